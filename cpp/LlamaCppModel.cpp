@@ -21,6 +21,10 @@
 #include "rn-utils.h"
 #include "rn-llama.h"
 #include "rn-multimodal.h"
+#include "rn-scheduler.h"
+#include "rn-session.h"
+#include "rn-prefix-cache.h"
+#include "rn-completion.h"
 
 // Include llama.cpp headers
 #include "llama.h"
@@ -39,31 +43,51 @@ namespace facebook::react {
 
 // ── CC-P2: Canonical lock hierarchy ──────────────────────────────────────────
 //
-// Three mutexes are used in LlamaCppModel. They MUST always be acquired in the
-// order listed below. Never acquire a lower-ranked mutex while holding a
+// Four locks are used in LlamaCppModel. They MUST always be acquired in the
+// order listed below. Never acquire a lower-ranked lock while holding a
 // higher-ranked one in the reverse order.
 //
-//   1. inference_mutex_       (rank 1 — outermost)
-//   2. predicting_cv_mutex_   (rank 2 — brief, only to set/clear is_predicting_)
-//   3. rn_ctx_->mutex         (rank 3 — innermost, only inside release())
+//   0. scheduler_gate_        (rank 0 — shared by scheduled completions, exclusive in release())
+//   1. inference_gate_        (rank 1 — rn_priority_gate; the batch scheduler worker takes it
+//                              per step. A preempted completion gives it up inside yield()
+//                              while holding nothing else.)
+//   2. predicting_cv_mutex_   (rank 2 — brief, only to count n_predicting_)
+//   3. rn_ctx_->mutex         (rank 3 — innermost: release(), the completion cache and
+//                              the chat session map)
 //
 // IMPORTANT INVARIANT in release():
 //   predicting_cv_mutex_ is acquired for wait_for() and then RELEASED (end of
-//   its {} block) BEFORE inference_mutex_ is acquired. The two mutexes are
+//   its {} block) BEFORE inference_gate_ is acquired. The two locks are
 //   therefore never held simultaneously in release(). Do not restructure
 //   release() in a way that holds both at the same time — that would create a
-//   deadlock with the inference path (which holds inference_mutex_ and then
+//   deadlock with the inference path (which holds inference_gate_ and then
 //   briefly acquires predicting_cv_mutex_ inside completion()).
 //
 // ─────────────────────────────────────────────────────────────────────────────
 
 LlamaCppModel::LlamaCppModel(rn_llama_context* rn_ctx, std::shared_ptr<CallInvoker> jsInvoker)
-    : rn_ctx_(rn_ctx), should_stop_completion_(false), is_predicting_(false), jsInvoker_(jsInvoker) {
+    : rn_ctx_(rn_ctx), should_stop_completion_(false), n_predicting_(0), jsInvoker_(jsInvoker),
+      workers_((rn_ctx ? std::max(1, rn_ctx->params.n_parallel_requests) : 1) + RN_WORKER_EXTRA_THREADS,
+               RN_WORKER_MAX_QUEUED) {
+  if (rn_ctx_ && rn_ctx_->ctx && rn_ctx_->params.n_parallel_requests > 1) {
+    scheduler_ = std::make_unique<rn_batch_scheduler>(
+        rn_ctx_, inference_gate_, rn_ctx_->params.n_parallel_requests);
+    rn_ctx_->scheduler = scheduler_.get();
+  }
+  if (rn_ctx_) {
+    rn_ctx_->gate = &inference_gate_;
+  }
 }
 
 LlamaCppModel::~LlamaCppModel() {
   // Note: We don't automatically release resources here
   // as the user should call release() explicitly
+  if (scheduler_) {
+    scheduler_->shutdown();
+    if (rn_ctx_) {
+      rn_ctx_->scheduler = nullptr;
+    }
+  }
 }
 
 void LlamaCppModel::release() {
@@ -73,20 +97,33 @@ void LlamaCppModel::release() {
     rn_ctx_->abort_generation = true;
   }
 
+  // Stop the batch scheduler first: it fails every queued and active scheduled request
+  // and joins its worker, so nothing below races with a scheduler step. Then wait for
+  // scheduled requests still in template rendering / tool parsing to leave.
+  // The gate stays held until the model is torn down so no new scheduled request can start.
+  std::unique_lock<std::shared_mutex> gate_lock(scheduler_gate_, std::defer_lock);
+  if (scheduler_) {
+    scheduler_->shutdown();
+    gate_lock.lock();
+  }
+
   // Wait for inference to finish using a condition variable.
   // With abort_callback set, this typically resolves within one token decode latency.
   {
     std::unique_lock<std::mutex> lock(predicting_cv_mutex_);
     predicting_cv_.wait_for(lock, std::chrono::milliseconds(500),
-                            [this] { return !is_predicting_.load(); });
+                            [this] { return n_predicting_.load() == 0; });
   }
 
-  // MS-P1 FIX: Acquire inference_mutex_ before touching rn_ctx_ so that release()
-  // cannot null rn_ctx_ while a background thread holds inference_mutex_ and is
-  // inside completion(). The wait_for above is a fast path (avoids holding the mutex
-  // for the full inference duration), but the mutex is the definitive safety net.
-  // Lock order: inference_mutex_ > rn_ctx_->mutex (consistent with all call sites).
-  std::lock_guard<std::mutex> inf_lock(inference_mutex_);
+  // MS-P1 FIX: Acquire inference_gate_ before touching rn_ctx_ so that release()
+  // cannot null rn_ctx_ while a background thread holds inference_gate_ and is
+  // inside completion(). The wait_for above is a fast path (avoids holding the gate
+  // for the full inference duration), but the gate is the definitive safety net.
+  // Completions parked by preemption still own a KV copy; cancelling them makes them
+  // resume first, drop it and leave before release() gets the gate.
+  // Lock order: inference_gate_ > rn_ctx_->mutex (consistent with all call sites).
+  inference_gate_.cancel_parked();
+  std::unique_lock<rn_priority_gate> inf_lock(inference_gate_);
 
   // Clean up our resources with proper mutex protection
   // NOTE: We do NOT manually free the context or model here because they are owned
@@ -99,9 +136,20 @@ void LlamaCppModel::release() {
     if (rn_ctx_->batches_initialized) {
       llama_batch_free(rn_ctx_->gen_batch);
       llama_batch_free(rn_ctx_->ingest_batch);
+      llama_batch_free(rn_ctx_->spec_batch);
       rn_ctx_->batches_initialized = false;
     }
 
+    // The draft model is owned by rn_ctx_ (not init_result_), so it can be freed here.
+    if (rn_ctx_->draft_loaded) {
+      llama_batch_free(rn_ctx_->draft_batch);
+      rn_ctx_->draft_ctx    = nullptr;
+      rn_ctx_->draft_model  = nullptr;
+      rn_ctx_->draft_init.reset();
+      rn_ctx_->draft_cache.clear();
+      rn_ctx_->draft_loaded = false;
+    }
+
     // Clear KV cache before context is freed (following server.cpp pattern)
     // This is safe even if context will be freed later by init_result_
     if (rn_ctx_->ctx) {
@@ -110,6 +158,17 @@ void LlamaCppModel::release() {
       } catch (...) {
         // Ignore errors during cache clearing
       }
+      rn_ctx_->kv_tokens.clear();
+      rn_ctx_->sessions.clear();
+      rn_ctx_->active_session = 0;
+      rn_ctx_->shared_prefix.prompt_id.clear();
+      rn_ctx_->shared_prefix.tokens.clear();
+      if (rn_ctx_->prefix_cache) {
+        rn_ctx_->prefix_cache->clear();
+      }
+      if (rn_ctx_->sampler_cache) {
+        rn_ctx_->sampler_cache->clear();
+      }
       
       // DO NOT call llama_free() here - init_result_ owns the context
       rn_ctx_->ctx = nullptr;
@@ -132,10 +191,12 @@ void LlamaCppModel::release() {
 
     // Reset state flags
     rn_ctx_->model_loaded = false;
+    rn_ctx_->scheduler = nullptr;
+    rn_ctx_->gate = nullptr;
 
     // MS-P1 FIX: Set is_released_ = true BEFORE nulling rn_ctx_ so that any background
-    // thread checking is_released_ inside inference_mutex_ sees the flag set before the
-    // pointer disappears. This is defense-in-depth on top of the inference_mutex_ guard.
+    // thread checking is_released_ inside inference_gate_ sees the flag set before the
+    // pointer disappears. This is defense-in-depth on top of the inference_gate_ guard.
     is_released_ = true;
 
     // Note: rn_ctx_ itself is owned by the module, so we don't delete it here
@@ -144,7 +205,16 @@ void LlamaCppModel::release() {
 
   // Reset our internal state
   should_stop_completion_ = false;
-  is_predicting_ = false;
+
+  // Let the tasks still queued or waiting on a lock run: they see is_released_ and
+  // reject their Promise. Both gates are dropped first so they can get through.
+  // release() runs on the JS thread, which those tasks settle their Promise through
+  // (invokeAsync), so the workers are not joined here; they exit once the queue drains.
+  inf_lock.unlock();
+  if (gate_lock.owns_lock()) {
+    gate_lock.unlock();
+  }
+  workers_.stop();
 }
 
 int32_t LlamaCppModel::getVocabSize() const {
@@ -178,6 +248,7 @@ void LlamaCppModel::setShouldStopCompletion(bool value) {
 // Parse the CompletionOptions from a JS object
 CompletionOptions LlamaCppModel::parseCompletionOptions(jsi::Runtime& rt, const jsi::Object& obj) {
   CompletionOptions options;
+  options.t_request = std::chrono::steady_clock::now();
 
   // Extract basic options
   if (obj.hasProperty(rt, "prompt") && !obj.getProperty(rt, "prompt").isUndefined()) {
@@ -223,15 +294,64 @@ CompletionOptions LlamaCppModel::parseCompletionOptions(jsi::Runtime& rt, const
     options.n_predict = obj.getProperty(rt, "max_tokens").asNumber();
   }
 
+  if (obj.hasProperty(rt, "max_time_ms") && !obj.getProperty(rt, "max_time_ms").isUndefined()) {
+    options.max_time_ms = std::max(0, static_cast<int>(obj.getProperty(rt, "max_time_ms").asNumber()));
+  }
+
+  if (obj.hasProperty(rt, "first_token_deadline_ms") && !obj.getProperty(rt, "first_token_deadline_ms").isUndefined()) {
+    options.first_token_deadline_ms =
+        std::max(0, static_cast<int>(obj.getProperty(rt, "first_token_deadline_ms").asNumber()));
+  }
+
+  if (obj.hasProperty(rt, "priority") && !obj.getProperty(rt, "priority").isUndefined()) {
+    const std::string name = obj.getProperty(rt, "priority").asString(rt).utf8(rt);
+    if (!rn_priority_from_name(name, options.priority)) {
+      throw std::runtime_error("priority must be 'interactive', 'normal' or 'background', got '" + name + "'");
+    }
+  }
+
+  if (obj.hasProperty(rt, "session_id") && !obj.getProperty(rt, "session_id").isUndefined()) {
+    options.session_id = static_cast<int32_t>(obj.getProperty(rt, "session_id").asNumber());
+  }
+
   if (obj.hasProperty(rt, "n_keep") && !obj.getProperty(rt, "n_keep").isUndefined()) {
     options.n_keep = obj.getProperty(rt, "n_keep").asNumber();
   }
 
+  if (obj.hasProperty(rt, "n") && !obj.getProperty(rt, "n").isUndefined()) {
+    options.n_choices = std::clamp(static_cast<int>(obj.getProperty(rt, "n").asNumber()), 1, RN_MAX_CHOICES);
+  }
+
+  if (obj.hasProperty(rt, "beam_width") && !obj.getProperty(rt, "beam_width").isUndefined()) {
+    options.beam_width = std::clamp(static_cast<int>(obj.getProperty(rt, "beam_width").asNumber()), 1, RN_MAX_BEAMS);
+  }
+
+  if (obj.hasProperty(rt, "logprobs") && !obj.getProperty(rt, "logprobs").isUndefined()) {
+    options.n_logprobs = std::clamp(static_cast<int>(obj.getProperty(rt, "logprobs").asNumber()), 0, RN_MAX_LOGPROBS);
+  }
+
   // Extract seed
   if (obj.hasProperty(rt, "seed") && !obj.getProperty(rt, "seed").isUndefined()) {
     options.seed = obj.getProperty(rt, "seed").asNumber();
   }
 
+  // Prompt-lookup speculative decoding
+  if (obj.hasProperty(rt, "prompt_lookup") && !obj.getProperty(rt, "prompt_lookup").isUndefined()) {
+    options.prompt_lookup = obj.getProperty(rt, "prompt_lookup").asBool();
+  }
+
+  if (obj.hasProperty(rt, "prompt_lookup_ngram") && !obj.getProperty(rt, "prompt_lookup_ngram").isUndefined()) {
+    options.prompt_lookup_ngram = static_cast<int>(obj.getProperty(rt, "prompt_lookup_ngram").asNumber());
+  }
+
+  if (obj.hasProperty(rt, "prompt_lookup_ngram_min") && !obj.getProperty(rt, "prompt_lookup_ngram_min").isUndefined()) {
+    options.prompt_lookup_ngram_min = static_cast<int>(obj.getProperty(rt, "prompt_lookup_ngram_min").asNumber());
+  }
+
+  if (obj.hasProperty(rt, "prompt_lookup_n_max") && !obj.getProperty(rt, "prompt_lookup_n_max").isUndefined()) {
+    options.prompt_lookup_n_max = static_cast<int>(obj.getProperty(rt, "prompt_lookup_n_max").asNumber());
+  }
+
   // KV cache control
   if (obj.hasProperty(rt, "reset_kv_cache") && !obj.getProperty(rt, "reset_kv_cache").isUndefined()) {
     options.reset_kv_cache = obj.getProperty(rt, "reset_kv_cache").asBool();
@@ -274,6 +394,10 @@ CompletionOptions LlamaCppModel::parseCompletionOptions(jsi::Runtime& rt, const
     options.stream = obj.getProperty(rt, "stream").asBool();
   }
 
+  if (obj.hasProperty(rt, "stream_deltas") && !obj.getProperty(rt, "stream_deltas").isUndefined()) {
+    options.stream_deltas = obj.getProperty(rt, "stream_deltas").asBool();
+  }
+
   // Convert messages and tools directly using jsiValueToJson — no manual field extraction.
   // This preserves all fields the model template needs (role, content, tool_calls, tool_call_id,
   // reasoning_content, name, etc.) exactly as the JS layer provides them, in the OpenAI-compatible
@@ -289,6 +413,8 @@ CompletionOptions LlamaCppModel::parseCompletionOptions(jsi::Runtime& rt, const
     auto toolsVal = obj.getProperty(rt, "tools").getObject(rt);
     if (toolsVal.isArray(rt)) {
       options.tools = jsiValueToJson(rt, jsi::Value(rt, std::move(toolsVal)));
+      // Hashed once here; chat_artifact_key keys render caches on it every request.
+      options.tools_hash = fnv1a_64(options.tools.dump());
     }
   }
 
@@ -316,7 +442,7 @@ CompletionOptions LlamaCppModel::parseCompletionOptions(jsi::Runtime& rt, const
 }
 
 // Modify the completion function to use this helper
-CompletionResult LlamaCppModel::completion(const CompletionOptions& options, std::function<void(jsi::Runtime&, const char*)> partialCallback, jsi::Runtime* runtime) {
+CompletionResult LlamaCppModel::completion(const CompletionOptions& options, std::function<void(jsi::Runtime&, const char*, const json*)> partialCallback, jsi::Runtime* runtime, const rn_priority_gate::ticket_ptr& ticket) {
   if (!rn_ctx_ || !rn_ctx_->model || !rn_ctx_->ctx) {
     CompletionResult result;
     result.content = "";
@@ -330,15 +456,25 @@ CompletionResult LlamaCppModel::completion(const CompletionOptions& options, std
   // Sampling overrides are applied per-request inside run_completion() on a LOCAL
   // copy of the sampling params — rn_ctx_->params is never mutated here.
 
+  // Delta events (stream_deltas) arrive right before the chunk they were parsed from and
+  // are handed to partialCallback together with it.
+  json pending_deltas = json::array();
+  auto on_deltas = [&pending_deltas](const json& events) {
+    pending_deltas.insert(pending_deltas.end(), events.begin(), events.end());
+  };
+
   // Check for a partial callback
-  auto callback_adapter = [&partialCallback, runtime, this](const std::string& token, bool is_done) -> bool {
-    // Check for stop condition first
-    if (should_stop_completion_) {
+  auto callback_adapter = [&partialCallback, &pending_deltas, &ticket, runtime, this](const std::string& token, bool is_done) -> bool {
+    // Check for stop condition first: stopCompletion() or stopCompletion(requestId)
+    if (should_stop_completion_ || (ticket && ticket->cancelled.load())) {
       return false; // Signal to stop completion
     }
     
-    if (partialCallback && runtime && !is_done) {
-      partialCallback(*runtime, token.c_str());
+    if (partialCallback && runtime && (!is_done || !pending_deltas.empty())) {
+      // The final parse may close tool calls after the last chunk: send those alone.
+      partialCallback(*runtime, is_done ? "" : token.c_str(),
+                      pending_deltas.empty() ? nullptr : &pending_deltas);
+      pending_deltas.clear();
     }
     
     // Return true to continue, false to stop
@@ -349,22 +485,32 @@ CompletionResult LlamaCppModel::completion(const CompletionOptions& options, std
   CompletionResult result;
 
   try {
-    // Reset stop signals BEFORE setting is_predicting, so any concurrent release()
-    // that fires after this point will set abort_generation=true and be respected.
-    should_stop_completion_ = false;
-    if (rn_ctx_) {
-      rn_ctx_->abort_generation = false;
-    }
-
-    // Set the predicting flag
+    // Stop state is per request (the ticket); the global flags belong to release() and
+    // are never reset here, so one request starting cannot undo a stop aimed at others.
     {
       std::lock_guard<std::mutex> cv_lock(predicting_cv_mutex_);
-      is_predicting_ = true;
+      n_predicting_++;
     }
 
-    if (!options.messages.empty()) {
-      // Chat completion (with messages)
-      result = run_chat_completion(rn_ctx_, options, callback_adapter);
+    // Bring the request's chat session into seq 0 (scheduled requests never touch it).
+    std::string session_error;
+    if (!options.use_scheduler && !rn_activate_session(rn_ctx_, options.session_id, session_error)) {
+      result.success = false;
+      result.error_msg = session_error;
+      result.error_type = RN_ERROR_INVALID_PARAM;
+    } else if (!options.messages.empty()) {
+      // Chat completion (with messages). options.use_scheduler is honoured inside.
+      result = run_chat_completion(rn_ctx_, options, callback_adapter,
+                                   options.stream_deltas ? rn_delta_callback(on_deltas) : nullptr);
+    } else if (options.use_scheduler) {
+      // Raw prompt on a batch scheduler slot
+      if (rn_ctx_->scheduler) {
+        result = rn_ctx_->scheduler->run(options, callback_adapter);
+      } else {
+        result.success = false;
+        result.error_msg = "Batch scheduler is not running";
+        result.error_type = RN_ERROR_CONTEXT;
+      }
     } else {
       // Regular completion (with prompt)
       result = run_completion(rn_ctx_, options, callback_adapter);
@@ -373,13 +519,13 @@ CompletionResult LlamaCppModel::completion(const CompletionOptions& options, std
     // Notify release() (or any waiter) that inference is done
     {
       std::lock_guard<std::mutex> cv_lock(predicting_cv_mutex_);
-      is_predicting_ = false;
+      n_predicting_--;
     }
     predicting_cv_.notify_all();
   } catch (const std::exception& e) {
     {
       std::lock_guard<std::mutex> cv_lock(predicting_cv_mutex_);
-      is_predicting_ = false;
+      n_predicting_--;
     }
     predicting_cv_.notify_all();
     result.success = false;
@@ -390,6 +536,17 @@ CompletionResult LlamaCppModel::completion(const CompletionOptions& options, std
   return result;
 }
 
+// Packs per-token logprobs into typed arrays: k alternatives per token, row-major.
+static jsi::Object logprobsToJsi(jsi::Runtime& rt, const CompletionResult& result) {
+  jsi::Object logprobs(rt);
+  logprobs.setProperty(rt, "k", jsi::Value(result.n_logprobs));
+  logprobs.setProperty(rt, "tokens", SystemUtils::toTypedArray(rt, result.tokens));
+  logprobs.setProperty(rt, "token_logprobs", SystemUtils::toTypedArray(rt, result.token_logprobs));
+  logprobs.setProperty(rt, "top_tokens", SystemUtils::toTypedArray(rt, result.top_tokens));
+  logprobs.setProperty(rt, "top_logprobs", SystemUtils::toTypedArray(rt, result.top_logprobs));
+  return logprobs;
+}
+
 // Helper to convert from the rn-utils CompletionResult to a JSI object
 jsi::Object LlamaCppModel::completionResultToJsi(jsi::Runtime& rt, const CompletionResult& result) {
   jsi::Object jsResult(rt);
@@ -411,6 +568,10 @@ jsi::Object LlamaCppModel::completionResultToJsi(jsi::Runtime& rt, const Complet
         jsonToJsi(rt, result.chat_response["choices"][0]["message"]["tool_calls"]));
     }
 
+    if (result.n_logprobs > 0) {
+      chatResponse.setProperty(rt, "logprobs", logprobsToJsi(rt, result));
+    }
+
     return chatResponse;
   }
 
@@ -423,12 +584,41 @@ jsi::Object LlamaCppModel::completionResultToJsi(jsi::Runtime& rt, const Complet
     timingsObj.setProperty(rt, "prompt_n",     jsi::Value(static_cast<double>(result.timings.prompt_n)));
     timingsObj.setProperty(rt, "prompt_ms",    jsi::Value(result.timings.prompt_ms));
     timingsObj.setProperty(rt, "total_ms",     jsi::Value(result.timings.total_ms));
+    if (result.timings.draft_n > 0) {
+      timingsObj.setProperty(rt, "draft_n",          jsi::Value(static_cast<double>(result.timings.draft_n)));
+      timingsObj.setProperty(rt, "draft_n_accepted", jsi::Value(static_cast<double>(result.timings.draft_n_accepted)));
+      timingsObj.setProperty(rt, "draft_acceptance_rate",
+          jsi::Value(static_cast<double>(result.timings.draft_n_accepted) / result.timings.draft_n));
+      if (result.timings.decode_passes > 0) {
+        timingsObj.setProperty(rt, "tokens_per_pass",
+            jsi::Value(static_cast<double>(result.n_predicted_tokens) / result.timings.decode_passes));
+      }
+    }
     jsResult.setProperty(rt, "timings", std::move(timingsObj));
   }
   jsResult.setProperty(rt, "success", jsi::Value(result.success));
   jsResult.setProperty(rt, "promptTokens", jsi::Value(result.n_prompt_tokens));
   jsResult.setProperty(rt, "completionTokens", jsi::Value(result.n_predicted_tokens));
   jsResult.setProperty(rt, "contextShifted", jsi::Value(result.context_shifted));
+  jsResult.setProperty(rt, "finish_reason",
+      jsi::String::createFromAscii(rt, finish_reason(result.stopped_by_length, result.stopped_by_time)));
+
+  // n > 1: same choice shape as chat completions.
+  if (!result.choices.empty()) {
+    json choices = json::array();
+    for (size_t i = 0; i < result.choices.size(); i++) {
+      choices.push_back({
+        {"index", i},
+        {"message", {{"role", "assistant"}, {"content", result.choices[i].content}}},
+        {"finish_reason", finish_reason(result.choices[i].stopped_by_length, result.choices[i].stopped_by_time)}
+      });
+    }
+    jsResult.setProperty(rt, "choices", jsonToJsi(rt, choices));
+  }
+
+  if (result.n_logprobs > 0) {
+    jsResult.setProperty(rt, "logprobs", logprobsToJsi(rt, result));
+  }
 
   if (!result.success) {
     jsResult.setProperty(rt, "error", jsi::String::createFromUtf8(rt, result.error_msg));
@@ -521,6 +711,50 @@ json LlamaCppModel::jsiValueToJson(jsi::Runtime& rt, const jsi::Value& val) {
     return nullptr;
 }
 
+// Queues an async JSI method's work on the model's worker pool. When the bounded queue is
+// full (or the model was released) the Promise is rejected right away and false returned.
+static bool submit_or_reject(jsi::Runtime& rt, rn_worker_pool& pool, rn_priority priority,
+                             const std::shared_ptr<jsi::Function>& reject, std::function<void()> task) {
+  if (pool.submit(std::move(task), priority)) {
+    return true;
+  }
+  reject->call(rt, jsi::String::createFromUtf8(rt, pool.accepting() ? "inference queue is full" : "model released"));
+  return false;
+}
+
+// Reads the optional `priority` field of a multimodal options object into `priority`.
+static void parse_priority_option(jsi::Runtime& rt, const jsi::Object& opts, rn_priority& priority) {
+  if (opts.hasProperty(rt, "priority") && opts.getProperty(rt, "priority").isString()) {
+    const std::string name = opts.getProperty(rt, "priority").asString(rt).utf8(rt);
+    if (!rn_priority_from_name(name, priority)) {
+      throw jsi::JSError(rt, "priority must be 'interactive', 'normal' or 'background', got '" + name + "'");
+    }
+  }
+}
+
+// Appends stream_deltas events to a pending batch, merging each one into the previous
+// event when it continues it (same text channel, or more arguments of the same tool call),
+// so a 33ms flush carries a few events rather than one per token.
+static void append_delta_events(json& batch, const json& events) {
+  for (const auto& ev : events) {
+    if (!batch.empty()) {
+      json& last = batch.back();
+      const std::string& type = ev["type"].get_ref<const std::string&>();
+      if (last["type"] == type) {
+        if (type == "content" || type == "reasoning_content") {
+          last["text"] = last["text"].get<std::string>() + ev["text"].get<std::string>();
+          continue;
+        }
+        if (type == "tool_call" && last["index"] == ev["index"] && !ev.contains("name") && !ev.contains("id")) {
+          last["arguments"] = last["arguments"].get<std::string>() + ev["arguments"].get<std::string>();
+          continue;
+        }
+      }
+    }
+    batch.push_back(ev);
+  }
+}
+
 // JSI method for completions (synchronous - kept for compatibility)
 jsi::Value LlamaCppModel::completionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count) {
   if (count < 1 || !args[0].isObject()) {
@@ -528,13 +762,16 @@ jsi::Value LlamaCppModel::completionJsi(jsi::Runtime& rt, const jsi::Value* args
   }
 
   // Create partial callback function for token streaming
-  std::function<void(jsi::Runtime&, const char*)> partialCallback = nullptr;
+  std::function<void(jsi::Runtime&, const char*, const json*)> partialCallback = nullptr;
 
   if (count > 1 && args[1].isObject() && args[1].getObject(rt).isFunction(rt)) {
     auto callbackFn = std::make_shared<jsi::Function>(args[1].getObject(rt).getFunction(rt));
-    partialCallback = [callbackFn](jsi::Runtime& rt, const char* token) {
+    partialCallback = [this, callbackFn](jsi::Runtime& rt, const char* token, const json* deltas) {
       jsi::Object data(rt);
       data.setProperty(rt, "token", jsi::String::createFromUtf8(rt, token));
+      if (deltas) {
+        data.setProperty(rt, "deltas", jsonToJsi(rt, *deltas));
+      }
       callbackFn->call(rt, data);
     };
   }
@@ -546,14 +783,21 @@ jsi::Value LlamaCppModel::completionJsi(jsi::Runtime& rt, const jsi::Value* args
     // Set streaming flag based on callback presence
     options.stream = (partialCallback != nullptr);
 
-    // CC-P1 FIX: Acquire inference_mutex_ before calling completion() so that
+    // CC-P1 FIX: Acquire inference_gate_ before calling completion() so that
     // completionJsi (sync path) cannot race with completionAsyncJsi (async path)
-    // on kv_messages / completion_cache inside run_chat_completion().
-    // Lock order: inference_mutex_ > rn_ctx_->mutex (consistent with all call sites).
+    // on kv_messages / completion_cache inside run_chat_completion(). The JS thread is
+    // blocked here, so the sync path queues as interactive and is never preempted.
+    // Lock order: inference_gate_ > rn_ctx_->mutex (consistent with all call sites).
+    // A ticket of its own so stopCompletion() without an id reaches this request too.
+    auto ticket = inference_gate_.make_ticket(RN_PRIORITY_INTERACTIVE, /*preemptible=*/false);
+    options.cancelled = std::shared_ptr<const std::atomic<bool>>(ticket, &ticket->cancelled);
     CompletionResult result;
     {
-      std::lock_guard<std::mutex> inf_lock(inference_mutex_);
-      result = completion(options, partialCallback, &rt);
+      rn_gate_lock inf_lock(inference_gate_, ticket);
+      if (!inf_lock.owns_lock()) {
+        throw std::runtime_error("request cancelled");
+      }
+      result = completion(options, partialCallback, &rt, ticket);
     }
 
     // Convert the result to a JSI object using our helper
@@ -589,6 +833,22 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
     throw jsi::JSError(rt, e.what());
   }
 
+  // Route text-only requests through the batch scheduler when it is running. Media
+  // messages, n > 1 and beam search (which fork seq 0), logprobs, chat sessions and the
+  // sync completion path stay on seq 0 under inference_gate_.
+  const bool has_media = rn_ctx_ && rn_ctx_->multimodal_loaded && messages_contain_media(options.messages);
+  const bool multi_seq = options.n_choices > 1 || options.beam_width > 1;
+  options.use_scheduler = scheduler_ != nullptr && !multi_seq && options.n_logprobs == 0 &&
+      options.session_id == 0 && !has_media;
+
+  // The request's place on the inference gate. Its id is handed back as the Promise's
+  // requestId so stopCompletion(requestId) can cancel this request alone, queued, running
+  // or preempted. Only the single-sequence text loop has preemption points: n > 1 and
+  // beam search keep several sequences in flight and media prompts have no token ids to
+  // re-decode from, so those tickets are not preemptible and never raise should_yield().
+  auto ticket = inference_gate_.make_ticket(options.priority, /*preemptible=*/!multi_seq && !has_media);
+  options.cancelled = std::shared_ptr<const std::atomic<bool>>(ticket, &ticket->cancelled);
+
   // Create Promise constructor
   auto Promise = rt.global().getPropertyAsFunction(rt, "Promise");
   
@@ -596,7 +856,7 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
     rt,
     jsi::PropNameID::forAscii(rt, "executor"),
     2,
-    [this, options, callbackFn](jsi::Runtime& runtime, const jsi::Value& thisValue, const jsi::Value* args, size_t count) -> jsi::Value {
+    [this, options, callbackFn, ticket](jsi::Runtime& runtime, const jsi::Value& thisValue, const jsi::Value* args, size_t count) -> jsi::Value {
       
       auto resolve = std::make_shared<jsi::Function>(args[0].asObject(runtime).asFunction(runtime));
       auto reject = std::make_shared<jsi::Function>(args[1].asObject(runtime).asFunction(runtime));
@@ -606,8 +866,8 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
       auto invoker = jsInvoker_;
       auto selfPtr = shared_from_this(); // This requires LlamaCppModel to inherit from std::enable_shared_from_this
       
-      // Launch background thread for completion
-      std::thread([selfPtr, options, callbackFn, resolve, reject, runtimePtr, invoker]() {
+      // Run the completion on the model's worker pool
+      submit_or_reject(runtime, selfPtr->workers_, options.priority, reject, [selfPtr, options, callbackFn, ticket, resolve, reject, runtimePtr, invoker]() {
         // Change 2: guard against model being released before the thread even starts.
         if (selfPtr->is_released_.load()) {
           try { invoker->invokeAsync([reject, runtimePtr]() {
@@ -627,11 +887,12 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
           // flushPtr is a shared_ptr<function> so both the partialCallback lambda and the
           // post-completion drain call can reach the same instance without capturing a local
           // by reference (which would dangle once the if-block ends).
-          std::function<void(jsi::Runtime&, const char*)> partialCallback = nullptr;
+          std::function<void(jsi::Runtime&, const char*, const json*)> partialCallback = nullptr;
           auto flushPtr = std::make_shared<std::function<void()>>();
 
           if (callbackFn && invoker) {
             auto tokenBatch   = std::make_shared<std::string>();
+            auto deltaBatch   = std::make_shared<json>(json::array());
             // pendingCount: back-pressure gauge for in-flight invokeAsync closures.
             // shared_ptr<atomic> so the JS-thread lambda can decrement after it fires.
             // memory_order_relaxed is correct: saturation gauge with no dependent memory.
@@ -639,17 +900,19 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
             auto lastFlush    = std::make_shared<std::chrono::steady_clock::time_point>(
                 std::chrono::steady_clock::now());
 
-            *flushPtr = [callbackFn, invoker, runtimePtr, tokenBatch, selfPtr,
+            *flushPtr = [callbackFn, invoker, runtimePtr, tokenBatch, deltaBatch, selfPtr,
                          pendingCount]() {
-              if (tokenBatch->empty()) return;
+              if (tokenBatch->empty() && deltaBatch->empty()) return;
               // Back-pressure: if ≥3 invokeAsync closures are already queued on the JS
               // thread, hold. Tokens accumulate in tokenBatch; next 33ms tick picks them up.
               if (pendingCount->load(std::memory_order_relaxed) >= 3) return;
               pendingCount->fetch_add(1, std::memory_order_relaxed);
               auto batchStr = std::make_shared<std::string>(std::move(*tokenBatch));
               tokenBatch->clear();
+              auto batchDeltas = std::make_shared<json>(std::move(*deltaBatch));
+              *deltaBatch = json::array();
               try {
-                invoker->invokeAsync([callbackFn, batchStr, runtimePtr, selfPtr,
+                invoker->invokeAsync([callbackFn, batchStr, batchDeltas, runtimePtr, selfPtr,
                                       pendingCount]() {
                   pendingCount->fetch_sub(1, std::memory_order_relaxed);
                   if (selfPtr->is_released_.load()) return;
@@ -657,6 +920,10 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
                     jsi::Object data(*runtimePtr);
                     data.setProperty(*runtimePtr, "token",
                         jsi::String::createFromUtf8(*runtimePtr, *batchStr));
+                    if (!batchDeltas->empty()) {
+                      data.setProperty(*runtimePtr, "deltas",
+                          selfPtr->jsonToJsi(*runtimePtr, *batchDeltas));
+                    }
                     callbackFn->call(*runtimePtr, data);
                   } catch (...) {}
                 });
@@ -670,9 +937,13 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
             // - Slow models (5 tok/s): 200ms >> 33ms → every token dispatched immediately.
             // - Fast models (50 tok/s): ~1-2 tokens per flush → smooth display.
             // - Thinking mode (200 tok/s): ~6-7 tokens per flush → 30 invokeAsync/s, Jetsam-safe.
-            partialCallback = [flushPtr, tokenBatch, lastFlush](jsi::Runtime&,
-                                                                 const char* token) {
+            partialCallback = [flushPtr, tokenBatch, deltaBatch, lastFlush](jsi::Runtime&,
+                                                                             const char* token,
+                                                                             const json* deltas) {
               *tokenBatch += token;
+              if (deltas) {
+                append_delta_events(*deltaBatch, *deltas);
+              }
               auto now = std::chrono::steady_clock::now();
               if (now - *lastFlush >= std::chrono::milliseconds(33)) {
                 *lastFlush = now;
@@ -681,15 +952,34 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
             };
           }
 
-          // Change 3: serialize with multimodal functions via inference_mutex_.
+          // Change 3: serialize with multimodal functions via inference_gate_.
           // completionAsyncJsi previously only held rn_ctx_->mutex (acquired inside
-          // completion()), while runOnFrameJsi / embedImageJsi use inference_mutex_.
+          // completion()), while runOnFrameJsi / embedImageJsi use the inference lock.
           // These are independent locks, so concurrent text + multimodal inference would
           // both touch rn_ctx_->ctx simultaneously — a data race on the llama context.
+          // The gate queues by options.priority and lets a higher class preempt this
+          // request at prefill-chunk and token boundaries (see run_completion).
+          //
+          // Scheduled requests skip inference_gate_: the scheduler worker takes it once
+          // per decode step, so concurrent requests share forward passes instead of
+          // queueing here. scheduler_gate_ keeps rn_ctx_ alive until they return.
           CompletionResult result;
           {
-            std::lock_guard<std::mutex> inf_lock(selfPtr->inference_mutex_);
-            // Change 2: re-check after potentially waiting on the mutex.
+            std::shared_lock<std::shared_mutex> gate_lock(selfPtr->scheduler_gate_, std::defer_lock);
+            std::optional<rn_gate_lock> inf_lock;
+            if (options.use_scheduler) {
+              gate_lock.lock();
+            } else {
+              inf_lock.emplace(selfPtr->inference_gate_, ticket);
+              if (!inf_lock->owns_lock()) {
+                try { invoker->invokeAsync([reject, runtimePtr]() {
+                  try { reject->call(*runtimePtr, jsi::String::createFromUtf8(*runtimePtr,
+                      "request cancelled")); } catch (...) {}
+                }); } catch (...) {}
+                return;
+              }
+            }
+            // Change 2: re-check after potentially waiting on the gate.
             if (selfPtr->is_released_.load()) {
               try { invoker->invokeAsync([reject, runtimePtr]() {
                 try { reject->call(*runtimePtr, jsi::String::createFromUtf8(*runtimePtr,
@@ -697,7 +987,7 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
               }); } catch (...) {}
               return;
             }
-            result = selfPtr->completion(options, partialCallback, runtimePtr);
+            result = selfPtr->completion(options, partialCallback, runtimePtr, ticket);
           }
 
           // Drain any tokens buffered since the last 33ms flush tick.
@@ -738,19 +1028,26 @@ jsi::Value LlamaCppModel::completionAsyncJsi(jsi::Runtime& rt, const jsi::Value*
             try { reject->call(*runtimePtr, jsi::String::createFromUtf8(*runtimePtr, "completion failed (unknown exception)")); } catch (...) {}
           }); } catch (...) {}
         }
-      }).detach();
+      });
       
       return jsi::Value::undefined();
     }
   );
   
-  return Promise.callAsConstructor(rt, std::move(executor));
+  jsi::Object promise = Promise.callAsConstructor(rt, std::move(executor)).asObject(rt);
+  promise.setProperty(rt, "requestId", jsi::Value(static_cast<double>(ticket->id)));
+  return promise;
 }
 
-// JSI method for stopping completion
+// JSI method for stopping completion. With a requestId only that request stops (false if
+// it already finished); without one every completion issued so far stops: queued, running
+// (seq 0 or scheduled) and preempted. Requests made afterwards are not affected.
 jsi::Value LlamaCppModel::stopCompletionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count) {
   try {
-    setShouldStopCompletion(true);
+    if (count > 0 && args[0].isNumber()) {
+      return jsi::Value(inference_gate_.cancel(static_cast<uint64_t>(args[0].asNumber())));
+    }
+    inference_gate_.cancel_all();
     return jsi::Value(true);
   } catch (const std::exception& e) {
     throw jsi::JSError(rt, e.what());
@@ -811,28 +1108,29 @@ jsi::Value LlamaCppModel::tokenizeJsi(jsi::Runtime& rt, const jsi::Value* args,
 
     // Create result object with tokens array
     jsi::Object result(rt);
-    jsi::Array tokensArray(rt, tokens.size());
+    result.setProperty(rt, "count", jsi::Value(static_cast<int>(tokens.size())));
+
+    if (!with_pieces) {
+      // Token IDs only: hand the vector over as an Int32Array
+      result.setProperty(rt, "tokens", SystemUtils::toTypedArray(rt, std::move(tokens)));
+      return result;
+    }
 
     // Fill the tokens array with token IDs and text
+    jsi::Array tokensArray(rt, tokens.size());
     for (size_t i = 0; i < tokens.size(); i++) {
-      if (with_pieces) {
-        // Create an object with ID and piece text
-        jsi::Object tokenObj(rt);
-        tokenObj.setProperty(rt, "id", jsi::Value(static_cast<int>(tokens[i])));
+      // Create an object with ID and piece text
+      jsi::Object tokenObj(rt);
+      tokenObj.setProperty(rt, "id", jsi::Value(static_cast<int>(tokens[i])));
 
-        // Get the text piece for this token
-        std::string piece = common_token_to_piece(rn_ctx_->vocab, tokens[i]);
-        tokenObj.setProperty(rt, "text", jsi::String::createFromUtf8(rt, piece));
+      // Get the text piece for this token (a view into the model's piece table)
+      const std::string_view piece = rn_ctx_->pieces.piece(tokens[i]);
+      tokenObj.setProperty(rt, "text", jsi::String::createFromUtf8(
+          rt, reinterpret_cast<const uint8_t*>(piece.data()), piece.size()));
 
-        tokensArray.setValueAtIndex(rt, i, tokenObj);
-      } else {
-        // Just add the token ID
-        tokensArray.setValueAtIndex(rt, i, jsi::Value(static_cast<int>(tokens[i])));
-      }
+      tokensArray.setValueAtIndex(rt, i, tokenObj);
     }
-
     result.setProperty(rt, "tokens", tokensArray);
-    result.setProperty(rt, "count", jsi::Value(static_cast<int>(tokens.size())));
 
     return result;
   } catch (const std::exception& e) {
@@ -854,38 +1152,37 @@ jsi::Value LlamaCppModel::detokenizeJsi(jsi::Runtime& rt, const jsi::Value* args
     }
 
     auto tokensVal = options.getProperty(rt, "tokens").getObject(rt);
-    if (!tokensVal.isArray(rt)) {
-      throw jsi::JSError(rt, "tokens must be an array");
-    }
-
-    jsi::Array tokensArr = tokensVal.getArray(rt);
-    auto token_count = static_cast<int>(tokensArr.size(rt));
 
     if (!rn_ctx_ || !rn_ctx_->model || !rn_ctx_->vocab) {
       throw std::runtime_error("Model not loaded or vocab not available");
     }
 
-    // Create a vector of token IDs
+    // Create a vector of token IDs: an Int32Array (tokenize() output) is read in one copy
     std::vector<llama_token> tokens;
-    tokens.reserve(token_count);
-
-    for (int i = 0; i < token_count; i++) {
-      auto val = tokensArr.getValueAtIndex(rt, i);
-      if (val.isNumber()) {
-        tokens.push_back(static_cast<llama_token>(val.asNumber()));
-      } else if (val.isObject() && val.getObject(rt).hasProperty(rt, "id")) {
-        auto id = val.getObject(rt).getProperty(rt, "id");
-        if (id.isNumber()) {
-          tokens.push_back(static_cast<llama_token>(id.asNumber()));
+    if (!SystemUtils::fromTypedArray(rt, tokensVal, tokens)) {
+      if (!tokensVal.isArray(rt)) {
+        throw jsi::JSError(rt, "tokens must be an array or an Int32Array");
+      }
+
+      jsi::Array tokensArr = tokensVal.getArray(rt);
+      auto token_count = static_cast<int>(tokensArr.size(rt));
+      tokens.reserve(token_count);
+
+      for (int i = 0; i < token_count; i++) {
+        auto val = tokensArr.getValueAtIndex(rt, i);
+        if (val.isNumber()) {
+          tokens.push_back(static_cast<llama_token>(val.asNumber()));
+        } else if (val.isObject() && val.getObject(rt).hasProperty(rt, "id")) {
+          auto id = val.getObject(rt).getProperty(rt, "id");
+          if (id.isNumber()) {
+            tokens.push_back(static_cast<llama_token>(id.asNumber()));
+          }
         }
       }
     }
 
-    // Use common_token_to_piece for each token and concatenate the results
-    std::string result_text;
-    for (auto token : tokens) {
-      result_text += common_token_to_piece(rn_ctx_->vocab, token);
-    }
+    // Gather the pieces from the model's piece table
+    const std::string result_text = rn_ctx_->pieces.detokenize(tokens.data(), tokens.size());
 
     // Create result object
     jsi::Object result(rt);
@@ -906,18 +1203,85 @@ int32_t LlamaCppModel::getEmbeddingSize() const {
   return llama_model_n_embd(rn_ctx_->model);
 }
 
-// Fixed embeddingJsi method with corrected API calls
+// Decodes `tokens` on seq 0 in embedding mode and copies the sequence embedding (pooling
+// models) or the last token's normalized embedding into `out`. Caller holds inference_gate_.
+static bool embed_tokens(rn_llama_context* rn_ctx, const std::vector<llama_token>& tokens,
+                         std::vector<float>& out, std::string& error) {
+  // Clear seq 0 to ensure clean embedding (scheduler slots keep their sequences)
+  rn_clear_sequence(rn_ctx, 0);
+
+  // Enable embedding mode for this decode only
+  llama_set_embeddings(rn_ctx->ctx, true);
+
+  // Create and populate batch using common_batch functions (following embedding.cpp pattern)
+  llama_batch batch = llama_batch_init(tokens.size(), 0, 1);
+  common_batch_clear(batch);
+  const llama_seq_id seq_id = 0;
+  // Only the last token needs an output: pooling models pool the whole sequence, and
+  // non-pooling models use the final token's embedding for OpenAI compatibility.
+  for (int i = 0; i < (int)tokens.size(); i++) {
+    common_batch_add(batch, tokens[i], i, {seq_id}, i == (int)tokens.size() - 1);
+  }
+
+  const int ret = rn_decode(rn_ctx, batch);
+  llama_batch_free(batch);
+  const int n_embd_out = llama_model_n_embd_out(rn_ctx->model);
+  const enum llama_pooling_type pooling_type = llama_pooling_type(rn_ctx->ctx);
+
+  const float* embd = nullptr;
+  if (ret == 0 && n_embd_out > 0) {
+    embd = pooling_type == LLAMA_POOLING_TYPE_NONE
+        ? llama_get_embeddings_ith(rn_ctx->ctx, -1)
+        : llama_get_embeddings_seq(rn_ctx->ctx, seq_id);
+    if (embd) {
+      out.assign(embd, embd + n_embd_out);
+    }
+  }
+  llama_set_embeddings(rn_ctx->ctx, rn_ctx->params.embedding);
+  // Seq 0 now holds the embedded text, not a conversation.
+  rn_clear_sequence(rn_ctx, 0);
+
+  if (ret != 0) {
+    error = "Failed to decode tokens for embedding";
+    return false;
+  }
+  if (n_embd_out <= 0) {
+    error = "Invalid embedding output dimension";
+    return false;
+  }
+  if (!embd) {
+    error = "Failed to extract embeddings - model may not support embeddings or pooling configuration is invalid";
+    return false;
+  }
+
+  // Normalize only for non-pooling models. Pooling models (MEAN, CLS, LAST) already
+  // return normalized embeddings — applying L2 norm again causes numerical drift.
+  if (pooling_type == LLAMA_POOLING_TYPE_NONE) {
+    std::vector<float> normalized(n_embd_out);
+    common_embd_normalize(out.data(), normalized.data(), n_embd_out, 2);
+    out = std::move(normalized);
+  }
+  return true;
+}
+
+// embedding(options): Promise<EmbeddingResponse>. Tokenizes on the JS thread, then decodes
+// on the worker pool under inference_gate_ like the other gated calls, so the JS thread
+// never waits behind a running completion.
 jsi::Value LlamaCppModel::embeddingJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count) {
   if (count < 1 || !args[0].isObject()) {
     throw jsi::JSError(rt, "embedding requires an options object with 'input' or 'content' field");
   }
 
+  std::string content;
+  std::string encoding_format = "float";
+  std::string model_name = "llamacpp";
+  bool add_bos = true;
+  rn_priority priority = RN_PRIORITY_NORMAL;
+  std::vector<llama_token> tokens;
   try {
     jsi::Object options = args[0].getObject(rt);
 
     // Extract required content parameter, support both 'input' (OpenAI) and 'content' (custom format)
-    std::string content;
-
     if (options.hasProperty(rt, "input") && options.getProperty(rt, "input").isString()) {
       content = options.getProperty(rt, "input").getString(rt).utf8(rt);
     } else if (options.hasProperty(rt, "content") && options.getProperty(rt, "content").isString()) {
@@ -927,26 +1291,26 @@ jsi::Value LlamaCppModel::embeddingJsi(jsi::Runtime& rt, const jsi::Value* args,
     }
 
     // Check optional parameters
-    std::string encoding_format = "float";
     if (options.hasProperty(rt, "encoding_format") && options.getProperty(rt, "encoding_format").isString()) {
       encoding_format = options.getProperty(rt, "encoding_format").getString(rt).utf8(rt);
       if (encoding_format != "float" && encoding_format != "base64") {
         throw jsi::JSError(rt, "encoding_format must be either 'float' or 'base64'");
       }
     }
-
-    bool add_bos = true;
     if (options.hasProperty(rt, "add_bos_token") && options.getProperty(rt, "add_bos_token").isBool()) {
       add_bos = options.getProperty(rt, "add_bos_token").getBool();
     }
+    if (options.hasProperty(rt, "model") && options.getProperty(rt, "model").isString()) {
+      model_name = options.getProperty(rt, "model").getString(rt).utf8(rt);
+    }
+    parse_priority_option(rt, options, priority);
 
     // Check model and context
-    if (!rn_ctx_ || !rn_ctx_->model || !rn_ctx_->ctx || !rn_ctx_->vocab) {
+    if (!rn_ctx_ || !rn_ctx_->model || !rn_ctx_->ctx || !rn_ctx_->vocab || is_released_) {
       throw std::runtime_error("Model not loaded or context not initialized");
     }
 
-    // Tokenize the input text
-    std::vector<llama_token> tokens;
+    // Tokenize the input text (vocab only, no context state)
     int n_tokens = llama_tokenize(rn_ctx_->vocab, content.c_str(), content.length(), nullptr, 0, add_bos, true);
     if (n_tokens < 0) {
       n_tokens = -n_tokens;
@@ -957,133 +1321,89 @@ jsi::Value LlamaCppModel::embeddingJsi(jsi::Runtime& rt, const jsi::Value* args,
       throw std::runtime_error("Tokenization failed for embedding");
     }
     tokens.resize(n_tokens);
+  } catch (const jsi::JSError&) {
+    throw;
+  } catch (const std::exception& e) {
+    throw jsi::JSError(rt, std::string("Embedding error: ") + e.what());
+  }
 
-    if (tokens.empty()) {
-      throw jsi::JSError(rt, "No tokens generated from input text");
-    }
-
-    // Clear the context KV cache to ensure clean embedding
-    llama_memory_clear(llama_get_memory(rn_ctx_->ctx), true);
-
-    // Enable embedding mode
-    llama_set_embeddings(rn_ctx_->ctx, true);
-
-    // Create and populate batch using common_batch functions (following embedding.cpp pattern)
-    llama_batch batch = llama_batch_init(tokens.size(), 0, 1);
-    
-    common_batch_clear(batch);
-    const llama_seq_id seq_id = 0;
-    // For embeddings, we need logits for the token(s) that will produce embeddings
-    // For pooling models: typically only the last token needs logits (sequence-level embedding)
-    // For non-pooling models: we can get token-level embeddings, but for OpenAI compatibility
-    // we typically want a single embedding, so we'll use the last token
-    for (int i = 0; i < (int)tokens.size(); i++) {
-      // Set logits for the last token (for both pooling and non-pooling, we want the final embedding)
-      bool needs_logits = (i == (int)tokens.size() - 1);
-      common_batch_add(batch, tokens[i], i, {seq_id}, needs_logits);
-    }
-
-    if (llama_decode(rn_ctx_->ctx, batch) != 0) {
-      llama_batch_free(batch);
-      throw std::runtime_error("Failed to decode tokens for embedding");
-    }
-
-    // Get embedding output size from the model (may differ from input size)
-    const int n_embd_out = llama_model_n_embd_out(rn_ctx_->model);
-    if (n_embd_out <= 0) {
-      llama_batch_free(batch);
-      throw std::runtime_error("Invalid embedding output dimension");
-    }
-
-    // Get the pooling type to determine which API to use
-    const enum llama_pooling_type pooling_type = llama_pooling_type(rn_ctx_->ctx);
-    
-    // Get the embeddings based on pooling type (following embedding.cpp pattern)
-    std::vector<float> embedding_vec(n_embd_out);
-    const float* embd = nullptr;
-
-    if (pooling_type == LLAMA_POOLING_TYPE_NONE) {
-      // For non-pooling models, get the token-level embedding for the last token
-      // Since we only set logits for the last token, the batch index is batch.n_tokens - 1
-      // The index in llama_get_embeddings_ith refers to the batch position
-      int last_token_batch_idx = batch.n_tokens - 1;
-      if (last_token_batch_idx < 0 || !batch.logits[last_token_batch_idx]) {
-        llama_batch_free(batch);
-        throw std::runtime_error("No tokens with logits found in batch");
-      }
-      embd = llama_get_embeddings_ith(rn_ctx_->ctx, last_token_batch_idx);
-    } else {
-      // For pooling models, get the sequence-level embedding
-      embd = llama_get_embeddings_seq(rn_ctx_->ctx, seq_id);
-    }
-
-    llama_batch_free(batch);
-
-    if (!embd) {
-      throw std::runtime_error("Failed to extract embeddings - model may not support embeddings or pooling configuration is invalid");
-    }
-
-    // Copy embeddings to our vector
-    std::copy(embd, embd + n_embd_out, embedding_vec.begin());
-
-    // Normalize only for non-pooling models. Pooling models (MEAN, CLS, LAST) already
-    // return normalized embeddings — applying L2 norm again causes numerical drift.
-    if (pooling_type == LLAMA_POOLING_TYPE_NONE) {
-      std::vector<float> normalized_vec(n_embd_out);
-      common_embd_normalize(embedding_vec.data(), normalized_vec.data(), n_embd_out, 2);
-      embedding_vec = std::move(normalized_vec);
-    }
-
-    // Create OpenAI-compatible response
-    jsi::Object response(rt);
-
-    // Add embedding data
-    jsi::Array dataArray(rt, 1);
-    jsi::Object embeddingObj(rt);
-
-    if (encoding_format == "base64") {
-      // Base64 encode the embedding vector
-      const char* data_ptr = reinterpret_cast<const char*>(embedding_vec.data());
-      size_t data_size = embedding_vec.size() * sizeof(float);
-      std::string base64_str = base64::encode(data_ptr, data_size);
-
-      embeddingObj.setProperty(rt, "embedding", jsi::String::createFromUtf8(rt, base64_str));
-      embeddingObj.setProperty(rt, "encoding_format", jsi::String::createFromUtf8(rt, "base64"));
-    } else {
-      // Create embedding array of floats
-      jsi::Array embeddingArray(rt, n_embd_out);
-      for (int i = 0; i < n_embd_out; i++) {
-        embeddingArray.setValueAtIndex(rt, i, jsi::Value(embedding_vec[i]));
-      }
-      embeddingObj.setProperty(rt, "embedding", embeddingArray);
-    }
-
-    embeddingObj.setProperty(rt, "object", jsi::String::createFromUtf8(rt, "embedding"));
-    embeddingObj.setProperty(rt, "index", jsi::Value(0));
-
-    dataArray.setValueAtIndex(rt, 0, embeddingObj);
+  if (tokens.empty()) {
+    throw jsi::JSError(rt, "No tokens generated from input text");
+  }
 
-    // Create model info
-    std::string model_name = "llamacpp";
-    if (options.hasProperty(rt, "model") && options.getProperty(rt, "model").isString()) {
-      model_name = options.getProperty(rt, "model").getString(rt).utf8(rt);
-    }
+  auto Promise = rt.global().getPropertyAsFunction(rt, "Promise");
+  auto invoker = jsInvoker_;
+  auto selfPtr = shared_from_this();
 
-    // Create usage info
-    jsi::Object usage(rt);
-    usage.setProperty(rt, "prompt_tokens", jsi::Value(static_cast<int>(tokens.size())));
-    usage.setProperty(rt, "total_tokens", jsi::Value(static_cast<int>(tokens.size())));
+  auto executor = jsi::Function::createFromHostFunction(
+    rt, jsi::PropNameID::forAscii(rt, "executor"), 2,
+    [selfPtr, tokens, encoding_format, model_name, priority, invoker](
+        jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* a, size_t) -> jsi::Value {
+      auto resolve = std::make_shared<jsi::Function>(a[0].asObject(runtime).asFunction(runtime));
+      auto reject  = std::make_shared<jsi::Function>(a[1].asObject(runtime).asFunction(runtime));
+      auto rtPtr   = &runtime;
 
-    // Assemble the response
-    response.setProperty(rt, "object", jsi::String::createFromUtf8(rt, "list"));
-    response.setProperty(rt, "data", dataArray);
-    response.setProperty(rt, "model", jsi::String::createFromUtf8(rt, model_name));
-    response.setProperty(rt, "usage", usage);
+      submit_or_reject(runtime, selfPtr->workers_, priority, reject, [selfPtr, tokens, encoding_format, model_name, priority, resolve, reject, invoker, rtPtr]() {
+        // Shared so the invokeAsync callback (a copyable std::function) can move it out
+        auto embedding = std::make_shared<std::vector<float>>();
+        std::string error;
+        bool ok = false;
+        {
+          rn_gate_lock lock(selfPtr->inference_gate_, priority);
+          if (selfPtr->is_released_) {
+            error = "model released";
+          } else {
+            // A chat session's KV on seq 0 is parked first; the embedding overwrites seq 0.
+            rn_activate_session(selfPtr->rn_ctx_, 0, error);
+            ok = embed_tokens(selfPtr->rn_ctx_, tokens, *embedding, error);
+          }
+        }
+        if (!ok) {
+          const std::string msg = "Embedding error: " + error;
+          try { invoker->invokeAsync([reject, msg, rtPtr]() {
+            try { reject->call(*rtPtr, jsi::String::createFromUtf8(*rtPtr, msg)); } catch (...) {}
+          }); } catch (...) {}
+          return;
+        }
 
-    return response;
-  } catch (const std::exception& e) {
-    throw jsi::JSError(rt, std::string("Embedding error: ") + e.what());
-  }
+        const size_t n_prompt = tokens.size();
+        try { invoker->invokeAsync([resolve, embedding, encoding_format, model_name, n_prompt, rtPtr]() {
+          try {
+            jsi::Runtime& jrt = *rtPtr;
+            // Create OpenAI-compatible response
+            jsi::Object embeddingObj(jrt);
+            if (encoding_format == "base64") {
+              // Base64 encode the embedding vector
+              const char* data_ptr = reinterpret_cast<const char*>(embedding->data());
+              size_t data_size = embedding->size() * sizeof(float);
+              embeddingObj.setProperty(jrt, "embedding", jsi::String::createFromUtf8(jrt, base64::encode(data_ptr, data_size)));
+              embeddingObj.setProperty(jrt, "encoding_format", jsi::String::createFromUtf8(jrt, "base64"));
+            } else {
+              // Hand the vector over as a Float32Array
+              embeddingObj.setProperty(jrt, "embedding", SystemUtils::toTypedArray(jrt, std::move(*embedding)));
+            }
+            embeddingObj.setProperty(jrt, "object", jsi::String::createFromUtf8(jrt, "embedding"));
+            embeddingObj.setProperty(jrt, "index", jsi::Value(0));
+
+            jsi::Array dataArray(jrt, 1);
+            dataArray.setValueAtIndex(jrt, 0, embeddingObj);
+
+            jsi::Object usage(jrt);
+            usage.setProperty(jrt, "prompt_tokens", jsi::Value(static_cast<int>(n_prompt)));
+            usage.setProperty(jrt, "total_tokens", jsi::Value(static_cast<int>(n_prompt)));
+
+            jsi::Object response(jrt);
+            response.setProperty(jrt, "object", jsi::String::createFromUtf8(jrt, "list"));
+            response.setProperty(jrt, "data", dataArray);
+            response.setProperty(jrt, "model", jsi::String::createFromUtf8(jrt, model_name));
+            response.setProperty(jrt, "usage", usage);
+            resolve->call(jrt, std::move(response));
+          } catch (...) {}
+        }); } catch (...) {}
+      });
+      return jsi::Value::undefined();
+    });
+  return Promise.callAsConstructor(rt, std::move(executor));
 }
 
 jsi::Value LlamaCppModel::runOnFrameJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count) {
@@ -1123,15 +1443,22 @@ jsi::Value LlamaCppModel::runOnFrameJsi(jsi::Runtime& rt, const jsi::Value* args
   uint32_t height = static_cast<uint32_t>(args[2].asNumber());
 
   float max_size = 0.0f;
+  rn_priority priority = RN_PRIORITY_INTERACTIVE; // a live camera feed is user-facing
   if (count > 4 && args[4].isObject()) {
     auto opts = args[4].getObject(rt);
     if (opts.hasProperty(rt, "maxSize") && opts.getProperty(rt, "maxSize").isNumber())
       max_size = static_cast<float>(opts.getProperty(rt, "maxSize").asNumber());
+    try {
+      parse_priority_option(rt, opts, priority);
+    } catch (...) {
+      is_processing_frame_ = false;
+      throw;
+    }
   }
 
   // Convert platform frame to mtmd_bitmap SYNCHRONOUSLY here on the JSI thread.
   // VisionCamera recycles the hardware buffer once the frame processor returns, so
-  // the pixel copy must complete before we spawn the background thread.
+  // the pixel copy must complete before the task is queued.
 #if defined(__ANDROID__)
   constexpr bool is_android = true;
 #else
@@ -1153,13 +1480,13 @@ jsi::Value LlamaCppModel::runOnFrameJsi(jsi::Runtime& rt, const jsi::Value* args
 
   auto executor = jsi::Function::createFromHostFunction(
     rt, jsi::PropNameID::forAscii(rt, "executor"), 2,
-    [selfPtr, raw_bm, invoker](
+    [selfPtr, raw_bm, priority, invoker](
         jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* a, size_t) -> jsi::Value {
       auto resolve = std::make_shared<jsi::Function>(a[0].asObject(runtime).asFunction(runtime));
       auto reject  = std::make_shared<jsi::Function>(a[1].asObject(runtime).asFunction(runtime));
       auto rtPtr   = &runtime;
 
-      std::thread([selfPtr, raw_bm, resolve, reject, invoker, rtPtr]() {
+      const bool queued = submit_or_reject(runtime, selfPtr->workers_, priority, reject, [selfPtr, raw_bm, priority, resolve, reject, invoker, rtPtr]() {
         // RAII: re-wrap raw_bm immediately so bitmap is freed on any exit path
         auto bm_del2 = [](mtmd_bitmap* b) { if (b) mtmd_bitmap_free(b); };
         std::unique_ptr<mtmd_bitmap, decltype(bm_del2)> bm2(raw_bm, bm_del2);
@@ -1180,7 +1507,7 @@ jsi::Value LlamaCppModel::runOnFrameJsi(jsi::Runtime& rt, const jsi::Value* args
 
           EmbedResult emb;
           {
-            std::lock_guard<std::mutex> lock(selfPtr->inference_mutex_);
+            rn_gate_lock lock(selfPtr->inference_gate_, priority);
             if (selfPtr->is_released_) {
               // EH-P3 FIX: reject so the Promise settles instead of hanging.
               try { invoker->invokeAsync([reject, rtPtr]() {
@@ -1214,7 +1541,8 @@ jsi::Value LlamaCppModel::runOnFrameJsi(jsi::Runtime& rt, const jsi::Value* args
           size_t n_embd = static_cast<size_t>(
               llama_model_n_embd(llama_get_model(selfPtr->rn_ctx_->ctx)));
           size_t n_tok  = n_embd > 0 ? (emb.embedding.size() / n_embd) : 0;
-          auto embCopy  = std::move(emb.embedding);
+          // Shared so the invokeAsync callback (a copyable std::function) can move it out
+          auto embCopy  = std::make_shared<std::vector<float>>(std::move(emb.embedding));
           if (selfPtr->is_released_) {
             // EH-P3 FIX: reject so the Promise settles instead of hanging.
             try { invoker->invokeAsync([reject, rtPtr]() {
@@ -1224,11 +1552,8 @@ jsi::Value LlamaCppModel::runOnFrameJsi(jsi::Runtime& rt, const jsi::Value* args
           }
           try { invoker->invokeAsync([resolve, embCopy, n_tok, n_embd, rtPtr]() {
             try {
-              jsi::Array arr(*rtPtr, embCopy.size());
-              for (size_t i = 0; i < embCopy.size(); ++i)
-                arr.setValueAtIndex(*rtPtr, i, jsi::Value(static_cast<double>(embCopy[i])));
               jsi::Object result(*rtPtr);
-              result.setProperty(*rtPtr, "embedding", std::move(arr));
+              result.setProperty(*rtPtr, "embedding", SystemUtils::toTypedArray(*rtPtr, std::move(*embCopy)));
               result.setProperty(*rtPtr, "n_tokens",  jsi::Value(static_cast<int>(n_tok)));
               result.setProperty(*rtPtr, "n_embd",    jsi::Value(static_cast<int>(n_embd)));
               resolve->call(*rtPtr, std::move(result));
@@ -1245,7 +1570,12 @@ jsi::Value LlamaCppModel::runOnFrameJsi(jsi::Runtime& rt, const jsi::Value* args
           }); } catch (...) {}
         }
         // _guard destructor resets is_processing_frame_ = false here
-      }).detach();
+      });
+      if (!queued) {
+        // The task never runs: free the frame and let the next one in.
+        mtmd_bitmap_free(raw_bm);
+        selfPtr->is_processing_frame_ = false;
+      }
       return jsi::Value::undefined();
     });
   return Promise.callAsConstructor(rt, std::move(executor));
@@ -1261,10 +1591,12 @@ jsi::Value LlamaCppModel::embedImageJsi(jsi::Runtime& rt, const jsi::Value* args
 
   std::string path = args[0].asString(rt).utf8(rt);
   bool normalize = false;
+  rn_priority priority = RN_PRIORITY_NORMAL;
   if (count > 1 && args[1].isObject()) {
     auto opts = args[1].getObject(rt);
     if (opts.hasProperty(rt, "normalize") && opts.getProperty(rt, "normalize").isBool())
       normalize = opts.getProperty(rt, "normalize").asBool();
+    parse_priority_option(rt, opts, priority);
   }
 
   auto Promise  = rt.global().getPropertyAsFunction(rt, "Promise");
@@ -1273,13 +1605,13 @@ jsi::Value LlamaCppModel::embedImageJsi(jsi::Runtime& rt, const jsi::Value* args
 
   auto executor = jsi::Function::createFromHostFunction(
     rt, jsi::PropNameID::forAscii(rt, "executor"), 2,
-    [selfPtr, path, normalize, invoker](
+    [selfPtr, path, normalize, priority, invoker](
         jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* a, size_t) -> jsi::Value {
       auto resolve = std::make_shared<jsi::Function>(a[0].asObject(runtime).asFunction(runtime));
       auto reject  = std::make_shared<jsi::Function>(a[1].asObject(runtime).asFunction(runtime));
       auto rtPtr   = &runtime;
 
-      std::thread([selfPtr, path, normalize, resolve, reject, invoker, rtPtr]() {
+      submit_or_reject(runtime, selfPtr->workers_, priority, reject, [selfPtr, path, normalize, priority, resolve, reject, invoker, rtPtr]() {
         try {
           if (selfPtr->is_released_) {
             // EH-P3 FIX: reject so the Promise settles instead of hanging.
@@ -1309,7 +1641,7 @@ jsi::Value LlamaCppModel::embedImageJsi(jsi::Runtime& rt, const jsi::Value* args
 
           EmbedResult res;
           {
-            std::lock_guard<std::mutex> lock(selfPtr->inference_mutex_);
+            rn_gate_lock lock(selfPtr->inference_gate_, priority);
             if (selfPtr->is_released_) {
               // EH-P3 FIX: reject so the Promise settles instead of hanging.
               try { invoker->invokeAsync([reject, rtPtr]() {
@@ -1342,7 +1674,8 @@ jsi::Value LlamaCppModel::embedImageJsi(jsi::Runtime& rt, const jsi::Value* args
           size_t n_embd = static_cast<size_t>(
               llama_model_n_embd(llama_get_model(selfPtr->rn_ctx_->ctx)));
           size_t n_tok  = n_embd > 0 ? (res.embedding.size() / n_embd) : 0;
-          auto emb      = std::move(res.embedding);
+          // Shared so the invokeAsync callback (a copyable std::function) can move it out
+          auto emb      = std::make_shared<std::vector<float>>(std::move(res.embedding));
           if (selfPtr->is_released_) {
             // EH-P3 FIX: reject so the Promise settles instead of hanging.
             try { invoker->invokeAsync([reject, rtPtr]() {
@@ -1352,11 +1685,8 @@ jsi::Value LlamaCppModel::embedImageJsi(jsi::Runtime& rt, const jsi::Value* args
           }
           try { invoker->invokeAsync([resolve, emb, n_tok, n_embd, rtPtr]() {
             try {
-              jsi::Array arr(*rtPtr, emb.size());
-              for (size_t i = 0; i < emb.size(); ++i)
-                arr.setValueAtIndex(*rtPtr, i, jsi::Value(static_cast<double>(emb[i])));
               jsi::Object result(*rtPtr);
-              result.setProperty(*rtPtr, "embedding", std::move(arr));
+              result.setProperty(*rtPtr, "embedding", SystemUtils::toTypedArray(*rtPtr, std::move(*emb)));
               result.setProperty(*rtPtr, "n_tokens",  jsi::Value(static_cast<int>(n_tok)));
               result.setProperty(*rtPtr, "n_embd",    jsi::Value(static_cast<int>(n_embd)));
               resolve->call(*rtPtr, std::move(result));
@@ -1372,7 +1702,7 @@ jsi::Value LlamaCppModel::embedImageJsi(jsi::Runtime& rt, const jsi::Value* args
             try { reject->call(*rtPtr, jsi::String::createFromUtf8(*rtPtr, "embedImage failed")); } catch (...) {}
           }); } catch (...) {}
         }
-      }).detach();
+      });
       return jsi::Value::undefined();
     });
   return Promise.callAsConstructor(rt, std::move(executor));
@@ -1401,6 +1731,9 @@ jsi::Value LlamaCppModel::transcribeAudioJsi(jsi::Runtime& rt, const jsi::Value*
     }})}
   }});
   opts.n_predict = 2048;  // generous default for transcription; caller can override via options
+  if (count > 1 && args[1].isObject()) {
+    parse_priority_option(rt, args[1].getObject(rt), opts.priority);
+  }
 
   auto Promise = rt.global().getPropertyAsFunction(rt, "Promise");
   auto invoker = jsInvoker_;
@@ -1414,7 +1747,7 @@ jsi::Value LlamaCppModel::transcribeAudioJsi(jsi::Runtime& rt, const jsi::Value*
       auto reject  = std::make_shared<jsi::Function>(a[1].asObject(runtime).asFunction(runtime));
       auto rtPtr   = &runtime;
 
-      std::thread([selfPtr, opts, resolve, reject, invoker, rtPtr]() {
+      submit_or_reject(runtime, selfPtr->workers_, opts.priority, reject, [selfPtr, opts, resolve, reject, invoker, rtPtr]() {
         try {
           if (selfPtr->is_released_) {
             // EH-P3 FIX: reject so the Promise settles instead of hanging.
@@ -1425,7 +1758,7 @@ jsi::Value LlamaCppModel::transcribeAudioJsi(jsi::Runtime& rt, const jsi::Value*
           }
           CompletionResult res;
           {
-            std::lock_guard<std::mutex> lock(selfPtr->inference_mutex_);
+            rn_gate_lock lock(selfPtr->inference_gate_, opts.priority);
             if (selfPtr->is_released_) {
               // EH-P3 FIX: reject so the Promise settles instead of hanging.
               try { invoker->invokeAsync([reject, rtPtr]() {
@@ -1433,6 +1766,9 @@ jsi::Value LlamaCppModel::transcribeAudioJsi(jsi::Runtime& rt, const jsi::Value*
               }); } catch (...) {}
               return;
             }
+            // Multimodal turns belong to the unnamed conversation.
+            std::string session_error;
+            rn_activate_session(selfPtr->rn_ctx_, 0, session_error);
             res = run_chat_completion(selfPtr->rn_ctx_, opts,
                 [](const std::string&, bool) { return false; });
           }
@@ -1465,7 +1801,7 @@ jsi::Value LlamaCppModel::transcribeAudioJsi(jsi::Runtime& rt, const jsi::Value*
             try { reject->call(*rtPtr, jsi::String::createFromUtf8(*rtPtr, "transcribeAudio failed")); } catch (...) {}
           }); } catch (...) {}
         }
-      }).detach();
+      });
       return jsi::Value::undefined();
     });
   return Promise.callAsConstructor(rt, std::move(executor));
@@ -1486,6 +1822,10 @@ jsi::Value LlamaCppModel::visionReasoningJsi(jsi::Runtime& rt, const jsi::Value*
     if (opts.hasProperty(rt, "prompt") && opts.getProperty(rt, "prompt").isString())
       prompt = opts.getProperty(rt, "prompt").asString(rt).utf8(rt);
   }
+  rn_priority priority = RN_PRIORITY_NORMAL;
+  if (count > 1 && args[1].isObject()) {
+    parse_priority_option(rt, args[1].getObject(rt), priority);
+  }
 
   CompletionOptions cmpl_opts;
   cmpl_opts.messages = json::array({{
@@ -1496,6 +1836,7 @@ jsi::Value LlamaCppModel::visionReasoningJsi(jsi::Runtime& rt, const jsi::Value*
     })}
   }});
   cmpl_opts.n_predict = 2048;  // generous default for vision reasoning; caller can override
+  cmpl_opts.priority  = priority;
 
   auto Promise = rt.global().getPropertyAsFunction(rt, "Promise");
   auto invoker = jsInvoker_;
@@ -1509,7 +1850,7 @@ jsi::Value LlamaCppModel::visionReasoningJsi(jsi::Runtime& rt, const jsi::Value*
       auto reject  = std::make_shared<jsi::Function>(a[1].asObject(runtime).asFunction(runtime));
       auto rtPtr   = &runtime;
 
-      std::thread([selfPtr, cmpl_opts, resolve, reject, invoker, rtPtr]() {
+      submit_or_reject(runtime, selfPtr->workers_, cmpl_opts.priority, reject, [selfPtr, cmpl_opts, resolve, reject, invoker, rtPtr]() {
         try {
           if (selfPtr->is_released_) {
             // EH-P3 FIX: reject so the Promise settles instead of hanging.
@@ -1520,7 +1861,7 @@ jsi::Value LlamaCppModel::visionReasoningJsi(jsi::Runtime& rt, const jsi::Value*
           }
           CompletionResult res;
           {
-            std::lock_guard<std::mutex> lock(selfPtr->inference_mutex_);
+            rn_gate_lock lock(selfPtr->inference_gate_, cmpl_opts.priority);
             if (selfPtr->is_released_) {
               // EH-P3 FIX: reject so the Promise settles instead of hanging.
               try { invoker->invokeAsync([reject, rtPtr]() {
@@ -1528,6 +1869,9 @@ jsi::Value LlamaCppModel::visionReasoningJsi(jsi::Runtime& rt, const jsi::Value*
               }); } catch (...) {}
               return;
             }
+            // Multimodal turns belong to the unnamed conversation.
+            std::string session_error;
+            rn_activate_session(selfPtr->rn_ctx_, 0, session_error);
             res = run_chat_completion(selfPtr->rn_ctx_, cmpl_opts,
                 [](const std::string&, bool) { return false; });
           }
@@ -1559,7 +1903,7 @@ jsi::Value LlamaCppModel::visionReasoningJsi(jsi::Runtime& rt, const jsi::Value*
             try { reject->call(*rtPtr, jsi::String::createFromUtf8(*rtPtr, "visionReasoning failed")); } catch (...) {}
           }); } catch (...) {}
         }
-      }).detach();
+      });
       return jsi::Value::undefined();
     });
   return Promise.callAsConstructor(rt, std::move(executor));
@@ -1621,12 +1965,205 @@ jsi::Value LlamaCppModel::setNThreadsJsi(jsi::Runtime& rt,
   // Non-blocking: JS thread (= UI thread) stores the request with release ordering
   // and returns immediately. The inference loop reads with acq_rel at the top of each
   // token iteration and calls llama_set_n_threads before the next llama_decode.
-  // No mutex — acquiring inference_mutex_ here would block the UI thread for the full
+  // No mutex — acquiring inference_gate_ here would block the UI thread for the full
   // duration of any in-flight completion. Mirrors the abort_generation atomic pattern.
   rn_ctx_->requested_n_threads.store(n, std::memory_order_release);
   return jsi::Value::undefined();
 }
 
+jsi::Value LlamaCppModel::setAppStateJsi(jsi::Runtime& rt,
+                                          const jsi::Value* args, size_t count) {
+  if (count < 1 || !args[0].isString())
+    throw jsi::JSError(rt, "setAppState requires a string argument");
+  if (!rn_ctx_)
+    throw jsi::JSError(rt, "setAppState: model not initialized");
+  // 'background' / 'idle' → nothing is rendering, so prompt ingestion drops its frame
+  // budget and yields. Any other state ('active', 'inactive', ...) restores pacing.
+  // Non-blocking, same atomic pattern as setNThreads; read before every ingestion chunk.
+  const std::string state = args[0].asString(rt).utf8(rt);
+  const bool full_speed = (state == "background" || state == "idle");
+  rn_ctx_->ingest_full_speed.store(full_speed, std::memory_order_relaxed);
+  return jsi::Value::undefined();
+}
+
+jsi::Value LlamaCppModel::saveSessionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count) {
+  return sessionJsi(rt, args, count, true);
+}
+
+jsi::Value LlamaCppModel::loadSessionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count) {
+  return sessionJsi(rt, args, count, false);
+}
+
+// saveSession(path) / loadSession(path): persist or restore seq 0 (KV bytes + token and
+// message bookkeeping, see rn-session.h) on a worker thread under inference_gate_.
+// save rejects on I/O errors; load resolves false when the file is missing or stale
+// (other model / n_ctx / version) so callers can fall back to a normal prefill.
+jsi::Value LlamaCppModel::sessionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count, bool save) {
+  const char* method = save ? "saveSession" : "loadSession";
+  if (count < 1 || !args[0].isString())
+    throw jsi::JSError(rt, std::string(method) + " requires a string path argument");
+  if (!rn_ctx_ || !rn_ctx_->ctx)
+    throw jsi::JSError(rt, "Model not loaded or context not initialized");
+  if (!jsInvoker_)
+    throw jsi::JSError(rt, std::string(method) + " requires a CallInvoker");
+
+  std::string path = args[0].asString(rt).utf8(rt);
+  SystemUtils::normalizeFilePath(path);
+
+  auto Promise = rt.global().getPropertyAsFunction(rt, "Promise");
+  auto invoker = jsInvoker_;
+  auto selfPtr = shared_from_this();
+
+  auto executor = jsi::Function::createFromHostFunction(
+    rt, jsi::PropNameID::forAscii(rt, "executor"), 2,
+    [selfPtr, path, save, invoker](
+        jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* a, size_t) -> jsi::Value {
+      auto resolve = std::make_shared<jsi::Function>(a[0].asObject(runtime).asFunction(runtime));
+      auto reject  = std::make_shared<jsi::Function>(a[1].asObject(runtime).asFunction(runtime));
+      auto rtPtr   = &runtime;
+
+      submit_or_reject(runtime, selfPtr->workers_, RN_PRIORITY_NORMAL, reject, [selfPtr, path, save, resolve, reject, invoker, rtPtr]() {
+        bool ok = false;
+        std::string error;
+        {
+          rn_gate_lock lock(selfPtr->inference_gate_, RN_PRIORITY_NORMAL);
+          if (selfPtr->is_released_ || !selfPtr->rn_ctx_) {
+            error = "model released";
+          } else {
+            // Session files hold the unnamed conversation, not a createSession() one.
+            rn_activate_session(selfPtr->rn_ctx_, 0, error);
+            ok = save ? rn_save_session(selfPtr->rn_ctx_, path, error)
+                      : rn_load_session(selfPtr->rn_ctx_, path, error);
+          }
+        }
+        const bool settle_false = !save && !selfPtr->is_released_;
+        try { invoker->invokeAsync([resolve, reject, ok, settle_false, error, rtPtr]() {
+          try {
+            if (ok || settle_false) {
+              resolve->call(*rtPtr, jsi::Value(ok));
+            } else {
+              reject->call(*rtPtr, jsi::String::createFromUtf8(*rtPtr, error));
+            }
+          } catch (...) {}
+        }); } catch (...) {}
+      });
+      return jsi::Value::undefined();
+    });
+  return Promise.callAsConstructor(rt, std::move(executor));
+}
+
+// Synchronous: only reads counters (leaf mutex inside rn_prefix_cache), never waits on inference.
+jsi::Value LlamaCppModel::getPrefixCacheStatsJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count) {
+  jsi::Object stats(rt);
+  std::shared_ptr<rn_prefix_cache> cache = (rn_ctx_ && !is_released_) ? rn_ctx_->prefix_cache : nullptr;
+  const rn_prefix_cache::stats_t s = cache ? cache->stats() : rn_prefix_cache::stats_t{};
+  stats.setProperty(rt, "enabled",       jsi::Value(cache != nullptr));
+  stats.setProperty(rt, "hits",          jsi::Value(static_cast<double>(s.hits)));
+  stats.setProperty(rt, "misses",        jsi::Value(static_cast<double>(s.misses)));
+  stats.setProperty(rt, "tokens_reused", jsi::Value(static_cast<double>(s.tokens_reused)));
+  stats.setProperty(rt, "entries",       jsi::Value(static_cast<double>(s.entries)));
+  stats.setProperty(rt, "bytes",         jsi::Value(static_cast<double>(s.bytes)));
+  stats.setProperty(rt, "budget_bytes",  jsi::Value(static_cast<double>(s.budget_bytes)));
+
+  size_t   shared_tokens = 0;
+  uint64_t shared_hits   = 0;
+  if (rn_ctx_ && !is_released_) {
+    std::lock_guard<std::mutex> lock(rn_ctx_->mutex);
+    shared_tokens = rn_ctx_->shared_prefix.tokens.size();
+    shared_hits   = rn_ctx_->shared_prefix.n_attached;
+  }
+  stats.setProperty(rt, "shared_prefix_tokens", jsi::Value(static_cast<double>(shared_tokens)));
+  stats.setProperty(rt, "shared_prefix_hits",   jsi::Value(static_cast<double>(shared_hits)));
+  return stats;
+}
+
+// Synchronous: a snapshot of the worker pool's queue under its leaf mutex.
+jsi::Value LlamaCppModel::getWorkerPoolStatsJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count) {
+  const rn_worker_pool::stats_t s = workers_.stats();
+  jsi::Object stats(rt);
+  stats.setProperty(rt, "threads",     jsi::Value(s.n_threads));
+  stats.setProperty(rt, "active",      jsi::Value(s.active));
+  stats.setProperty(rt, "queued",      jsi::Value(static_cast<double>(s.queued)));
+  stats.setProperty(rt, "max_queued",  jsi::Value(static_cast<double>(s.max_queued)));
+  stats.setProperty(rt, "peak_queued", jsi::Value(static_cast<double>(s.peak_queued)));
+  stats.setProperty(rt, "completed",   jsi::Value(static_cast<double>(s.completed)));
+  stats.setProperty(rt, "rejected",    jsi::Value(static_cast<double>(s.rejected)));
+  return stats;
+}
+
+// createSession(): a chat session handle, { id, completion(params, callback?), release() }.
+// Synchronous: it only reserves a pooled sequence. completion() is the model's completion
+// with session_id set; release() resolves once the session's KV is freed (false if it
+// was already released).
+jsi::Value LlamaCppModel::createSessionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count) {
+  if (!rn_ctx_ || !rn_ctx_->ctx || is_released_)
+    throw jsi::JSError(rt, "Model not loaded or context not initialized");
+
+  int32_t session_id = 0;
+  std::string error;
+  if (!rn_create_session(rn_ctx_, session_id, error))
+    throw jsi::JSError(rt, error);
+
+  auto selfPtr = shared_from_this();
+  jsi::Object session(rt);
+  session.setProperty(rt, "id", jsi::Value(session_id));
+  session.setProperty(rt, "completion", jsi::Function::createFromHostFunction(
+    rt, jsi::PropNameID::forAscii(rt, "completion"), 2,
+    [selfPtr, session_id](jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* a, size_t n) -> jsi::Value {
+      if (n < 1 || !a[0].isObject()) {
+        throw jsi::JSError(runtime, "completion requires an options object");
+      }
+      // A copy, so the caller's params object is left as it was.
+      jsi::Object params = runtime.global().getPropertyAsObject(runtime, "Object")
+          .getPropertyAsFunction(runtime, "assign")
+          .call(runtime, jsi::Object(runtime), a[0]).asObject(runtime);
+      params.setProperty(runtime, "session_id", jsi::Value(session_id));
+      jsi::Value forwarded[2] = {jsi::Value(runtime, params),
+                                 n > 1 ? jsi::Value(runtime, a[1]) : jsi::Value::undefined()};
+      return selfPtr->completionAsyncJsi(runtime, forwarded, n > 1 ? 2 : 1);
+    }));
+  session.setProperty(rt, "release", jsi::Function::createFromHostFunction(
+    rt, jsi::PropNameID::forAscii(rt, "release"), 0,
+    [selfPtr, session_id](jsi::Runtime& runtime, const jsi::Value&, const jsi::Value*, size_t) -> jsi::Value {
+      return selfPtr->releaseSessionJsi(runtime, session_id);
+    }));
+  return session;
+}
+
+// Waits for inference_gate_ on a worker thread: the session may be in seq 0 or about to be.
+jsi::Value LlamaCppModel::releaseSessionJsi(jsi::Runtime& rt, int32_t session_id) {
+  if (!jsInvoker_)
+    throw jsi::JSError(rt, "releaseSession requires a CallInvoker");
+
+  auto Promise = rt.global().getPropertyAsFunction(rt, "Promise");
+  auto invoker = jsInvoker_;
+  auto selfPtr = shared_from_this();
+
+  auto executor = jsi::Function::createFromHostFunction(
+    rt, jsi::PropNameID::forAscii(rt, "executor"), 2,
+    [selfPtr, session_id, invoker](
+        jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* a, size_t) -> jsi::Value {
+      auto resolve = std::make_shared<jsi::Function>(a[0].asObject(runtime).asFunction(runtime));
+      auto reject  = std::make_shared<jsi::Function>(a[1].asObject(runtime).asFunction(runtime));
+      auto rtPtr   = &runtime;
+
+      submit_or_reject(runtime, selfPtr->workers_, RN_PRIORITY_NORMAL, reject, [selfPtr, session_id, resolve, invoker, rtPtr]() {
+        bool released = false;
+        {
+          rn_gate_lock lock(selfPtr->inference_gate_, RN_PRIORITY_NORMAL);
+          if (!selfPtr->is_released_ && selfPtr->rn_ctx_) {
+            released = rn_release_session(selfPtr->rn_ctx_, session_id);
+          }
+        }
+        try { invoker->invokeAsync([resolve, released, rtPtr]() {
+          try { resolve->call(*rtPtr, jsi::Value(released)); } catch (...) {}
+        }); } catch (...) {}
+      });
+      return jsi::Value::undefined();
+    });
+  return Promise.callAsConstructor(rt, std::move(executor));
+}
+
 jsi::Value LlamaCppModel::get(jsi::Runtime& rt, const jsi::PropNameID& name) {
   auto nameStr = name.utf8(rt);
 
@@ -1731,6 +2268,42 @@ jsi::Value LlamaCppModel::get(jsi::Runtime& rt, const jsi::PropNameID& name) {
         return this->setNThreadsJsi(runtime, args, count);
       });
   }
+  else if (nameStr == "setAppState") {
+    return jsi::Function::createFromHostFunction(rt, name, 1,
+      [this](jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* args, size_t count) {
+        return this->setAppStateJsi(runtime, args, count);
+      });
+  }
+  else if (nameStr == "saveSession") {
+    return jsi::Function::createFromHostFunction(rt, name, 1,
+      [this](jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* args, size_t count) {
+        return this->saveSessionJsi(runtime, args, count);
+      });
+  }
+  else if (nameStr == "loadSession") {
+    return jsi::Function::createFromHostFunction(rt, name, 1,
+      [this](jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* args, size_t count) {
+        return this->loadSessionJsi(runtime, args, count);
+      });
+  }
+  else if (nameStr == "getPrefixCacheStats") {
+    return jsi::Function::createFromHostFunction(rt, name, 0,
+      [this](jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* args, size_t count) {
+        return this->getPrefixCacheStatsJsi(runtime, args, count);
+      });
+  }
+  else if (nameStr == "getWorkerPoolStats") {
+    return jsi::Function::createFromHostFunction(rt, name, 0,
+      [this](jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* args, size_t count) {
+        return this->getWorkerPoolStatsJsi(runtime, args, count);
+      });
+  }
+  else if (nameStr == "createSession") {
+    return jsi::Function::createFromHostFunction(rt, name, 0,
+      [this](jsi::Runtime& runtime, const jsi::Value&, const jsi::Value* args, size_t count) {
+        return this->createSessionJsi(runtime, args, count);
+      });
+  }
   else if (nameStr == "n_vocab") {
     return jsi::Value(getVocabSize());
   }
@@ -1768,6 +2341,12 @@ std::vector<jsi::PropNameID> LlamaCppModel::getPropertyNames(jsi::Runtime& rt) {
   result.push_back(jsi::PropNameID::forAscii(rt, "n_ctx"));
   result.push_back(jsi::PropNameID::forAscii(rt, "n_embd"));
   result.push_back(jsi::PropNameID::forAscii(rt, "setNThreads"));
+  result.push_back(jsi::PropNameID::forAscii(rt, "setAppState"));
+  result.push_back(jsi::PropNameID::forAscii(rt, "saveSession"));
+  result.push_back(jsi::PropNameID::forAscii(rt, "loadSession"));
+  result.push_back(jsi::PropNameID::forAscii(rt, "getPrefixCacheStats"));
+  result.push_back(jsi::PropNameID::forAscii(rt, "getWorkerPoolStats"));
+  result.push_back(jsi::PropNameID::forAscii(rt, "createSession"));
   return result;
 }
 
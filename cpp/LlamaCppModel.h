@@ -6,6 +6,7 @@
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -22,12 +23,15 @@
 // Include rn-utils.h which has the CompletionResult definition
 #include "rn-utils.h"
 #include "rn-llama.h"
+#include "rn-priority-gate.h"
+#include "rn-worker-pool.h"
 
 // Include json.hpp for json handling
 #include "nlohmann/json.hpp"
 
 namespace facebook::react {
 
+class rn_batch_scheduler;
 
 /**
  * LlamaCppModel - A JSI wrapper class around llama.cpp functionality
@@ -77,14 +81,17 @@ public:
    * Uses run_completion and run_chat_completion from llama.cpp
    *
    * @param options CompletionOptions with all parameters
-   * @param partialCallback Callback for streaming tokens
+   * @param partialCallback Callback for streaming tokens; the delta events of the chunk
+   *        (stream_deltas) come with it, nullptr when there are none
    * @param runtime Pointer to JSI runtime for callbacks
+   * @param ticket The request's inference gate ticket; cancelling it stops generation
    * @return CompletionResult with generated text and metadata
    */
   CompletionResult completion(
       const CompletionOptions& options,
-      std::function<void(jsi::Runtime&, const char*)> partialCallback = nullptr,
-      jsi::Runtime* runtime = nullptr);
+      std::function<void(jsi::Runtime&, const char*, const json*)> partialCallback = nullptr,
+      jsi::Runtime* runtime = nullptr,
+      const rn_priority_gate::ticket_ptr& ticket = nullptr);
 
   /**
    * JSI interface implementation
@@ -105,6 +112,14 @@ private:
   jsi::Value embeddingJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
   jsi::Value releaseJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
   jsi::Value setNThreadsJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
+  jsi::Value setAppStateJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
+  jsi::Value saveSessionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
+  jsi::Value loadSessionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
+  jsi::Value sessionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count, bool save);
+  jsi::Value getPrefixCacheStatsJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
+  jsi::Value getWorkerPoolStatsJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
+  jsi::Value createSessionJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
+  jsi::Value releaseSessionJsi(jsi::Runtime& rt, int32_t session_id);
 
   /**
    * Helper to parse completion options from JS object
@@ -126,9 +141,10 @@ private:
   // LLAMA context pointer (owned by the module)
   rn_llama_context* rn_ctx_;
 
-  // Completion state — atomic because they are read on the inference thread and written on the JS thread
+  // Completion state — atomic because they are read on the inference thread and written on the JS thread.
+  // should_stop_completion_ is set by release() only; stopCompletion() cancels tickets.
   std::atomic<bool> should_stop_completion_;
-  std::atomic<bool> is_predicting_;
+  std::atomic<int>  n_predicting_; // completion() calls in flight (scheduled ones run concurrently)
 
   // Add CallInvoker for async operations
   std::shared_ptr<CallInvoker> jsInvoker_;
@@ -139,10 +155,20 @@ private:
   std::mutex              predicting_cv_mutex_;
 
   // Multimodal / thread-safety guards (see plan: Thread Safety Architecture)
-  std::mutex        inference_mutex_;           // serializes ALL llama/mtmd inference calls
+  rn_priority_gate  inference_gate_;            // serializes ALL llama/mtmd inference calls, by priority
   std::atomic<bool> is_processing_frame_{false}; // instant frame drop for runOnFrame
   std::atomic<bool> is_released_{false};          // JSI teardown guard
 
+  // Continuous batching (initLlama n_parallel > 1). Scheduled completions do not hold
+  // inference_gate_ for their whole duration; instead they hold scheduler_gate_ shared
+  // so release() can wait for their template/parse work to drain before nulling rn_ctx_.
+  std::unique_ptr<rn_batch_scheduler> scheduler_;
+  std::shared_mutex                   scheduler_gate_;
+
+  // Runs the async JSI methods' work; shut down at the end of release(). Declared last
+  // so its workers are joined before the members they use go away.
+  rn_worker_pool                      workers_;
+
   // Multimodal JSI methods
   jsi::Value isMultimodalEnabledJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
   jsi::Value getSupportedModalitiesJsi(jsi::Runtime& rt, const jsi::Value* args, size_t count);
@@ -19,9 +19,15 @@
 #include "SystemUtils.h"
 // Include our custom headers - this was missing!
 #include "rn-llama.h"
+#include "rn-prefix-cache.h"
+#include "rn-completion.h"
+#include "rn-memory-plan.h"
+#include "rn-priority-gate.h"
+#include "rn-worker-pool.h"
 #include "LlamaCppModel.h"
 // Include the llama.cpp common headers
 #include "chat.h"
+#include "log.h"
 
 #if defined(__ANDROID__) || defined(__linux__)
 #include <dlfcn.h>
@@ -227,6 +233,44 @@ static void ensure_backends_loaded() {
   });
 }
 
+// Size of the file at `path` (stat only), 0 when the path is empty or unreadable.
+static int64_t file_size_bytes(const std::string& path) {
+  struct stat st{};
+  if (path.empty() || ::stat(path.c_str(), &st) != 0) {
+    return 0;
+  }
+  return static_cast<int64_t>(st.st_size);
+}
+
+// Plan fields use initLlama's option names, so a plan can be spread into its options.
+static jsi::Object memoryPlanToJsi(jsi::Runtime& rt, const rn_memory_plan& plan) {
+  jsi::Object o(rt);
+  o.setProperty(rt, "n_ctx",        jsi::Value(plan.n_ctx));
+  o.setProperty(rt, "n_batch",      jsi::Value(plan.n_batch));
+  o.setProperty(rt, "n_ubatch",     jsi::Value(plan.n_ubatch));
+  o.setProperty(rt, "cache_type_k", jsi::String::createFromUtf8(rt, rn_kv_cache_type_name(plan.cache_type_k)));
+  o.setProperty(rt, "cache_type_v", jsi::String::createFromUtf8(rt, rn_kv_cache_type_name(plan.cache_type_v)));
+  if (plan.flash_attn == LLAMA_FLASH_ATTN_TYPE_AUTO) {
+    o.setProperty(rt, "flash_attn", jsi::String::createFromAscii(rt, "auto"));
+  } else {
+    o.setProperty(rt, "flash_attn", jsi::Value(plan.flash_attn == LLAMA_FLASH_ATTN_TYPE_ENABLED));
+  }
+  o.setProperty(rt, "fits", jsi::Value(plan.fits));
+  if (!plan.reason.empty()) {
+    o.setProperty(rt, "reason", jsi::String::createFromUtf8(rt, plan.reason));
+  }
+
+  jsi::Object bytes(rt);
+  bytes.setProperty(rt, "available",     jsi::Value(static_cast<double>(plan.available_bytes)));
+  bytes.setProperty(rt, "weights",       jsi::Value(static_cast<double>(plan.weights_bytes)));
+  bytes.setProperty(rt, "kv",            jsi::Value(static_cast<double>(plan.kv_bytes)));
+  bytes.setProperty(rt, "compute",       jsi::Value(static_cast<double>(plan.compute_bytes)));
+  bytes.setProperty(rt, "headroom",      jsi::Value(static_cast<double>(plan.headroom_bytes)));
+  bytes.setProperty(rt, "kv_per_token",  jsi::Value(static_cast<double>(plan.kv_bytes_per_token)));
+  o.setProperty(rt, "bytes", std::move(bytes));
+  return o;
+}
+
 // Dispatches fn to the JS thread via invoker; silently drops if the runtime is already gone.
 template<typename Fn>
 static void safe_invoke(const std::shared_ptr<CallInvoker>& invoker, Fn&& fn) {
@@ -279,22 +323,14 @@ jsi::Value PureCppImpl::loadLlamaModelInfo(jsi::Runtime &runtime, jsi::String mo
       auto invoker = jsInvoker_;
       auto selfPtr = shared_from_this();
       
-      // Launch background thread for model info loading
-      std::thread([selfPtr, path, mmproj_path,
-                   resolve = std::move(resolve),
-                   reject  = std::move(reject),
-                   runtimePtr, invoker]() mutable {
+      // Load on the module's loader pool
+      const bool queued = selfPtr->loader_pool_.submit([selfPtr, path, mmproj_path,
+                   resolve, reject, runtimePtr, invoker]() mutable {
         try {
           ensure_backends_loaded();
 
           // Read mmproj file size (stat only — no model load needed) for VRAM reservation.
-          int64_t mmproj_size_bytes = 0;
-          if (!mmproj_path.empty()) {
-            struct stat st{};
-            if (::stat(mmproj_path.c_str(), &st) == 0) {
-              mmproj_size_bytes = static_cast<int64_t>(st.st_size);
-            }
-          }
+          const int64_t mmproj_size_bytes = file_size_bytes(mmproj_path);
 
           // Create model params
           llama_model_params params = llama_model_default_params();
@@ -366,6 +402,12 @@ jsi::Value PureCppImpl::loadLlamaModelInfo(jsi::Runtime &runtime, jsi::String mo
           int arch_ret = llama_model_meta_val_str(model, "general.architecture", arch_buf.data(), arch_buf.size());
           std::string architecture = (arch_ret > 0) ? arch_buf.data() : "unknown";
 
+          // Context, KV cache types and batch sizes that fit next to the weights (and mmproj).
+          const rn_memory_plan memory_plan = rn_plan_memory(
+              rn_read_model_dims(model),
+              static_cast<int64_t>(model_size_bytes) + mmproj_size_bytes,
+              available_memory_bytes);
+
           // Read GGUF-embedded sampling defaults (present on some models, absent on others).
           // These are the model author's recommended sampling parameters — the JS layer should
           // use them as defaults when the user hasn't explicitly set a value.
@@ -418,7 +460,7 @@ jsi::Value PureCppImpl::loadLlamaModelInfo(jsi::Runtime &runtime, jsi::String mo
                                 gpuSupported, optimalGpuLayers, quantType, n_layers,
                                 model_size_bytes, architecture,
                                 available_memory_mb, estimated_vram_mb,
-                                mmproj_size_mb, is_cpu_only, chunk_size, gs, runtimePtr]() {
+                                mmproj_size_mb, is_cpu_only, chunk_size, gs, memory_plan, runtimePtr]() {
             try {
               jsi::Object result(*runtimePtr);
               result.setProperty(*runtimePtr, "n_params",            jsi::Value(n_params));
@@ -439,6 +481,7 @@ jsi::Value PureCppImpl::loadLlamaModelInfo(jsi::Runtime &runtime, jsi::String mo
               if (mmproj_size_mb >= 0.0) {
                 result.setProperty(*runtimePtr, "mmprojSizeMB",      jsi::Value(mmproj_size_mb));
               }
+              result.setProperty(*runtimePtr, "memoryPlan",          memoryPlanToJsi(*runtimePtr, memory_plan));
 
               // GGUF-embedded sampling defaults — only present when the model author set them.
               // Fields with value -1 mean the model doesn't specify that parameter.
@@ -476,7 +519,10 @@ jsi::Value PureCppImpl::loadLlamaModelInfo(jsi::Runtime &runtime, jsi::String mo
             try { reject->call(*runtimePtr, jsi::String::createFromUtf8(*runtimePtr, "loadLlamaModelInfo failed")); } catch (...) {}
           });
         }
-      }).detach();
+      });
+      if (!queued) {
+        reject->call(runtime, jsi::String::createFromUtf8(runtime, "model loader queue is full"));
+      }
       
       return jsi::Value::undefined();
     }
@@ -538,6 +584,17 @@ static void init_chat_templates_safe(rn_llama_context* ctx, const rn_common_para
 struct InitLlamaParams {
   std::string model_path;
   int n_ctx, n_batch, n_ubatch, n_keep;
+  // KV cache precision; a quantized V cache needs flash attention
+  ggml_type cache_type_k = GGML_TYPE_F16;
+  ggml_type cache_type_v = GGML_TYPE_F16;
+  llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+  // Memory planner: sets n_ctx, n_batch, n_ubatch and whichever of the three fields
+  // above the caller left unset; an explicit n_ctx becomes the plan's upper bound
+  bool auto_plan = false;
+  bool n_ctx_set = false;
+  bool cache_type_k_set = false;
+  bool cache_type_v_set = false;
+  bool flash_attn_set   = false;
   bool use_mmap, use_mlock, use_jinja, embedding;
   int n_threads, n_gpu_layers;
   std::string logits_file;
@@ -556,10 +613,123 @@ struct InitLlamaParams {
   uint32_t    declared_capabilities = 0;
   // Cooperative ingestion loop
   int  chunk_size  = 128;
+  int  ingest_budget_ms = 12;
   bool is_cpu_only = false;
   int  prompt_chunk_gap_ms = 5;
+  // Continuous batching
+  int n_parallel = 1;
+  int n_seq_max  = 1;
+  // Speculative decoding
+  std::string draft_model_path;
+  int   draft_n_max = 8;
+  float draft_p_min = 0.75f;
+  // Prefix cache
+  size_t prefix_cache_bytes = 0;
+  bool   shared_prefix      = false;
 };
 
+// llama_decode's abort callback (target and draft contexts): the model is being released,
+// or the request holding the inference gate was stopped. Scheduler steps hold the gate
+// with an anonymous ticket, so a batch shared by several requests is never aborted for one.
+static bool abort_requested(void* data) {
+    auto* rn_ctx = static_cast<rn_llama_context*>(data);
+    return rn_ctx->abort_generation.load(std::memory_order_relaxed) ||
+           (rn_ctx->gate && rn_ctx->gate->holder_cancelled());
+}
+
+// Loads the speculative-decoding draft model next to the target. Non-fatal like mmproj:
+// on any failure (load error, vocabulary mismatch, recurrent target) the draft is dropped
+// and completions decode one token per pass as before.
+static void init_draft_model_safe(
+    rn_llama_context* ctx,
+    const rn_common_params& target_params,
+    const std::string& draft_path,
+    ProgressCallbackCtx* progress_ctx) {
+    // Rejected drafts are rolled back with a partial llama_memory_seq_rm, which recurrent
+    // and hybrid memory do not support.
+    if (llama_model_is_recurrent(ctx->model) || llama_model_is_hybrid(ctx->model)) {
+        return;
+    }
+
+    rn_common_params dparams;
+    static_cast<common_params&>(dparams) = target_params;
+    dparams.model.path   = draft_path;
+    dparams.lora_adapters.clear();
+    dparams.embedding    = false;
+    dparams.n_parallel   = 1;
+    dparams.kv_unified   = false;
+    dparams.load_progress_callback           = &progress_trampoline;
+    dparams.load_progress_callback_user_data = progress_ctx;
+
+    common_init_result_ptr draft;
+    try {
+        draft = try_init_with_gpu_fallback(dparams);
+    } catch (...) {
+        return;
+    }
+
+    // Drafts are verified token-for-token, so both models must tokenize identically.
+    const llama_vocab* dvocab = llama_model_get_vocab(draft->model());
+    if (llama_vocab_type(dvocab)     != llama_vocab_type(ctx->vocab) ||
+        llama_vocab_n_tokens(dvocab) != llama_vocab_n_tokens(ctx->vocab) ||
+        llama_vocab_bos(dvocab)      != llama_vocab_bos(ctx->vocab) ||
+        llama_vocab_eos(dvocab)      != llama_vocab_eos(ctx->vocab)) {
+        return;
+    }
+
+    ctx->draft_model = draft->model();
+    ctx->draft_ctx   = draft->context();
+    ctx->draft_init  = std::move(draft);
+    ctx->draft_batch = llama_batch_init(ctx->params.n_batch, 0, 1);
+    ctx->draft_cache.clear();
+    llama_set_abort_callback(
+        ctx->draft_ctx,
+        &abort_requested,
+        ctx);
+    ctx->draft_loaded = true;
+}
+
+// auto_plan: sizes the context from the model's hparams (a vocab_only load reads no
+// tensors) and the memory available now. The draft model's weights are counted, its KV
+// is not. Explicit cache types and flash_attn are kept as constraints. When the plan does
+// not fit, or free memory is unknown, the caller's own settings load unchanged and the
+// reason is logged.
+static void apply_memory_plan(InitLlamaParams& p) {
+    ensure_backends_loaded();
+    llama_model_params mparams = llama_model_default_params();
+    mparams.vocab_only   = true;
+    mparams.n_gpu_layers = 0;
+    llama_model* model = llama_model_load_from_file(p.model_path.c_str(), mparams);
+    if (!model) {
+        throw std::runtime_error("Failed to read model for memory planning: " + p.model_path);
+    }
+    const rn_model_dims dims = rn_read_model_dims(model);
+    llama_model_free(model);
+
+    const int64_t weights = file_size_bytes(p.model_path) + file_size_bytes(p.mmproj_path) +
+                            file_size_bytes(p.draft_model_path);
+    rn_plan_fixed fixed;
+    fixed.cache_type_k_set = p.cache_type_k_set;
+    fixed.cache_type_k     = p.cache_type_k;
+    fixed.cache_type_v_set = p.cache_type_v_set;
+    fixed.cache_type_v     = p.cache_type_v;
+    fixed.flash_attn_set   = p.flash_attn_set;
+    fixed.flash_attn       = p.flash_attn;
+    const rn_memory_plan plan = rn_plan_memory(dims, weights, SystemUtils::getAvailableMemoryBytes(),
+                                               p.n_ctx_set ? p.n_ctx : 0, p.n_seq_max, fixed);
+    if (!plan.fits) {
+        LOG_WRN("auto_plan: %s; loading with the given settings (n_ctx = %d)\n",
+                plan.reason.c_str(), p.n_ctx);
+        return;
+    }
+    p.n_ctx        = plan.n_ctx;
+    p.n_batch      = plan.n_batch;
+    p.n_ubatch     = plan.n_ubatch;
+    p.cache_type_k = plan.cache_type_k;
+    p.cache_type_v = plan.cache_type_v;
+    p.flash_attn   = plan.flash_attn;
+}
+
 struct ModelInitResult {
     std::unique_ptr<rn_llama_context> rn_ctx;
     common_init_result_ptr            init_result; // keeps llama_model / llama_context alive
@@ -582,6 +752,9 @@ static ModelInitResult do_init_llama(
     params.n_ctx               = p.n_ctx;
     params.n_batch             = p.n_batch;
     params.n_ubatch            = p.n_ubatch;
+    params.cache_type_k        = p.cache_type_k;
+    params.cache_type_v        = p.cache_type_v;
+    params.flash_attn_type     = p.flash_attn;
     params.n_keep              = p.n_keep;
     params.use_mmap            = p.use_mmap;
     params.use_mlock           = p.use_mlock;
@@ -598,6 +771,10 @@ static ModelInitResult do_init_llama(
     params.yarn_attn_factor    = p.yarn_attn_factor;
     params.yarn_beta_fast      = p.yarn_beta_fast;
     params.yarn_beta_slow      = p.yarn_beta_slow;
+    // n_parallel in common_params is the context's n_seq_max. A unified KV buffer lets
+    // sequences share cells instead of splitting n_ctx evenly between them.
+    params.n_parallel          = p.n_seq_max;
+    params.kv_unified          = p.n_seq_max > 1;
     // reasoning_budget is stored in rn_common_params (not common_params — upstream moved it
     // to common_params_sampling.reasoning_budget_tokens). We set it on rn_params below.
     params.reasoning_format    = p.reasoning_format;
@@ -627,8 +804,14 @@ static ModelInitResult do_init_llama(
     rn_params.reasoning_format    = p.reasoning_format;
     rn_params.reasoning_budget    = p.reasoning_budget;
     rn_params.chunk_size          = p.chunk_size;
+    rn_params.ingest_budget_ms    = p.ingest_budget_ms;
     rn_params.is_cpu_only         = p.is_cpu_only;
     rn_params.prompt_chunk_gap_ms = p.prompt_chunk_gap_ms;
+    rn_params.n_parallel_requests = p.n_parallel;
+    rn_params.draft_n_max         = p.draft_n_max;
+    rn_params.draft_p_min         = p.draft_p_min;
+    rn_params.prefix_cache_bytes  = p.prefix_cache_bytes;
+    rn_params.shared_prefix       = p.shared_prefix;
 
     // ── 2. Model init with GPU→CPU fallback ────────────────────────────────
     ProgressCallbackCtx model_progress_ctx{on_progress, "model"};
@@ -649,16 +832,32 @@ static ModelInitResult do_init_llama(
     rn_ctx->ctx          = init_result->context();
     rn_ctx->model_loaded = true;
     rn_ctx->vocab        = llama_model_get_vocab(rn_ctx->model);
+    if (!rn_ctx->pieces.build(rn_ctx->vocab)) {
+        throw std::runtime_error("Failed to build the token piece table");
+    }
     rn_ctx->params       = rn_params;
     rn_ctx->gen_batch    = llama_batch_init(1, 0, 1);
     rn_ctx->ingest_batch = llama_batch_init(rn_ctx->params.n_batch, 0, 1);
+    rn_ctx->spec_batch   = llama_batch_init(RN_MAX_DRAFT_TOKENS + 1, 0, 1);
     rn_ctx->batches_initialized = true;
+    rn_ctx->seq_in_use.assign(static_cast<size_t>(std::max(1, p.n_seq_max)), false);
+    rn_ctx->seq_in_use[0] = true; // seq 0: legacy single-request path
+    if (p.prefix_cache_bytes > 0) {
+        rn_ctx->prefix_cache = std::make_shared<rn_prefix_cache>(p.prefix_cache_bytes);
+    }
+    // The shared system / tools prefix lives in the last sequence, kept out of the pool.
+    // Recurrent state cannot be shared by cell, so those models never reserve it.
+    if (p.shared_prefix && rn_ctx->seq_in_use.size() > 1 &&
+        !llama_model_is_recurrent(rn_ctx->model) && !llama_model_is_hybrid(rn_ctx->model)) {
+        const size_t last = rn_ctx->seq_in_use.size() - 1;
+        rn_ctx->seq_in_use[last]    = true;
+        rn_ctx->shared_prefix.seq_id = static_cast<llama_seq_id>(last);
+    }
+    rn_ctx->sampler_cache = std::make_shared<rn_sampler_cache>();
 
     llama_set_abort_callback(
         rn_ctx->ctx,
-        [](void* data) -> bool {
-            return static_cast<rn_llama_context*>(data)->abort_generation.load(std::memory_order_relaxed);
-        },
+        &abort_requested,
         rn_ctx.get());
 
     // ── 4. Chat templates ──────────────────────────────────────────────────
@@ -680,6 +879,12 @@ static ModelInitResult do_init_llama(
         rn_ctx->multimodal_loaded = (rn_ctx->mtmd_ctx != nullptr);
     }
 
+    // ── 6. Speculative decoding draft model (non-fatal) ───────────────────
+    if (!p.draft_model_path.empty()) {
+        ProgressCallbackCtx draft_progress_ctx{on_progress, "draft"};
+        init_draft_model_safe(rn_ctx.get(), rn_ctx->params, p.draft_model_path, &draft_progress_ctx);
+    }
+
     return { std::move(rn_ctx), std::move(init_result) };
 }
 
@@ -728,7 +933,7 @@ jsi::Value PureCppImpl::initLlama(jsi::Runtime &runtime, jsi::Object options) {
   bool parallel_tool_calls = false;  // Disabled by default for compatibility
 
   // Parse options to native types
-  SystemUtils::setIfExists(runtime, options, "n_ctx", n_ctx);
+  const bool n_ctx_set = SystemUtils::setIfExists(runtime, options, "n_ctx", n_ctx);
   SystemUtils::setIfExists(runtime, options, "n_batch", n_batch);
   SystemUtils::setIfExists(runtime, options, "n_ubatch", n_ubatch);
   SystemUtils::setIfExists(runtime, options, "n_keep", n_keep);
@@ -836,18 +1041,80 @@ jsi::Value PureCppImpl::initLlama(jsi::Runtime &runtime, jsi::Object options) {
 
   // Cooperative ingestion loop settings
   int  chunk_size  = 128;
+  int  ingest_budget_ms = 12;
   bool is_cpu_only = false;
   int  prompt_chunk_gap_ms = 5;
   SystemUtils::setIfExists(runtime, options, "chunk_size",  chunk_size);
+  SystemUtils::setIfExists(runtime, options, "ingest_budget_ms", ingest_budget_ms);
   SystemUtils::setIfExists(runtime, options, "is_cpu_only", is_cpu_only);
   SystemUtils::setIfExists(runtime, options, "prompt_chunk_gap_ms", prompt_chunk_gap_ms);
 
+  // Continuous batching: n_parallel scheduler slots, each on its own KV sequence,
+  // plus seq 0 for the legacy path (multimodal, embedding, sync completion).
+  int n_parallel = 1;
+  SystemUtils::setIfExists(runtime, options, "n_parallel", n_parallel);
+  n_parallel = std::max(1, n_parallel);
+  int n_seq_max = n_parallel > 1 ? n_parallel + 1 : 1;
+  SystemUtils::setIfExists(runtime, options, "n_seq_max", n_seq_max);
+  // Shared system / tools prefix across sequences: one extra sequence holds it
+  bool shared_prefix = false;
+  SystemUtils::setIfExists(runtime, options, "shared_prefix", shared_prefix);
+  if (shared_prefix) {
+    n_seq_max += 1;
+  }
+  n_seq_max = std::clamp(n_seq_max, 1, 256); // LLAMA_MAX_SEQ (not exported by llama.h)
+
+  // Speculative decoding: small same-vocabulary draft model
+  std::string draft_model_path;
+  int   draft_n_max = 8;
+  float draft_p_min = 0.75f;
+  if (options.hasProperty(runtime, "draft_model") &&
+      options.getProperty(runtime, "draft_model").isString()) {
+    draft_model_path = options.getProperty(runtime, "draft_model").asString(runtime).utf8(runtime);
+    SystemUtils::normalizeFilePath(draft_model_path);
+  }
+  SystemUtils::setIfExists(runtime, options, "draft_n_max", draft_n_max);
+  SystemUtils::setIfExists(runtime, options, "draft_p_min", draft_p_min);
+
+  // KV cache precision and flash attention (true / false / 'auto')
+  std::string cache_type_k_name = "f16";
+  std::string cache_type_v_name = "f16";
+  const bool cache_type_k_set = SystemUtils::setIfExists(runtime, options, "cache_type_k", cache_type_k_name);
+  const bool cache_type_v_set = SystemUtils::setIfExists(runtime, options, "cache_type_v", cache_type_v_name);
+  ggml_type cache_type_k = GGML_TYPE_F16;
+  ggml_type cache_type_v = GGML_TYPE_F16;
+  if (!rn_kv_cache_type_from_name(cache_type_k_name, cache_type_k) ||
+      !rn_kv_cache_type_from_name(cache_type_v_name, cache_type_v)) {
+    throw jsi::JSError(runtime, "cache_type_k / cache_type_v must be 'f16', 'q8_0' or 'q4_0'");
+  }
+  llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+  const bool flash_attn_set =
+      options.hasProperty(runtime, "flash_attn") && options.getProperty(runtime, "flash_attn").isBool();
+  if (flash_attn_set) {
+    flash_attn = options.getProperty(runtime, "flash_attn").getBool()
+        ? LLAMA_FLASH_ATTN_TYPE_ENABLED : LLAMA_FLASH_ATTN_TYPE_DISABLED;
+  }
+  bool auto_plan = false;
+  SystemUtils::setIfExists(runtime, options, "auto_plan", auto_plan);
+
+  // In-RAM LRU of earlier conversations' KV (0 = disabled)
+  int prefix_cache_mb = 0;
+  SystemUtils::setIfExists(runtime, options, "prefix_cache_mb", prefix_cache_mb);
+
   // Pack all parsed values into a shared struct so the lambda captures stay minimal.
   auto p = std::make_shared<InitLlamaParams>();
   p->model_path           = model_path;
   p->n_ctx                = n_ctx;
   p->n_batch              = n_batch;
   p->n_ubatch             = n_ubatch;
+  p->cache_type_k         = cache_type_k;
+  p->cache_type_v         = cache_type_v;
+  p->flash_attn           = flash_attn;
+  p->auto_plan            = auto_plan;
+  p->n_ctx_set            = n_ctx_set;
+  p->cache_type_k_set     = cache_type_k_set;
+  p->cache_type_v_set     = cache_type_v_set;
+  p->flash_attn_set       = flash_attn_set;
   p->n_keep               = n_keep;
   p->use_mmap             = use_mmap;
   p->use_mlock            = use_mlock;
@@ -875,8 +1142,16 @@ jsi::Value PureCppImpl::initLlama(jsi::Runtime &runtime, jsi::Object options) {
   p->image_marker          = image_marker;
   p->declared_capabilities = declared_capabilities;
   p->chunk_size            = std::clamp(chunk_size, 8, 512);
+  p->ingest_budget_ms      = std::max(0, ingest_budget_ms);
   p->is_cpu_only           = is_cpu_only;
   p->prompt_chunk_gap_ms   = std::max(0, prompt_chunk_gap_ms);
+  p->n_parallel            = n_parallel;
+  p->n_seq_max             = n_seq_max;
+  p->draft_model_path      = draft_model_path;
+  p->draft_n_max           = std::clamp(draft_n_max, 1, RN_MAX_DRAFT_TOKENS);
+  p->draft_p_min           = std::clamp(draft_p_min, 0.0f, 1.0f);
+  p->prefix_cache_bytes    = static_cast<size_t>(std::max(0, prefix_cache_mb)) * 1024 * 1024;
+  p->shared_prefix         = shared_prefix;
 
   // Create Promise constructor
   auto Promise = runtime.global().getPropertyAsFunction(runtime, "Promise");
@@ -895,11 +1170,9 @@ jsi::Value PureCppImpl::initLlama(jsi::Runtime &runtime, jsi::Object options) {
       auto invoker = jsInvoker_;
       auto selfPtr = shared_from_this();
 
-      // Launch background thread for model initialization
-      std::thread([selfPtr, p,
-                   resolve = std::move(resolve),
-                   reject  = std::move(reject),
-                   runtimePtr, invoker]() mutable {
+      // Initialize on the module's loader pool
+      const bool queued = selfPtr->loader_pool_.submit([selfPtr, p,
+                   resolve, reject, runtimePtr, invoker]() mutable {
         // ── Phase 1: all heavy work — no JSI, no lock ──────────────────────
         // emitOnModelLoadProgress (AsyncEventEmitter) is thread-safe and
         // hops to the JS thread internally — safe to call from this
@@ -909,6 +1182,9 @@ jsi::Value PureCppImpl::initLlama(jsi::Runtime &runtime, jsi::Object options) {
         };
         ModelInitResult r;
         try {
+          if (p->auto_plan) {
+            apply_memory_plan(*p);
+          }
           r = do_init_llama(*p, on_progress);
         } catch (const std::exception& e) {
           std::string msg = e.what();
@@ -946,7 +1222,10 @@ jsi::Value PureCppImpl::initLlama(jsi::Runtime &runtime, jsi::Object options) {
             try { reject->call(*runtimePtr, jsi::String::createFromUtf8(*runtimePtr, "model object creation failed")); } catch (...) {}
           }
         });
-      }).detach();
+      });
+      if (!queued) {
+        reject->call(runtime, jsi::String::createFromUtf8(runtime, "model loader queue is full"));
+      }
       
       return jsi::Value::undefined();
     }
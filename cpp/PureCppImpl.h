@@ -10,6 +10,7 @@
 
 // Include the header with the full definition of rn_llama_context
 #include "rn-llama.h"
+#include "rn-worker-pool.h"
 
 namespace facebook::react {
 
@@ -71,6 +72,10 @@ private:
     
     // CallInvoker for async operations
     std::shared_ptr<CallInvoker> jsInvoker_;
+
+    // Runs initLlama / loadLlamaModelInfo. Two workers, so reading a model's info is not
+    // stuck behind a multi-second model load. Declared last: joined before the rest goes.
+    rn_worker_pool loader_pool_{2, 8};
 };
 
 } // namespace facebook::react
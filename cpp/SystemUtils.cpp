@@ -12,6 +12,9 @@
 #include <mach/mach.h>
 #include <mach/host_info.h>
 #include <TargetConditionals.h>
+#if TARGET_OS_IPHONE
+#include <os/proc.h>
+#endif
 #elif defined(__ANDROID__)
 #include <sys/sysinfo.h>
 #include <unistd.h>
@@ -94,6 +97,14 @@ int64_t getTotalPhysicalMemory() {
 
 int64_t SystemUtils::getAvailableMemoryBytes() {
 #if defined(__APPLE__) && TARGET_OS_IPHONE
+    // What the process may still allocate before hitting its Jetsam limit. Free pages
+    // alone ignore both reclaimable memory and the per-process limit.
+    if (__builtin_available(iOS 13.0, *)) {
+        const size_t remaining = os_proc_available_memory();
+        if (remaining > 0) {
+            return static_cast<int64_t>(remaining);
+        }
+    }
     mach_port_t host = mach_host_self();
     vm_size_t page_size = 0;
     host_page_size(host, &page_size);
@@ -199,6 +210,51 @@ bool SystemUtils::setIfExists(jsi::Runtime& rt, const jsi::Object& options, cons
   return false;
 }
 
+namespace {
+
+// MutableBuffer that owns a vector; lives as long as the JS ArrayBuffer referencing it.
+template <typename T>
+class VectorBuffer : public jsi::MutableBuffer {
+public:
+  explicit VectorBuffer(std::vector<T>&& values) : values_(std::move(values)) {}
+  size_t size() const override { return values_.size() * sizeof(T); }
+  uint8_t* data() override { return reinterpret_cast<uint8_t*>(values_.data()); }
+
+private:
+  std::vector<T> values_;
+};
+
+template <typename T>
+jsi::Object makeTypedArray(jsi::Runtime& rt, std::vector<T>&& values, const char* ctor) {
+  jsi::ArrayBuffer buffer(rt, std::make_shared<VectorBuffer<T>>(std::move(values)));
+  return rt.global()
+      .getPropertyAsFunction(rt, ctor)
+      .callAsConstructor(rt, std::move(buffer))
+      .asObject(rt);
+}
+
+} // namespace
+
+jsi::Object SystemUtils::toTypedArray(jsi::Runtime& rt, std::vector<float> values) {
+  return makeTypedArray(rt, std::move(values), "Float32Array");
+}
+
+jsi::Object SystemUtils::toTypedArray(jsi::Runtime& rt, std::vector<int32_t> values) {
+  return makeTypedArray(rt, std::move(values), "Int32Array");
+}
+
+bool SystemUtils::fromTypedArray(jsi::Runtime& rt, const jsi::Object& obj, std::vector<int32_t>& out) {
+  if (!obj.instanceOf(rt, rt.global().getPropertyAsFunction(rt, "Int32Array"))) {
+    return false;
+  }
+  jsi::ArrayBuffer buffer = obj.getPropertyAsObject(rt, "buffer").getArrayBuffer(rt);
+  const auto offset = static_cast<size_t>(obj.getProperty(rt, "byteOffset").asNumber());
+  const auto length = static_cast<size_t>(obj.getProperty(rt, "length").asNumber());
+  const auto* data  = reinterpret_cast<const int32_t*>(buffer.data(rt) + offset);
+  out.assign(data, data + length);
+  return true;
+}
+
 // For std::vector<jsi::Value> (Array)
 bool SystemUtils::setIfExists(jsi::Runtime& rt, const jsi::Object& options, const std::string& key, std::vector<jsi::Value>& outValue) {
   if (options.hasProperty(rt, key.c_str())) {
@@ -43,7 +43,8 @@ public:
 
   /**
    * Returns the number of bytes of memory currently available to the process.
-   * Uses MemAvailable on Android and vm_statistics on iOS for accuracy.
+   * Uses MemAvailable on Android and os_proc_available_memory on iOS (vm_statistics
+   * free pages before iOS 13).
    */
   static int64_t getAvailableMemoryBytes();
 
@@ -76,6 +77,20 @@ public:
 
   // Specialized version for vector
   static bool setIfExists(jsi::Runtime& rt, const jsi::Object& options, const std::string& key, std::vector<jsi::Value>& outValue);
+
+  /**
+   * Hands a vector to JS as a Float32Array / Int32Array. The backing ArrayBuffer takes
+   * ownership of the vector's storage, so there is no element-wise copy and no
+   * per-element JSI call. Pass an rvalue to avoid copying the vector itself.
+   */
+  static jsi::Object toTypedArray(jsi::Runtime& rt, std::vector<float> values);
+  static jsi::Object toTypedArray(jsi::Runtime& rt, std::vector<int32_t> values);
+
+  /**
+   * Reads an Int32Array (e.g. tokenize() output) with one copy out of its ArrayBuffer.
+   * Returns false, leaving `out` untouched, when `obj` is not an Int32Array.
+   */
+  static bool fromTypedArray(jsi::Runtime& rt, const jsi::Object& obj, std::vector<int32_t>& out);
 };
 
 } // namespace facebook::react
\ No newline at end of file
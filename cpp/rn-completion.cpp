@@ -12,6 +12,12 @@
 #pragma GCC diagnostic pop
 #include "rn-utils.h"
 #include "rn-multimodal.h"
+#include "rn-completion.h"
+#include "rn-scheduler.h"
+#include "rn-prefix-cache.h"
+#include "rn-priority-gate.h"
+#include "rn-session.h"
+#include "rn-shared-prefix.h"
 
 #include <string>
 #include <vector>
@@ -27,48 +33,73 @@
 
 namespace facebook::react {
 
-// Struct to track prediction completion state
-struct completion_state {
-    struct sampler_deleter {
-        void operator()(common_sampler* sampler) const {
-            if (sampler) {
-                common_sampler_free(sampler);
-            }
-        }
-    };
-
-    rn_llama_context* rn_ctx = nullptr;
-
-    bool has_next_token = true;
-    bool has_new_line = false;
-    bool truncated = false;
-
-    int n_past = 0;
-    int n_ctx = 0;
-    int n_predict = 0;
-    int n_decoded = 0;
-    int n_remaining = 0;
-
-    size_t n_sent_text = 0;
+// Sizes prompt-ingestion chunks from measured decode time. Each chunk aims for
+// ingest_budget_ms of continuous compute and is followed by a short yield; the per-token
+// cost is a moving average, so the chunk shrinks as attention over a longer KV gets
+// slower and grows on fast GPUs. A budget of 0 keeps the fixed chunk_size. When the app
+// reports it is backgrounded or idle, chunks are n_batch-sized and nothing sleeps.
+struct ingest_governor {
+    static constexpr int MIN_CHUNK = 8;
+
+    int    chunk;
+    int    chunk_max;
+    double budget_ms;
+    double ms_per_token = 0.0;
+    std::chrono::milliseconds gap;
+
+    explicit ingest_governor(const rn_common_params& params)
+        : chunk_max(std::max(MIN_CHUNK, static_cast<int>(params.n_batch))),
+          budget_ms(std::max(0, params.ingest_budget_ms)),
+          gap(params.is_cpu_only ? 2 : std::max(0, params.prompt_chunk_gap_ms)) {
+        chunk = std::clamp(params.chunk_size, MIN_CHUNK, chunk_max);
+    }
 
-    std::string generated_text;
-    std::string stopping_word;
-    bool stopped_by_limit = false;
-    bool context_shifted = false;  // true if at least one context shift occurred
+    int next_chunk(bool full_speed) const {
+        return full_speed ? chunk_max : chunk;
+    }
 
-    std::vector<llama_token> prompt_tokens;
-    std::vector<llama_token> generated_tokens;
+    void record(int n_tokens, std::chrono::steady_clock::duration elapsed) {
+        if (n_tokens <= 0) {
+            return;
+        }
+        const double ms = std::chrono::duration<double, std::milli>(elapsed).count();
+        const double per_token = ms / n_tokens;
+        ms_per_token = ms_per_token > 0.0 ? 0.7 * ms_per_token + 0.3 * per_token : per_token;
+        if (budget_ms <= 0.0 || ms_per_token <= 0.0) {
+            return;
+        }
+        // At most double or halve per step so one noisy measurement (first-decode graph
+        // allocation, a preempted thread) cannot swing the chunk to either bound.
+        const int target = static_cast<int>(budget_ms / ms_per_token);
+        chunk = std::clamp(std::clamp(target, chunk / 2, chunk * 2), MIN_CHUNK, chunk_max);
+    }
 
-    std::unique_ptr<common_sampler, sampler_deleter> sampler;
-    std::vector<std::string> antiprompt;
+    // True when ingesting n_left more tokens in the current chunks, yields included, would
+    // not finish by `deadline`; prefill then runs at full speed to save the first token.
+    bool behind(int n_left, std::chrono::steady_clock::time_point deadline) const {
+        if (deadline == std::chrono::steady_clock::time_point::max()) {
+            return false;
+        }
+        const double left_ms = std::chrono::duration<double, std::milli>(
+            deadline - std::chrono::steady_clock::now()).count();
+        const int n_chunks = (n_left + chunk - 1) / chunk;
+        return n_left * ms_per_token + n_chunks * static_cast<double>(gap.count()) >= left_ms;
+    }
 
+    void yield() const {
+        if (gap.count() > 0) {
+            std::this_thread::sleep_for(gap);
+        } else {
+            std::this_thread::yield();
+        }
+    }
 };
 
-// Helper function to check for stopping criteria
+// Helper function to check for stopping criteria. token_text has just been appended to
+// generated_text; it is fed to the request's stop-string automaton.
 static bool check_stop_conditions(
     completion_state& state,
-    const std::vector<std::string>& stop_words,
-    const std::string& token_text,
+    std::string_view token_text,
     bool ignore_eos) {
 
     if (state.n_predict >= 0 && state.n_remaining <= 0) {
@@ -78,18 +109,12 @@ static bool check_stop_conditions(
     }
 
     // Check for stopping strings
-    size_t stop_pos = std::string::npos;
-
-    for (const std::string & word : stop_words) {
-        size_t pos = state.generated_text.find(word, state.n_sent_text > 0 ? state.n_sent_text - 1 : 0);
-        if (pos != std::string::npos && (stop_pos == std::string::npos || pos < stop_pos)) {
-            state.stopping_word = word;
-            state.has_next_token = false;
-            stop_pos = pos;
-        }
-    }
+    int word = -1;
+    const size_t stop_pos = state.stop_matcher.feed(
+        token_text, state.generated_text.size() - token_text.size(), word);
 
     if (stop_pos != std::string::npos) {
+        state.stopping_word = state.antiprompt[word];
         state.generated_text.erase(
             state.generated_text.begin() + stop_pos,
             state.generated_text.end()
@@ -102,25 +127,1295 @@ static bool check_stop_conditions(
     }
 
     // Check for newline condition
-    if (token_text.find('\n') != std::string::npos) {
+    if (token_text.find('\n') != std::string_view::npos) {
         state.has_new_line = true;
     }
 
     return false;
 }
 
-static std::string build_kv_render_identity(
+// Hash of every chat render input except the messages: template, jinja/reasoning
+// settings, tool_choice, grammar and tools. Keys rn_ctx->chat_artifact_cache, and its hex
+// form is the kv_render_identity that ties seq 0 message boundaries to a render setup.
+static uint64_t chat_artifact_key(
+    const rn_llama_context* rn_ctx,
+    const CompletionOptions& options) {
+    const auto field = [](uint64_t h, std::string_view value) {
+        h = fnv1a_64(value, h);
+        return fnv1a_64(std::string_view("\x1f", 1), h); // unit separator between fields
+    };
+    uint64_t h = fnv1a_64("chat");
+    h = field(h, rn_ctx->params.use_jinja ? "1" : "0");
+    h = field(h, std::to_string(static_cast<int>(rn_ctx->params.reasoning_format)));
+    h = field(h, rn_ctx->params.chat_template);
+    for (const auto& [key, value] : rn_ctx->params.default_template_kwargs) {
+        h = field(field(h, key), value);
+    }
+    h = field(h, options.tool_choice);
+    h = field(h, options.grammar);
+    // Tools go in by their content hash, taken once when the options were parsed.
+    const uint64_t tools_hash = options.tools_hash != 0
+        ? options.tools_hash
+        : fnv1a_64(options.tools.is_null() ? "null" : options.tools.dump());
+    h = field(h, std::to_string(tools_hash));
+    return h;
+}
+
+// Features of a conversation that llama.cpp's format handlers rewrite messages for
+// before rendering. A pure-content render verified for one shape is not trusted for
+// another.
+static uint32_t message_shape(const std::vector<common_chat_msg>& msgs) {
+    uint32_t shape = 0;
+    for (const auto& m : msgs) {
+        if (m.role == "tool")                { shape |= 1u << 0; }
+        if (!m.tool_calls.empty())           { shape |= 1u << 1; }
+        if (!m.reasoning_content.empty())    { shape |= 1u << 2; }
+        if (!m.content_parts.empty())        { shape |= 1u << 3; }
+    }
+    if (!msgs.empty() && msgs.back().role == "assistant") {
+        shape |= 1u << 4; // assistant prefill
+    }
+    return shape;
+}
+
+// common_chat_templates_apply with the fallback chain described in run_chat_completion.
+// template_inputs keeps the flags of the level that succeeded.
+static common_chat_params apply_chat_template_with_fallback(
+    rn_llama_context* rn_ctx,
+    common_chat_templates_inputs& template_inputs) {
+    try {
+        return common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs);
+    } catch (const std::exception &) {
+        try {
+            template_inputs.force_pure_content = true;
+            return common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs);
+        } catch (const std::exception &) {
+            template_inputs.use_jinja = false;
+            return common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs);
+        }
+    }
+}
+
+static std::shared_ptr<rn_llama_context::chat_artifacts> build_chat_artifacts(
+    const rn_llama_context* rn_ctx,
+    const common_chat_params& chat_params) {
+    auto artifacts = std::make_shared<rn_llama_context::chat_artifacts>();
+    artifacts->params = chat_params;
+    artifacts->params.prompt.clear();
+
+    // Tokenize preserved_tokens strings from the chat template and keep the single-token
+    // IDs so the tokenizer never splits them mid-sequence.
+    // Mirrors server-task.cpp: common_tokenize → insert if size() == 1.
+    for (const auto & pt : chat_params.preserved_tokens) {
+        auto ids = common_tokenize(rn_ctx->vocab, pt, false, true);
+        if (ids.size() == 1) {
+            artifacts->preserved_ids.insert(ids[0]);
+        }
+    }
+
+    // Construct parser params from the applied chat params, then override reasoning format.
+    // The common_chat_parser_params(chat_params) constructor only copies format and
+    // generation_prompt — it does NOT copy the PEG arena.  Load it explicitly so that
+    // common_chat_parse uses the autoparser's generated PEG grammar for tool-call
+    // parsing instead of the fallback pure-content parser.
+    // Mirrors server-task.cpp: params.chat_parser_params.parser.load(data["chat_parser"])
+    // Built without tools too: stream_deltas splits reasoning from content with it.
+    try {
+        artifacts->parser.emplace(chat_params);
+        artifacts->parser->reasoning_format = rn_ctx->params.reasoning_format;
+        if (!chat_params.parser.empty()) {
+            artifacts->parser->parser.load(chat_params.parser);
+        }
+    } catch (const std::exception& e) {
+        artifacts->parser.reset();
+        artifacts->parser_error = e.what();
+    }
+    return artifacts;
+}
+
+// Renders the prompt for template_inputs. When an earlier render with the same key and
+// message shape verified that a force_pure_content render produces the same prompt, only
+// that render runs (no autoparser, grammar or schema conversion) and everything else comes
+// from the cached artifacts. Otherwise the full render runs; its artifacts are cached
+// when it succeeded without falling back, and the pure render is checked once for this
+// shape. pure_ok_out tells whether a pure render of these inputs is known to match, so
+// later renders of them (message boundaries) can skip the grammar too.
+static common_chat_params apply_chat_template_cached(
+    rn_llama_context* rn_ctx,
+    common_chat_templates_inputs& template_inputs,
+    uint64_t key,
+    uint32_t shape,
+    std::shared_ptr<const rn_llama_context::chat_artifacts>& artifacts_out,
+    bool& pure_ok_out) {
+    pure_ok_out = false;
+    std::shared_ptr<rn_llama_context::chat_artifacts> cached;
+    std::optional<bool> pure_ok;
+    {
+        std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+        auto& lru = rn_ctx->chat_artifact_cache;
+        for (auto it = lru.begin(); it != lru.end(); ++it) {
+            if (it->first == key) {
+                lru.splice(lru.begin(), lru, it);
+                cached = it->second;
+                auto ok = cached->pure_render_ok.find(shape);
+                if (ok != cached->pure_render_ok.end()) {
+                    pure_ok = ok->second;
+                }
+                break;
+            }
+        }
+    }
+
+    if (cached && pure_ok.value_or(false)) {
+        try {
+            template_inputs.force_pure_content = true;
+            common_chat_params chat_params = cached->params;
+            chat_params.prompt = common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs).prompt;
+            template_inputs.force_pure_content = false;
+            artifacts_out = cached;
+            pure_ok_out   = true;
+            return chat_params;
+        } catch (const std::exception &) {
+            template_inputs.force_pure_content = false; // render the full way below
+        }
+    }
+
+    const bool use_jinja = template_inputs.use_jinja;
+    common_chat_params chat_params = apply_chat_template_with_fallback(rn_ctx, template_inputs);
+    const bool fell_back = template_inputs.force_pure_content || template_inputs.use_jinja != use_jinja;
+
+    std::shared_ptr<rn_llama_context::chat_artifacts> artifacts =
+        cached ? cached : build_chat_artifacts(rn_ctx, chat_params);
+    artifacts_out = artifacts;
+    if (fell_back || pure_ok.has_value()) {
+        // A fallback render is not representative of this key (used for this call only);
+        // a known shape has already been checked (and, if verified, its pure render just
+        // failed, so it is not reported as usable).
+        return chat_params;
+    }
+
+    bool matches = false;
+    try {
+        common_chat_templates_inputs pure_inputs = template_inputs;
+        pure_inputs.force_pure_content = true;
+        matches = common_chat_templates_apply(rn_ctx->chat_templates.get(), pure_inputs).prompt == chat_params.prompt;
+    } catch (const std::exception &) {
+        matches = false;
+    }
+
+    pure_ok_out = matches;
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    artifacts->pure_render_ok[shape] = matches;
+    if (!cached) {
+        auto& lru = rn_ctx->chat_artifact_cache;
+        lru.emplace_front(key, artifacts);
+        while (lru.size() > rn_llama_context::CHAT_ARTIFACT_CACHE_SIZE) {
+            lru.pop_back();
+        }
+    }
+    return chat_params;
+}
+
+llama_seq_id rn_acquire_seq(rn_llama_context* rn_ctx) {
+    std::lock_guard<std::mutex> lock(rn_ctx->seq_mutex);
+    for (size_t i = 1; i < rn_ctx->seq_in_use.size(); i++) {
+        if (!rn_ctx->seq_in_use[i]) {
+            rn_ctx->seq_in_use[i] = true;
+            return static_cast<llama_seq_id>(i);
+        }
+    }
+    return -1;
+}
+
+void rn_release_seq(rn_llama_context* rn_ctx, llama_seq_id seq_id) {
+    std::lock_guard<std::mutex> lock(rn_ctx->seq_mutex);
+    if (seq_id > 0 && static_cast<size_t>(seq_id) < rn_ctx->seq_in_use.size()) {
+        rn_ctx->seq_in_use[seq_id] = false;
+    }
+}
+
+int rn_decode(rn_llama_context* rn_ctx, const llama_batch& batch) {
+    int ret = llama_decode(rn_ctx->ctx, batch);
+    while (ret == 1 && rn_ctx->scheduler && rn_ctx->scheduler->evict_idle_slot()) {
+        ret = llama_decode(rn_ctx->ctx, batch);
+    }
+    return ret;
+}
+
+void rn_clear_sequence(rn_llama_context* rn_ctx, llama_seq_id seq_id) {
+    llama_memory_t mem = llama_get_memory(rn_ctx->ctx);
+    if (seq_id == 0) {
+        rn_ctx->kv_tokens.clear();
+        rn_ctx->kv_shared_len = 0;
+    }
+    if (rn_ctx->seq_in_use.size() <= 1) {
+        // Single-sequence context: a full clear also resets recurrent state and is what
+        // every caller did before sequences other than 0 existed.
+        llama_memory_clear(mem, true);
+        return;
+    }
+    // Other sequences may be live (scheduler slots) — only drop this one.
+    llama_memory_seq_rm(mem, seq_id, -1, -1);
+}
+
+rn_llama_context::seq0_state rn_copy_seq0_state(rn_llama_context* rn_ctx) {
+    rn_llama_context::seq0_state state;
+    state.kv_tokens          = rn_ctx->kv_tokens;
+    state.kv_shared_len      = rn_ctx->kv_shared_len;
+    state.kv_messages        = rn_ctx->kv_messages;
+    state.kv_has_messages    = rn_ctx->kv_has_messages;
+    state.kv_render_identity = rn_ctx->kv_render_identity;
+    state.kv_evicted_ids     = rn_ctx->kv_evicted_ids;
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    state.completion_cache = rn_ctx->completion_cache;
+    return state;
+}
+
+rn_llama_context::seq0_state rn_take_seq0_state(rn_llama_context* rn_ctx) {
+    rn_llama_context::seq0_state state = rn_copy_seq0_state(rn_ctx);
+    rn_put_seq0_state(rn_ctx, {});
+    return state;
+}
+
+void rn_put_seq0_state(rn_llama_context* rn_ctx, rn_llama_context::seq0_state state) {
+    rn_ctx->kv_tokens          = std::move(state.kv_tokens);
+    rn_ctx->kv_shared_len      = state.kv_shared_len;
+    rn_ctx->kv_messages        = std::move(state.kv_messages);
+    rn_ctx->kv_has_messages    = state.kv_has_messages;
+    rn_ctx->kv_render_identity = std::move(state.kv_render_identity);
+    rn_ctx->kv_evicted_ids     = std::move(state.kv_evicted_ids);
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    rn_ctx->completion_cache = std::move(state.completion_cache);
+}
+
+common_params_sampling build_sampling_params(
     const rn_llama_context* rn_ctx,
     const CompletionOptions& options) {
-    std::string identity;
-    identity.reserve(512);
-    identity += "use_jinja=" + std::to_string(rn_ctx->params.use_jinja ? 1 : 0);
-    identity += "|reasoning_format=" + std::to_string(static_cast<int>(rn_ctx->params.reasoning_format));
-    identity += "|chat_template=" + rn_ctx->params.chat_template;
-    identity += "|tool_choice=" + options.tool_choice;
-    identity += "|grammar=" + options.grammar;
-    identity += "|tools=" + (options.tools.is_null() ? "null" : options.tools.dump());
-    return identity;
+    // Create a copy of sampling parameters and apply per-request overrides.
+    // All mutations happen on this LOCAL copy — rn_ctx_->params.sampling is never touched.
+    common_params_sampling sampling_params = rn_ctx->params.sampling;
+
+    // Apply per-request sampling overrides from CompletionOptions.
+    // Only override when the caller explicitly set a value (not NaN / -1 sentinel).
+    // When not set, the model's initLlama defaults (params.sampling) are preserved —
+    // this respects per-model tuning and GGUF-embedded sampling metadata.
+    auto applyF = [](float& dst, float src) { if (!std::isnan(src)) dst = src; };
+    auto applyFI = [](int32_t& dst, float src) { if (!std::isnan(src)) dst = static_cast<int32_t>(src); };
+    applyF(sampling_params.temp,            options.temperature);
+    applyF(sampling_params.top_p,           options.top_p);
+    applyFI(sampling_params.top_k,          options.top_k);
+    applyF(sampling_params.min_p,           options.min_p);
+    applyF(sampling_params.penalty_present, options.presence_penalty);
+    applyF(sampling_params.penalty_repeat,  options.repeat_penalty);
+    applyF(sampling_params.penalty_freq,    options.frequency_penalty);
+    if (options.repeat_last_n >= 0) {
+        sampling_params.penalty_last_n = options.repeat_last_n;
+    } else if (sampling_params.penalty_last_n == 64) {
+        // Neither the caller nor the GGUF set a repeat-penalty window.
+        // 64 (llama.cpp hardcoded default) is smaller than a typical paragraph (~80-200 tokens),
+        // so paragraph-level repetition passes through the penalty window undetected.
+        // Bump to 256 — covers ~2 average paragraphs with no user intent to override.
+        sampling_params.penalty_last_n = 256;
+    }
+    // Map JS sentinel -1 ("use default/random") to the model's configured seed.
+    // Only override if the caller supplied an explicit non-negative seed.
+    if (options.seed >= 0) {
+        sampling_params.seed = static_cast<uint32_t>(options.seed);
+    }
+
+    // Merge preserved token IDs from the chat template autoparser into sampling params.
+    // These are special single-token strings (e.g. "<think>", "<|eot_id|>") that the
+    // tokenizer must not split — required for lazy grammar triggers to work correctly.
+    for (auto tok : options.preserved_tokens) {
+        sampling_params.preserved_tokens.insert(tok);
+    }
+
+    if (!options.grammar.empty()) {
+        sampling_params.grammar = common_grammar(COMMON_GRAMMAR_TYPE_USER, options.grammar);
+        // Force grammar_lazy to false whenever tools are present to ensure strict JSON format enforcement
+        if (!options.tools.empty()) {
+            sampling_params.grammar_lazy = false;
+        } else {
+            sampling_params.grammar_lazy = options.grammar_lazy;
+        }
+        // Pass grammar_triggers if any were provided by chat_params and passed via options
+        if (!options.grammar_triggers.empty()) {
+            sampling_params.grammar_triggers = options.grammar_triggers;
+        }
+    }
+
+    // Wire reasoning budget into sampling params.
+    // The start/end tags come from chat_params.thinking_start/end_tag (set by run_chat_completion).
+    // Mirrors server-common.cpp oaicompat_chat_params_parse() reasoning budget block.
+    if (!options.reasoning_budget_start_tag.empty() && !options.reasoning_budget_end_tag.empty()) {
+        sampling_params.reasoning_budget_tokens  = options.reasoning_budget_tokens;
+        sampling_params.reasoning_budget_start   = common_tokenize(rn_ctx->vocab, options.reasoning_budget_start_tag, false, true);
+        sampling_params.reasoning_budget_end     = common_tokenize(rn_ctx->vocab, options.reasoning_budget_end_tag,   false, true);
+        if (!options.reasoning_budget_message.empty()) {
+            sampling_params.reasoning_budget_forced = common_tokenize(rn_ctx->vocab,
+                options.reasoning_budget_message + options.reasoning_budget_end_tag, false, true);
+            sampling_params.reasoning_budget_message = options.reasoning_budget_message;
+        } else {
+            sampling_params.reasoning_budget_forced = sampling_params.reasoning_budget_end;
+        }
+    }
+
+    return sampling_params;
+}
+
+rn_sampler_cache::sampler_ptr rn_sampler_cache::acquire(
+    const llama_model* model,
+    const common_params_sampling& params,
+    const std::string& key) {
+    sampler_ptr sampler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = idle_.begin(); it != idle_.end(); ++it) {
+            if (it->first == key) {
+                sampler = std::move(it->second);
+                idle_.erase(it);
+                break;
+            }
+        }
+    }
+    if (sampler) {
+        common_sampler_reset(sampler.get()); // outside the lock: re-parses the grammar
+        return sampler;
+    }
+    return sampler_ptr(common_sampler_init(model, params));
+}
+
+void rn_sampler_cache::release(std::string key, sampler_ptr sampler) {
+    if (!sampler || key.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.emplace_front(std::move(key), std::move(sampler));
+    while (idle_.size() > CAPACITY) {
+        idle_.pop_back();
+    }
+}
+
+void rn_sampler_cache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+}
+
+std::string sampler_cache_key(const common_params_sampling& params, const std::string& grammar) {
+    std::ostringstream key;
+    key << params.print() << "|seed=" << params.seed
+        << "|grammar=" << std::hash<std::string>{}(grammar) << ':' << grammar.size()
+        << "|lazy=" << params.grammar_lazy << "|triggers=";
+    for (const auto& t : params.grammar_triggers) {
+        key << static_cast<int>(t.type) << ':' << t.token << ':' << t.value.size() << ':' << t.value << ',';
+    }
+    key << "|preserved=";
+    for (llama_token tok : params.preserved_tokens) {
+        key << tok << ',';
+    }
+    key << "|budget=" << params.reasoning_budget_tokens << ':';
+    for (const auto* toks : {&params.reasoning_budget_start, &params.reasoning_budget_end,
+                             &params.reasoning_budget_forced}) {
+        for (llama_token tok : *toks) {
+            key << tok << ',';
+        }
+        key << ';';
+    }
+    return key.str();
+}
+
+bool acquire_sampler(rn_llama_context* rn_ctx,
+                     completion_state& state,
+                     const common_params_sampling& params,
+                     const CompletionOptions& options) {
+    if (rn_ctx->sampler_cache) {
+        state.sampler_key = sampler_cache_key(params, options.grammar);
+        state.sampler = rn_ctx->sampler_cache->acquire(rn_ctx->model, params, state.sampler_key);
+    } else {
+        state.sampler_key.clear();
+        state.sampler.reset(common_sampler_init(rn_ctx->model, params));
+    }
+    return state.sampler != nullptr;
+}
+
+void release_sampler(rn_llama_context* rn_ctx, completion_state& state) {
+    if (rn_ctx->sampler_cache && state.sampler) {
+        rn_ctx->sampler_cache->release(std::move(state.sampler_key), std::move(state.sampler));
+    }
+}
+
+void prime_sampler(common_sampler* sampler,
+                   const common_params_sampling& params,
+                   const std::vector<llama_token>& prompt) {
+    // Tokens older than every history window have no effect on sampling.
+    int32_t window = std::max(params.n_prev, params.penalty_last_n);
+    if (params.dry_multiplier != 0.0f) {
+        window = params.dry_penalty_last_n < 0 ? -1 : std::max(window, params.dry_penalty_last_n);
+    }
+    if (params.penalty_last_n < 0 || !params.reasoning_budget_start.empty()) {
+        window = -1;
+    }
+    const size_t n_replay = window < 0 ? prompt.size() : std::min(prompt.size(), static_cast<size_t>(window));
+
+    for (size_t i = prompt.size() - n_replay; i < prompt.size(); i++) {
+        common_sampler_accept(sampler, prompt[i], false);
+    }
+}
+
+int resolve_n_predict(const rn_llama_context* rn_ctx, const CompletionOptions& options) {
+    if (options.n_predict >= 0) {
+        return options.n_predict;
+    }
+    if (rn_ctx->params.n_predict >= 0) {
+        return rn_ctx->params.n_predict;
+    }
+    return -1; // unlimited — EOS or stop string terminates
+}
+
+void set_deadlines(completion_state& state, const CompletionOptions& options) {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point t0 =
+        options.t_request == clock::time_point{} ? clock::now() : options.t_request;
+    state.t_deadline = options.max_time_ms > 0
+        ? t0 + std::chrono::milliseconds(options.max_time_ms) : clock::time_point::max();
+    state.t_first_token = options.first_token_deadline_ms > 0
+        ? t0 + std::chrono::milliseconds(options.first_token_deadline_ms) : clock::time_point::max();
+    state.t_first_token = std::min(state.t_first_token, state.t_deadline);
+}
+
+bool deadline_passed(completion_state& state) {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point deadline = state.n_decoded == 0 ? state.t_first_token : state.t_deadline;
+    if (deadline == clock::time_point::max() || clock::now() < deadline) {
+        return false;
+    }
+    state.has_next_token = false;
+    state.stopped_by_time = true;
+    return true;
+}
+
+void reserve_generation_buffers(completion_state& state) {
+    // MP-P2 FIX: pre-reserve generated_text and generated_tokens to avoid
+    // repeated heap reallocations inside the token generation loop.
+    // Average token is ~4 bytes (mixed ASCII/UTF-8); reserve 4× n_predict chars.
+    // For unlimited generation (n_predict < 0), reserve 512 tokens as a reasonable default.
+    if (state.n_predict > 0) {
+        state.generated_text.reserve(static_cast<size_t>(state.n_predict) * 4);
+        state.generated_tokens.reserve(static_cast<size_t>(state.n_predict));
+    } else {
+        // Thinking models (reasoning_budget != 0) generate 2000-5000 token reasoning
+        // blocks with n_predict = -1. Reserve enough upfront to avoid reallocations.
+        const bool has_thinking = (state.rn_ctx->params.reasoning_budget != 0);
+        const size_t initial_reserve = has_thinking ? 6144 : 512;
+        state.generated_text.reserve(initial_reserve * 4);
+        state.generated_tokens.reserve(initial_reserve);
+    }
+}
+
+void flush_unsent_text(
+    completion_state& state,
+    const std::function<bool(const std::string&, bool)>& callback) {
+    utf8_trim_incomplete(state.generated_text);
+    state.n_sent_text = std::min(state.n_sent_text, state.generated_text.size());
+    if (callback && state.n_sent_text < state.generated_text.size()) {
+        callback(state.generated_text.substr(state.n_sent_text), false);
+        state.n_sent_text = state.generated_text.size();
+    }
+}
+
+bool process_generated_token(
+    completion_state& state,
+    llama_token token_id,
+    std::string_view token_text,
+    const CompletionOptions& options,
+    const std::function<bool(const std::string&, bool)>& callback) {
+    const llama_vocab* vocab = state.rn_ctx->vocab;
+
+    // Check EOS FIRST — before streaming — so the EOS token text is never sent to JS
+    // and all end-of-generation tokens are handled (not just the single llama_vocab_eos()).
+    // Also erase the EOG token text from generated_text so it does not appear in
+    // result.content or any streamed batch: EOG tokens are control tokens, not content.
+    if (!options.ignore_eos && llama_vocab_is_eog(vocab, token_id)) {
+        if (state.generated_text.size() >= token_text.size()) {
+            state.generated_text.erase(state.generated_text.size() - token_text.size());
+        } else {
+            state.generated_text.clear();
+        }
+        if (state.n_sent_text > state.generated_text.size()) {
+            state.n_sent_text = state.generated_text.size();
+        }
+        if (!state.generated_tokens.empty()) {
+            state.generated_tokens.pop_back();
+        }
+        state.has_next_token = false;
+        // Flush any buffered tokens before stopping on EOS
+        flush_unsent_text(state, callback);
+        return false;
+    }
+
+    // Check stopping conditions (stop strings, context limit, n_remaining)
+    if (check_stop_conditions(state, token_text, options.ignore_eos)) {
+        // Flush any buffered tokens before stopping on stop string / context limit
+        flush_unsent_text(state, callback);
+        return false;
+    }
+
+    // Stream unsent text, holding back the longest suffix that could be the start of
+    // a stop word (tracked by the stop-string automaton) and any character whose
+    // remaining UTF-8 bytes have not been generated yet, so JS only sees whole
+    // code points.
+    if (callback) {
+        const size_t holdback = std::max(state.stop_matcher.partial_len(),
+                                         utf8_incomplete_tail(state.generated_text));
+        const size_t safe_send_limit =
+            state.generated_text.size() - std::min(holdback, state.generated_text.size());
+        if (safe_send_limit > state.n_sent_text) {
+            std::string text_to_send = state.generated_text.substr(
+                state.n_sent_text, safe_send_limit - state.n_sent_text);
+            state.n_sent_text = safe_send_limit;
+            if (!text_to_send.empty() && !callback(text_to_send, false)) {
+                state.has_next_token = false;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Resyncs the draft context with `history` (target seq 0 plus the token about to be
+// verified) by longest common prefix, then drafts up to n_max tokens greedily.
+// Drafting stops early on EOG or when the draft is not confident (draft_p_min).
+// Returns an empty vector on any draft-side failure — the caller then decodes normally.
+static std::vector<llama_token> draft_from_model(
+    rn_llama_context* rn_ctx,
+    const std::vector<llama_token>& history,
+    int n_max) {
+    std::vector<llama_token> drafts;
+    llama_context* dctx = rn_ctx->draft_ctx;
+    llama_memory_t dmem = llama_get_memory(dctx);
+    std::vector<llama_token>& cache = rn_ctx->draft_cache;
+
+    // Keep at least the last history token to decode so the draft has fresh logits.
+    size_t n_keep = std::min(common_lcp(cache, history), history.size() - 1);
+    if (!llama_memory_seq_rm(dmem, 0, static_cast<llama_pos>(n_keep), -1)) {
+        llama_memory_clear(dmem, true);
+        n_keep = 0;
+    }
+    cache.resize(n_keep);
+
+    llama_batch& batch = rn_ctx->draft_batch;
+    const size_t n_batch = static_cast<size_t>(std::max(1, rn_ctx->params.n_batch));
+    for (size_t i = n_keep; i < history.size(); ) {
+        const size_t n = std::min(n_batch, history.size() - i);
+        common_batch_clear(batch);
+        for (size_t j = 0; j < n; j++) {
+            common_batch_add(batch, history[i + j], static_cast<llama_pos>(i + j), {0},
+                             i + j == history.size() - 1);
+        }
+        if (llama_decode(dctx, batch) != 0) {
+            llama_memory_seq_rm(dmem, 0, static_cast<llama_pos>(i), -1);
+            return drafts;
+        }
+        cache.insert(cache.end(), history.begin() + i, history.begin() + i + n);
+        i += n;
+    }
+
+    const int n_vocab = llama_vocab_n_tokens(rn_ctx->vocab);
+    for (int k = 0; k < n_max; k++) {
+        const float* logits = llama_get_logits_ith(dctx, -1);
+        if (!logits) {
+            break;
+        }
+        // Greedy pick and its probability 1 / sum(exp(l - max)) in one pass over the
+        // logits: the running sum is rescaled whenever a new max appears, so the
+        // distribution is never materialized.
+        llama_token best  = 0;
+        float       denom = 1.0f;
+        for (llama_token t = 1; t < n_vocab; t++) {
+            const float d = logits[t] - logits[best];
+            if (d > 0.0f) {
+                denom = denom * std::exp(-d) + 1.0f;
+                best  = t;
+            } else {
+                denom += std::exp(d);
+            }
+        }
+        if (1.0f / denom < rn_ctx->params.draft_p_min) {
+            break;
+        }
+
+        drafts.push_back(best);
+        if (k + 1 == n_max || llama_vocab_is_eog(rn_ctx->vocab, best)) {
+            break;
+        }
+        common_batch_clear(batch);
+        common_batch_add(batch, best, static_cast<llama_pos>(cache.size()), {0}, true);
+        if (llama_decode(dctx, batch) != 0) {
+            llama_memory_seq_rm(dmem, 0, static_cast<llama_pos>(cache.size()), -1);
+            break;
+        }
+        cache.push_back(best);
+    }
+    return drafts;
+}
+
+// Prompt lookup: finds an earlier occurrence of the last n tokens of `history`
+// (ngram_min <= n <= ngram, longest first, then most recent) and proposes up to n_max
+// tokens that followed it. Pays off when the output echoes the input (summaries,
+// rewrites, extraction, code edits).
+//
+// history is seq 0's tokens plus the token about to be verified. Start positions of
+// every ngram_min-gram in history[0, size - 1) are indexed incrementally, so a step
+// only hashes the tokens added since the last one and checks a bounded number of the
+// most recent candidates. Candidates are compared against history, so an index left
+// stale by a context shift can only miss; a shorter history or a changed last indexed
+// token rebuilds it.
+class rn_prompt_lookup {
+public:
+    rn_prompt_lookup(int ngram_min, int ngram) : ngram_min_(ngram_min), ngram_(ngram) {}
+
+    // Returns the drafted tokens (empty when no n-gram of at least ngram_min matches)
+    // and sets match_len to the length of the matched n-gram.
+    std::vector<llama_token> draft(const std::vector<llama_token>& history, int n_max, int& match_len) {
+        match_len = 0;
+        const int n_hist = static_cast<int>(history.size());
+        if (n_hist <= ngram_min_) {
+            return {};
+        }
+        update(history);
+
+        const auto it = index_.find(key(history, n_hist - ngram_min_));
+        if (it == index_.end()) {
+            return {};
+        }
+        int best_start = -1;
+        int n_checked  = 0;
+        for (auto pos = it->second.rbegin(); pos != it->second.rend() && n_checked < MAX_CANDIDATES;
+             ++pos, ++n_checked) {
+            const int i = *pos; // candidate n-gram [i, i + ngram_min), continuation at i + ngram_min
+            if (!std::equal(history.end() - ngram_min_, history.end(), history.begin() + i)) {
+                continue; // hash collision or stale entry
+            }
+            int len = ngram_min_;
+            while (len < ngram_ && i + ngram_min_ - len - 1 >= 0 &&
+                   history[i + ngram_min_ - len - 1] == history[n_hist - len - 1]) {
+                len++;
+            }
+            if (len > match_len) {
+                match_len  = len;
+                best_start = i + ngram_min_;
+                if (len == ngram_) {
+                    break;
+                }
+            }
+        }
+        if (best_start < 0) {
+            return {};
+        }
+        const int n_take = std::min(n_max, n_hist - best_start);
+        return std::vector<llama_token>(history.begin() + best_start, history.begin() + best_start + n_take);
+    }
+
+private:
+    // Candidates checked per step, most recent first.
+    static constexpr int MAX_CANDIDATES = 16;
+
+    uint64_t key(const std::vector<llama_token>& tokens, int start) const {
+        uint64_t h = 1469598103934665603ull;
+        for (int j = 0; j < ngram_min_; j++) {
+            h = (h ^ static_cast<uint32_t>(tokens[start + j])) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    // Indexes every n-gram that ends before the last history token, i.e. every one with a
+    // continuation and that is not the tail being looked up.
+    void update(const std::vector<llama_token>& history) {
+        const int n_body = static_cast<int>(history.size()) - 1;
+        if (n_body < n_indexed_ || (n_indexed_ > 0 && history[n_indexed_ - 1] != last_indexed_)) {
+            index_.clear();
+            n_indexed_ = 0;
+        }
+        for (int i = std::max(0, n_indexed_ - ngram_min_ + 1); i + ngram_min_ <= n_body; i++) {
+            index_[key(history, i)].push_back(i);
+        }
+        if (n_body > n_indexed_) {
+            n_indexed_    = n_body;
+            last_indexed_ = history[n_body - 1];
+        }
+    }
+
+    int ngram_min_;
+    int ngram_;
+    int n_indexed_ = 0; // history prefix whose n-grams are in index_
+    llama_token last_indexed_ = LLAMA_TOKEN_NULL;
+    std::unordered_map<uint64_t, std::vector<int>> index_;
+};
+
+// Pool sequences borrowed for one request (n choices, beams). They are emptied and
+// returned to the pool on every exit path.
+struct borrowed_seqs {
+    rn_llama_context*         rn_ctx;
+    std::vector<llama_seq_id> ids;
+
+    explicit borrowed_seqs(rn_llama_context* ctx) : rn_ctx(ctx) {}
+    borrowed_seqs(const borrowed_seqs&) = delete;
+    borrowed_seqs& operator=(const borrowed_seqs&) = delete;
+    ~borrowed_seqs() {
+        for (llama_seq_id id : ids) {
+            rn_clear_sequence(rn_ctx, id);
+            rn_release_seq(rn_ctx, id);
+        }
+    }
+
+    // Borrows n more empty sequences; false when the pool runs out.
+    bool acquire(int n) {
+        for (int i = 0; i < n; i++) {
+            const llama_seq_id seq = rn_acquire_seq(rn_ctx);
+            if (seq < 0) {
+                return false;
+            }
+            ids.push_back(seq);
+            rn_clear_sequence(rn_ctx, seq);
+        }
+        return true;
+    }
+};
+
+// Lets a higher-priority request waiting on rn_ctx->gate run (see rn_priority_gate::yield).
+// Seq 0 is parked in a free pooled sequence, or as a host snapshot when the pool is empty,
+// together with its bookkeeping, and restored once the gate comes back. The request that
+// ran meanwhile overwrote the logits, so `relogit` (the token at n_past - 1, or
+// LLAMA_TOKEN_NULL between prompt chunks) is decoded again; recurrent state cannot take a
+// token twice, so those models are only preempted between prompt chunks. Returns false
+// when the request no longer owns seq 0: it was cancelled while parked, or the restore failed.
+static bool preempt_point(rn_llama_context* rn_ctx, completion_state& state, llama_token relogit) {
+    rn_priority_gate* gate = rn_ctx->gate;
+    if (!gate || !gate->should_yield()) {
+        return true;
+    }
+    if (relogit != LLAMA_TOKEN_NULL &&
+        (llama_model_is_recurrent(rn_ctx->model) || llama_model_is_hybrid(rn_ctx->model))) {
+        return true;
+    }
+
+    llama_memory_t mem = llama_get_memory(rn_ctx->ctx);
+    borrowed_seqs parked(rn_ctx);
+    std::vector<uint8_t> snapshot;
+    if (parked.acquire(1)) {
+        llama_memory_seq_cp(mem, 0, parked.ids[0], -1, -1);
+    } else {
+        snapshot.resize(llama_state_seq_get_size(rn_ctx->ctx, 0));
+        if (snapshot.empty() ||
+            llama_state_seq_get_data(rn_ctx->ctx, snapshot.data(), snapshot.size(), 0) != snapshot.size()) {
+            return true; // cannot park: keep the gate
+        }
+    }
+
+    rn_llama_context::seq0_state saved = rn_copy_seq0_state(rn_ctx);
+    const int32_t session_id = rn_ctx->active_session;
+    if (!parked.ids.empty()) {
+        // Whoever runs meanwhile must not shift the cells the parked copy shares.
+        rn_ctx->kv_shared_len = rn_ctx->kv_tokens.size();
+    }
+
+    const llama_perf_context_data perf = llama_perf_context(rn_ctx->ctx);
+    state.perf_parked.t_p_eval_ms += perf.t_p_eval_ms;
+    state.perf_parked.t_eval_ms   += perf.t_eval_ms;
+    state.perf_parked.n_p_eval    += perf.n_p_eval;
+    state.perf_parked.n_eval      += perf.n_eval;
+
+    if (!gate->yield()) {
+        return false; // seq 0 and its bookkeeping now belong to whoever ran meanwhile
+    }
+
+    // A request on another chat session may have run meanwhile: set its conversation
+    // aside before seq 0 is overwritten.
+    if (rn_ctx->active_session != session_id) {
+        rn_park_active_session(rn_ctx);
+    }
+    rn_clear_sequence(rn_ctx, 0);
+    if (!parked.ids.empty()) {
+        llama_memory_seq_cp(mem, parked.ids[0], 0, -1, -1);
+    } else if (llama_state_seq_set_data(rn_ctx->ctx, snapshot.data(), snapshot.size(), 0) != snapshot.size()) {
+        rn_clear_sequence(rn_ctx, 0);
+        return false;
+    }
+    rn_put_seq0_state(rn_ctx, std::move(saved));
+    rn_resume_session(rn_ctx, session_id);
+    llama_perf_context_reset(rn_ctx->ctx);
+
+    if (relogit != LLAMA_TOKEN_NULL) {
+        llama_memory_seq_rm(mem, 0, state.n_past - 1, -1);
+        llama_batch& batch = rn_ctx->gen_batch;
+        common_batch_clear(batch);
+        common_batch_add(batch, relogit, state.n_past - 1, {0}, true);
+        if (rn_decode(rn_ctx, batch) != 0) {
+            rn_clear_sequence(rn_ctx, 0);
+            return false;
+        }
+    }
+    return true;
+}
+
+// One pass over a logits row: collects the k highest logits into `top` (most likely
+// first) and returns log Z, so logit - log Z is the token's log-probability.
+static double log_softmax_top_k(
+    const float* logits,
+    int n_vocab,
+    int k,
+    std::vector<std::pair<float, llama_token>>& top) {
+    const float max_logit = *std::max_element(logits, logits + n_vocab);
+    double sum = 0.0;
+    top.clear();
+    for (llama_token t = 0; t < n_vocab; t++) {
+        sum += std::exp(static_cast<double>(logits[t] - max_logit));
+        if (static_cast<int>(top.size()) < k || logits[t] > top.back().first) {
+            auto at = std::upper_bound(top.begin(), top.end(), logits[t],
+                [](float v, const std::pair<float, llama_token>& e) { return v > e.first; });
+            top.insert(at, {logits[t], t});
+            if (static_cast<int>(top.size()) > k) {
+                top.pop_back();
+            }
+        }
+    }
+    return max_logit + std::log(sum);
+}
+
+// logprobs > 0: records the logprob of the token just sampled from the last logits row
+// and the state.n_logprobs most likely alternatives. Read from the model's full
+// distribution rather than the sampler's candidate array, which top-k / temperature
+// have already truncated and rescaled (greedy decoding would report 0 for every token).
+static void record_logprobs(
+    rn_llama_context* rn_ctx,
+    completion_state& state,
+    llama_token token_id) {
+    const int k = state.n_logprobs;
+    const int n_vocab = llama_vocab_n_tokens(rn_ctx->vocab);
+    const float* logits = llama_get_logits_ith(rn_ctx->ctx, -1);
+    if (!logits || token_id < 0 || token_id >= n_vocab) {
+        return;
+    }
+    thread_local std::vector<std::pair<float, llama_token>> top;
+    const double log_z = log_softmax_top_k(logits, n_vocab, k, top);
+
+    state.token_logprobs.push_back(static_cast<float>(logits[token_id] - log_z));
+    for (int i = 0; i < k; i++) {
+        const bool valid = i < static_cast<int>(top.size());
+        state.top_tokens.push_back(valid ? top[i].second : LLAMA_TOKEN_NULL);
+        state.top_logprobs.push_back(valid ? static_cast<float>(top[i].first - log_z) : -INFINITY);
+    }
+}
+
+// n > 1: forks the prompt prefilled in seq 0 into n_choices - 1 pooled sequences with
+// llama_memory_seq_cp (the prompt cells are shared, not copied) and samples every
+// choice in one batched decode per step. Choice 0 is `state` itself: it stays on seq 0,
+// is mirrored in kv_tokens and streams through callback. The other choices run
+// silently. Every choice lands in result.choices and `state` is left finished, so the
+// single-sequence loop in run_completion is skipped. Speculation and context shift
+// are not used; a choice that runs out of context ends as truncated.
+static bool generate_choices(
+    rn_llama_context* rn_ctx,
+    const CompletionOptions& options,
+    const common_params_sampling& sampling_params,
+    completion_state& state,
+    bool track_kv,
+    const std::function<bool(const std::string&, bool)>& callback,
+    CompletionResult& result) {
+
+    const int n_choices = std::min(std::clamp(options.n_choices, 1, RN_MAX_CHOICES),
+                                   static_cast<int>(rn_ctx->params.n_batch));
+    llama_memory_t mem = llama_get_memory(rn_ctx->ctx);
+
+    borrowed_seqs forked(rn_ctx);
+    if (!forked.acquire(n_choices - 1)) {
+        result.success = false;
+        result.error_msg = "n = " + std::to_string(n_choices) + " needs " +
+            std::to_string(n_choices - 1) + " free KV sequences; raise n_seq_max in initLlama";
+        result.error_type = RN_ERROR_INVALID_PARAM;
+        return false;
+    }
+    std::vector<llama_seq_id> seq_ids = {0};
+    for (llama_seq_id seq : forked.ids) {
+        llama_memory_seq_cp(mem, 0, seq, -1, -1);
+        seq_ids.push_back(seq);
+    }
+
+    // Choices 1..n-1 get their own sampler, seeded with the same prompt history as
+    // choice 0. A fixed seed is offset per choice so they don't draw identical streams.
+    std::vector<completion_state> forks(n_choices - 1);
+    std::vector<completion_state*> choices = {&state};
+    for (int c = 1; c < n_choices; c++) {
+        completion_state& fork = forks[c - 1];
+        fork.rn_ctx      = rn_ctx;
+        fork.n_past      = state.n_past;
+        fork.n_ctx       = state.n_ctx;
+        fork.n_predict   = state.n_predict;
+        fork.n_remaining = state.n_remaining;
+        fork.antiprompt  = state.antiprompt;
+        fork.stop_matcher.build(fork.antiprompt);
+
+        common_params_sampling fork_params = sampling_params;
+        if (fork_params.seed != LLAMA_DEFAULT_SEED) {
+            fork_params.seed += static_cast<uint32_t>(c);
+        }
+        if (!acquire_sampler(rn_ctx, fork, fork_params, options)) {
+            result.success = false;
+            result.error_msg = "Failed to initialize sampler";
+            result.error_type = RN_ERROR_INFERENCE;
+            return false;
+        }
+        prime_sampler(fork.sampler.get(), fork_params, state.prompt_tokens);
+        reserve_generation_buffers(fork);
+        choices.push_back(&fork);
+    }
+
+    // Every choice samples its first token from the prompt logits (row -1), then from
+    // its own row of the previous step's batch.
+    llama_batch& batch = rn_ctx->ingest_batch;
+    std::vector<int>         i_batch(n_choices, -1);
+    std::vector<llama_token> sampled(n_choices, LLAMA_TOKEN_NULL);
+    std::vector<bool>        active(n_choices, true);
+    int n_active = n_choices;
+
+    auto finish_truncated = [&](int c) {
+        choices[c]->truncated        = true;
+        choices[c]->stopped_by_limit = true;
+        choices[c]->has_next_token   = false;
+        active[c] = false;
+        n_active--;
+    };
+
+    while (n_active > 0) {
+        if (deadline_passed(state)) {
+            for (int c = 0; c < n_choices; c++) {
+                if (active[c]) {
+                    choices[c]->stopped_by_time = true;
+                    choices[c]->has_next_token  = false;
+                }
+            }
+            break;
+        }
+        {
+            int requested = rn_ctx->requested_n_threads.exchange(-1, std::memory_order_acq_rel);
+            if (requested > 0) {
+                llama_set_n_threads(rn_ctx->ctx, requested, requested);
+            }
+        }
+
+        common_batch_clear(batch);
+        for (int c = 0; c < n_choices; c++) {
+            if (!active[c]) {
+                continue;
+            }
+            completion_state& cs = *choices[c];
+            if (cs.n_past + 1 >= cs.n_ctx) {
+                finish_truncated(c);
+                continue;
+            }
+            sampled[c] = common_sampler_sample(cs.sampler.get(), rn_ctx->ctx, i_batch[c]);
+            if (sampled[c] == LLAMA_TOKEN_NULL) {
+                result.success = false;
+                result.error_msg = "Sampler produced no valid token (grammar may be over-constrained)";
+                result.error_type = RN_ERROR_INFERENCE;
+                return false;
+            }
+            i_batch[c] = batch.n_tokens;
+            common_batch_add(batch, sampled[c], cs.n_past, {seq_ids[c]}, true);
+        }
+        if (batch.n_tokens == 0) {
+            break;
+        }
+
+        const int ret = rn_decode(rn_ctx, batch);
+        if (ret == 1) {
+            // No free KV cells for this step: the choices share n_ctx, so end them all here.
+            for (int c = 0; c < n_choices; c++) {
+                if (active[c]) {
+                    finish_truncated(c);
+                }
+            }
+            break;
+        }
+        if (ret != 0) {
+            llama_memory_seq_rm(mem, 0, state.n_past, -1);
+            result.success = false;
+            result.error_msg = "Failed to decode generated token";
+            result.error_type = RN_ERROR_INFERENCE;
+            return false;
+        }
+        state.n_decode_passes++;
+
+        // Same order as the single-sequence loop: decode → n_past++ → accept → process.
+        for (int c = 0; c < n_choices; c++) {
+            if (!active[c]) {
+                continue;
+            }
+            completion_state& cs = *choices[c];
+            const llama_token tok = sampled[c];
+            const std::string_view piece = rn_ctx->pieces.piece(tok);
+            cs.generated_text += piece;
+            cs.generated_tokens.push_back(tok);
+            cs.n_decoded++;
+            cs.n_remaining--;
+            cs.n_past++;
+            if (c == 0 && track_kv) {
+                rn_ctx->kv_tokens.push_back(tok);
+            }
+            common_sampler_accept(cs.sampler.get(), tok, true);
+            if (!process_generated_token(cs, tok, piece, options, c == 0 ? callback : nullptr)) {
+                active[c] = false;
+                n_active--;
+            }
+        }
+    }
+
+    result.choices.reserve(n_choices);
+    for (completion_state* cs : choices) {
+        utf8_trim_incomplete(cs->generated_text);
+        CompletionChoice choice;
+        choice.content            = cs->generated_text;
+        choice.tokens             = cs->generated_tokens;
+        choice.n_predicted_tokens = cs->n_decoded;
+        choice.stopped_by_length  = cs->stopped_by_limit;
+        choice.stopped_by_time    = cs->stopped_by_time;
+        result.choices.push_back(std::move(choice));
+    }
+    for (completion_state& fork : forks) {
+        release_sampler(rn_ctx, fork);
+    }
+    state.has_next_token = false;
+    return true;
+}
+
+// Beam search (beam_width > 1). Keeps the beam_width continuations with the highest
+// cumulative log-probability, each on its own KV sequence, and extends all of them in
+// one batched decode per step. A beam whose parent spawned several survivors is forked
+// with llama_memory_seq_cp into the sequence of a beam that died. A beam ends at EOG, a
+// stop string or the length limit; the search ends once beam_width beams have ended,
+// and the one with the best per-token log-probability wins. Deterministic: the sampler
+// chain (temperature, penalties, grammar) is not applied. The winning text is delivered
+// as one chunk at the end, and seq 0 is trimmed back to the prompt.
+static bool generate_beams(
+    rn_llama_context* rn_ctx,
+    const CompletionOptions& options,
+    completion_state& state,
+    CompletionResult& result) {
+
+    struct beam {
+        llama_seq_id             seq = 0;
+        std::vector<llama_token> tokens;
+        std::string              text;
+        double                   score = 0.0; // cumulative log-probability
+        rn_stop_matcher          stops;
+        bool                     by_length = false;
+        bool                     by_time   = false;
+    };
+    struct candidate {
+        size_t      parent;
+        llama_token token;
+        double      score;
+    };
+
+    const int width = std::min(std::clamp(options.beam_width, 1, RN_MAX_BEAMS),
+                               static_cast<int>(rn_ctx->params.n_batch));
+    llama_memory_t mem = llama_get_memory(rn_ctx->ctx);
+    const llama_vocab* vocab = rn_ctx->vocab;
+    const int n_vocab  = llama_vocab_n_tokens(vocab);
+    const int n_prompt = state.n_past;
+    const int n_max    = state.n_predict >= 0 ? state.n_predict : state.n_ctx;
+
+    borrowed_seqs pool(rn_ctx);
+    if (!pool.acquire(width - 1)) {
+        result.success = false;
+        result.error_msg = "beam_width = " + std::to_string(width) + " needs " +
+            std::to_string(width - 1) + " free KV sequences; raise n_seq_max in initLlama";
+        result.error_type = RN_ERROR_INVALID_PARAM;
+        return false;
+    }
+    std::vector<llama_seq_id> free_seqs = pool.ids;
+
+    std::vector<beam> live(1);
+    live[0].stops = state.stop_matcher;
+    std::vector<int> rows = {-1}; // logits row of each live beam; -1 = prompt logits
+    std::vector<beam> ended;
+    llama_batch& batch = rn_ctx->ingest_batch;
+    std::vector<std::pair<float, llama_token>> top;
+    top.reserve(width + 1);
+
+    while (!live.empty() && static_cast<int>(ended.size()) < width) {
+        if (deadline_passed(state)) {
+            // Out of time: the live beams compete as they are.
+            for (beam& b : live) {
+                b.by_time = true;
+                ended.push_back(std::move(b));
+            }
+            live.clear();
+            break;
+        }
+        {
+            int requested = rn_ctx->requested_n_threads.exchange(-1, std::memory_order_acq_rel);
+            if (requested > 0) {
+                llama_set_n_threads(rn_ctx->ctx, requested, requested);
+            }
+        }
+
+        // 1. The width most likely next tokens of every live beam, scored by
+        //    log-softmax. That is enough: no beam can keep more than width children.
+        std::vector<candidate> cands;
+        cands.reserve(live.size() * width);
+        for (size_t b = 0; b < live.size(); b++) {
+            const double log_z = log_softmax_top_k(
+                llama_get_logits_ith(rn_ctx->ctx, rows[b]), n_vocab, width, top);
+            for (const auto& [logit, tok] : top) {
+                cands.push_back({b, tok, live[b].score + (logit - log_z)});
+            }
+        }
+        std::sort(cands.begin(), cands.end(),
+                  [](const candidate& a, const candidate& b) { return a.score > b.score; });
+
+        // 2. Best candidates first: ended ones leave the beam, the first width others
+        //    continue.
+        std::vector<beam>   next;
+        std::vector<size_t> next_parent;
+        for (const candidate& c : cands) {
+            if (static_cast<int>(next.size()) == width) {
+                break;
+            }
+            const beam& parent = live[c.parent];
+            beam nb;
+            nb.tokens = parent.tokens;
+            nb.text   = parent.text;
+            nb.stops  = parent.stops;
+            nb.score  = c.score;
+            if (llama_vocab_is_eog(vocab, c.token)) {
+                ended.push_back(std::move(nb));
+                continue;
+            }
+            const std::string_view piece = rn_ctx->pieces.piece(c.token);
+            nb.tokens.push_back(c.token);
+            nb.text += piece;
+            int word = -1;
+            const size_t stop_pos = nb.stops.feed(piece, parent.text.size(), word);
+            if (stop_pos != std::string::npos) {
+                nb.text.erase(stop_pos);
+                ended.push_back(std::move(nb));
+                continue;
+            }
+            if (static_cast<int>(nb.tokens.size()) >= n_max ||
+                n_prompt + static_cast<int>(nb.tokens.size()) + 1 >= state.n_ctx) {
+                nb.by_length = true;
+                ended.push_back(std::move(nb));
+                continue;
+            }
+            next.push_back(std::move(nb));
+            next_parent.push_back(c.parent);
+        }
+        if (next.empty()) {
+            live.clear();
+            break;
+        }
+
+        // 3. Sequences: the first child of a parent continues in place, later children
+        //    fork the parent into sequences freed by parents that left no children.
+        std::vector<bool> parent_taken(live.size(), false);
+        std::vector<size_t> forks;
+        for (size_t i = 0; i < next.size(); i++) {
+            if (!parent_taken[next_parent[i]]) {
+                parent_taken[next_parent[i]] = true;
+                next[i].seq = live[next_parent[i]].seq;
+            } else {
+                forks.push_back(i);
+            }
+        }
+        for (size_t p = 0; p < live.size(); p++) {
+            if (!parent_taken[p]) {
+                free_seqs.push_back(live[p].seq);
+            }
+        }
+        for (size_t i : forks) {
+            const llama_seq_id dest = free_seqs.back();
+            free_seqs.pop_back();
+            llama_memory_seq_rm(mem, dest, -1, -1);
+            llama_memory_seq_cp(mem, live[next_parent[i]].seq, dest, -1, -1);
+            next[i].seq = dest;
+        }
+
+        // 4. One decode extends every beam by its new token.
+        common_batch_clear(batch);
+        rows.assign(next.size(), 0);
+        for (size_t i = 0; i < next.size(); i++) {
+            rows[i] = batch.n_tokens;
+            common_batch_add(batch, next[i].tokens.back(),
+                             n_prompt + static_cast<int>(next[i].tokens.size()) - 1,
+                             {next[i].seq}, true);
+        }
+        const int ret = rn_decode(rn_ctx, batch);
+        if (ret == 1) {
+            // No free KV cells: the beams share n_ctx, so end them all here.
+            for (beam& b : next) {
+                b.by_length = true;
+                ended.push_back(std::move(b));
+            }
+            live.clear();
+            break;
+        }
+        if (ret != 0) {
+            llama_memory_seq_rm(mem, 0, n_prompt, -1);
+            result.success = false;
+            result.error_msg = "Failed to decode beam search step";
+            result.error_type = RN_ERROR_INFERENCE;
+            return false;
+        }
+        state.n_decode_passes++;
+        state.n_decoded++; // steps so far; past the first, max_time_ms is the deadline
+        live = std::move(next);
+    }
+    if (ended.empty()) {
+        ended = std::move(live);
+    }
+
+    // Rank by per-token log-probability so shorter beams don't win merely by having
+    // fewer terms in their sum.
+    auto norm_score = [](const beam& b) {
+        return b.score / std::max<size_t>(1, b.tokens.size());
+    };
+    for (beam& b : ended) {
+        utf8_trim_incomplete(b.text);
+    }
+    std::stable_sort(ended.begin(), ended.end(),
+                     [&](const beam& a, const beam& b) { return norm_score(a) > norm_score(b); });
+
+    const beam& best = ended.front();
+    state.generated_text   = best.text;
+    state.generated_tokens = best.tokens;
+    state.n_decoded        = static_cast<int>(best.tokens.size());
+    state.stopped_by_limit = best.by_length;
+    state.stopped_by_time  = best.by_time;
+    state.truncated        = best.by_length;
+    state.has_next_token   = false;
+
+    // n > 1 with beams: the n best beams are the choices.
+    if (options.n_choices > 1) {
+        const size_t n = std::min(ended.size(), static_cast<size_t>(options.n_choices));
+        for (size_t i = 0; i < n; i++) {
+            CompletionChoice choice;
+            choice.content            = ended[i].text;
+            choice.tokens             = ended[i].tokens;
+            choice.n_predicted_tokens = static_cast<int>(ended[i].tokens.size());
+            choice.stopped_by_length  = ended[i].by_length;
+            choice.stopped_by_time    = ended[i].by_time;
+            result.choices.push_back(std::move(choice));
+        }
+    }
+
+    // Seq 0 may hold any beam by now; keep only the prompt (kv_tokens still mirrors it).
+    // If the next prompt continues with the winning text it is simply re-encoded.
+    if (!llama_memory_seq_rm(mem, 0, n_prompt, -1)) {
+        rn_clear_sequence(rn_ctx, 0);
+    }
+    return true;
 }
 
 CompletionResult run_completion(
@@ -148,86 +1443,17 @@ CompletionResult run_completion(
     try {
         // Initialize state with context values
         state.rn_ctx = rn_ctx;
-
-        const auto& params = rn_ctx->params;
+        set_deadlines(state, options);
 
         // Reset per-request performance counters so timings reflect this request only,
         // not cumulative totals across all prior requests on this context.
         // Mirrors server-context.cpp slot reset behavior.
         llama_perf_context_reset(rn_ctx->ctx);
 
-        // Create a copy of sampling parameters and apply per-request overrides.
-        // All mutations happen on this LOCAL copy — rn_ctx_->params.sampling is never touched.
-        common_params_sampling sampling_params = params.sampling;
-
-        // Apply per-request sampling overrides from CompletionOptions.
-        // Only override when the caller explicitly set a value (not NaN / -1 sentinel).
-        // When not set, the model's initLlama defaults (params.sampling) are preserved —
-        // this respects per-model tuning and GGUF-embedded sampling metadata.
-        auto applyF = [](float& dst, float src) { if (!std::isnan(src)) dst = src; };
-        auto applyFI = [](int32_t& dst, float src) { if (!std::isnan(src)) dst = static_cast<int32_t>(src); };
-        applyF(sampling_params.temp,            options.temperature);
-        applyF(sampling_params.top_p,           options.top_p);
-        applyFI(sampling_params.top_k,          options.top_k);
-        applyF(sampling_params.min_p,           options.min_p);
-        applyF(sampling_params.penalty_present, options.presence_penalty);
-        applyF(sampling_params.penalty_repeat,  options.repeat_penalty);
-        applyF(sampling_params.penalty_freq,    options.frequency_penalty);
-        if (options.repeat_last_n >= 0) {
-            sampling_params.penalty_last_n = options.repeat_last_n;
-        } else if (sampling_params.penalty_last_n == 64) {
-            // Neither the caller nor the GGUF set a repeat-penalty window.
-            // 64 (llama.cpp hardcoded default) is smaller than a typical paragraph (~80-200 tokens),
-            // so paragraph-level repetition passes through the penalty window undetected.
-            // Bump to 256 — covers ~2 average paragraphs with no user intent to override.
-            sampling_params.penalty_last_n = 256;
-        }
-        // Map JS sentinel -1 ("use default/random") to the model's configured seed.
-        // Only override if the caller supplied an explicit non-negative seed.
-        if (options.seed >= 0) {
-            sampling_params.seed = static_cast<uint32_t>(options.seed);
-        }
-
-        // Merge preserved token IDs from the chat template autoparser into sampling params.
-        // These are special single-token strings (e.g. "<think>", "<|eot_id|>") that the
-        // tokenizer must not split — required for lazy grammar triggers to work correctly.
-        for (auto tok : options.preserved_tokens) {
-            sampling_params.preserved_tokens.insert(tok);
-        }
-
-        if (!options.grammar.empty()) {
-            sampling_params.grammar = common_grammar(COMMON_GRAMMAR_TYPE_USER, options.grammar);
-            // Force grammar_lazy to false whenever tools are present to ensure strict JSON format enforcement
-            if (!options.tools.empty()) {
-                sampling_params.grammar_lazy = false;
-            } else {
-                sampling_params.grammar_lazy = options.grammar_lazy;
-            }
-            // Pass grammar_triggers if any were provided by chat_params and passed via options
-            if (!options.grammar_triggers.empty()) {
-                sampling_params.grammar_triggers = options.grammar_triggers;
-            }
-        }
-
-        // Wire reasoning budget into sampling params.
-        // The start/end tags come from chat_params.thinking_start/end_tag (set by run_chat_completion).
-        // Mirrors server-common.cpp oaicompat_chat_params_parse() reasoning budget block.
-        if (!options.reasoning_budget_start_tag.empty() && !options.reasoning_budget_end_tag.empty()) {
-            sampling_params.reasoning_budget_tokens  = options.reasoning_budget_tokens;
-            sampling_params.reasoning_budget_start   = common_tokenize(rn_ctx->vocab, options.reasoning_budget_start_tag, false, true);
-            sampling_params.reasoning_budget_end     = common_tokenize(rn_ctx->vocab, options.reasoning_budget_end_tag,   false, true);
-            if (!options.reasoning_budget_message.empty()) {
-                sampling_params.reasoning_budget_forced = common_tokenize(rn_ctx->vocab,
-                    options.reasoning_budget_message + options.reasoning_budget_end_tag, false, true);
-                sampling_params.reasoning_budget_message = options.reasoning_budget_message;
-            } else {
-                sampling_params.reasoning_budget_forced = sampling_params.reasoning_budget_end;
-            }
-        }
+        const common_params_sampling sampling_params = build_sampling_params(rn_ctx, options);
 
-        // Initialize the sampler with the updated sampling parameters
-        state.sampler.reset(common_sampler_init(rn_ctx->model, sampling_params));
-        if (!state.sampler) {
+        // Take a sampler for these parameters (reused from an earlier request if possible)
+        if (!acquire_sampler(rn_ctx, state, sampling_params, options)) {
             result.success = false;
             result.error_msg = "Failed to initialize sampler";
             result.error_type = RN_ERROR_INFERENCE;
@@ -236,19 +1462,19 @@ CompletionResult run_completion(
 
         // Stop words
         state.antiprompt = options.stop;
+        state.stop_matcher.build(state.antiprompt);
+
+        // Mirrors seq 0 for prefix reuse on the next request; not maintained on the
+        // multimodal path (media positions have no token ids — kv_tokens stays empty).
+        std::vector<llama_token>& kv_tokens = rn_ctx->kv_tokens;
+        const bool track_kv = options.mtmd_encoded_n_past < 0;
 
         if (options.mtmd_encoded_n_past >= 0) {
             // Multimodal fast path: images + text were already encoded by run_chat_completion
             // via mtmd_helper_eval_chunks. Logits are ready; skip tokenize and KV encode.
             state.n_past      = options.mtmd_encoded_n_past;
             state.n_ctx       = llama_n_ctx(rn_ctx->ctx);
-            if (options.n_predict >= 0) {
-                state.n_predict = options.n_predict;
-            } else if (params.n_predict >= 0) {
-                state.n_predict = params.n_predict;
-            } else {
-                state.n_predict = -1; // unlimited — EOS or stop string terminates
-            }
+            state.n_predict   = resolve_n_predict(rn_ctx, options);
             state.n_remaining = state.n_predict;
             result.n_prompt_tokens = 0;
         } else {
@@ -268,144 +1494,138 @@ CompletionResult run_completion(
             return result;
         }
 
-        // KV cache: run_chat_completion already evicted stale entries and passes the
-        // trusted common prefix length via kv_hint_pos. We just apply it here.
-        // Direct callers (no kv_hint_pos) always start from position 0 with a full clear.
+        // KV cache prefix reuse. run_chat_completion may pass a trusted common prefix
+        // length via kv_hint_pos (message-ID match, stale entries already evicted).
+        // Otherwise the prompt is diffed against kv_tokens — the exact tokens in seq 0 —
+        // and only the tail after the longest common prefix is evicted.
+        // At least one prompt token is always re-encoded so the first sample has logits.
+        const size_t n_reuse_max = state.prompt_tokens.size() - 1;
         if (options.kv_hint_pos >= 0) {
-            size_t kv_common_len = static_cast<size_t>(options.kv_hint_pos);
-            // Safety: need at least 1 new token to encode for valid logits.
-            // Clamp to size-1 rather than resetting to 0 — if the hint equals the full
-            // prompt length (all tokens already cached), we still need to encode the last
-            // token to produce logits for the first generated token.
-            if (kv_common_len >= state.prompt_tokens.size()) {
-                kv_common_len = state.prompt_tokens.size() - 1;
-            }
-            state.n_past = static_cast<int>(kv_common_len);
-        } else {
-            llama_memory_clear(llama_get_memory(rn_ctx->ctx), true);
-            state.n_past = 0;
-        }
-
-        // Configure state
-        state.n_ctx = llama_n_ctx(rn_ctx->ctx);
-        if (options.n_predict >= 0) {
-            state.n_predict = options.n_predict;
-        } else if (params.n_predict >= 0) {
-            state.n_predict = params.n_predict;
-        } else {
-            state.n_predict = -1; // unlimited — EOS or stop string terminates
-        }
-        state.n_remaining = state.n_predict;
-
-        // Guard: prompt must fit in the context window, otherwise llama_decode will ggml_abort.
-        if (static_cast<int>(state.prompt_tokens.size()) >= state.n_ctx) {
-            result.success = false;
-            result.error_msg = "Prompt too long: " + std::to_string(state.prompt_tokens.size())
-                + " tokens exceeds context size " + std::to_string(state.n_ctx);
-            result.error_type = RN_ERROR_INVALID_PARAM;
-            return result;
-        }
-
-        // Encode prompt tokens into the KV cache using the cooperative ingestion loop.
-        // chunk_size (distinct from n_batch) is the decode granularity; after each chunk
-        // we yield to let the OS/UI thread run, preventing display fence timeouts (Android)
-        // and UI starvation (CPU-only devices).
-        const int ingest_chunk = std::clamp(rn_ctx->params.chunk_size, 8, 512);
-
-        if (state.n_past > 0) {
-            // Prefix reuse: only encode prompt_tokens[n_past:] at positions [n_past, n_past+1, ...]
-            const int n_new = static_cast<int>(state.prompt_tokens.size()) - state.n_past;
-            if (n_new > 0) {
-                llama_batch& ingest_batch = rn_ctx->ingest_batch;
-                for (int i = 0; i < n_new; ) {
-                    if (rn_ctx->abort_generation.load(std::memory_order_relaxed)) {
-                        result.success = false;
-                        result.error_msg = "Generation aborted";
-                        result.error_type = RN_ERROR_INFERENCE;
-                        return result;
-                    }
-                    common_batch_clear(ingest_batch);
-                    int chunk = std::min(ingest_chunk, n_new - i);
-                    bool last_chunk = (i + chunk >= n_new);
-                    for (int j = 0; j < chunk; j++) {
-                        common_batch_add(ingest_batch,
-                            state.prompt_tokens[state.n_past + i + j],
-                            state.n_past + i + j,
-                            {0},
-                            last_chunk && (j == chunk - 1));
-                    }
-                    auto t0 = std::chrono::steady_clock::now();
-                    if (llama_decode(rn_ctx->ctx, ingest_batch) != 0) {
-                        result.success = false;
-                        result.error_msg = "Failed to process prompt";
-                        result.error_type = RN_ERROR_INFERENCE;
-                        return result;
-                    }
-                    const auto chunk_elapsed = std::chrono::steady_clock::now() - t0;
-                    if (rn_ctx->params.is_cpu_only) {
-                        std::this_thread::sleep_for(std::chrono::milliseconds(2));
-                    } else {
-                        int chunk_gap_ms = std::max(0, rn_ctx->params.prompt_chunk_gap_ms);
-                        if (state.prompt_tokens.size() > 2048) {
-                            chunk_gap_ms += static_cast<int>(state.prompt_tokens.size() / 2048);
-                        }
-                        const auto min_chunk_gap = std::chrono::milliseconds(chunk_gap_ms);
-                        if (chunk_elapsed < min_chunk_gap) {
-                            std::this_thread::sleep_for(min_chunk_gap - chunk_elapsed);
-                        }
-                    }
-                    i += chunk;
-                }
-                state.n_past = static_cast<int>(state.prompt_tokens.size());
-            }
-        } else {
-            // Standard path: encode all tokens from position 0.
-            const int n_total = static_cast<int>(state.prompt_tokens.size());
-            llama_batch& ingest_batch = rn_ctx->ingest_batch;
-            for (int i = 0; i < n_total; ) {
-                if (rn_ctx->abort_generation.load(std::memory_order_relaxed)) {
-                    result.success = false;
-                    result.error_msg = "Generation aborted";
-                    result.error_type = RN_ERROR_INFERENCE;
-                    return result;
-                }
-                common_batch_clear(ingest_batch);
-                int chunk = std::min(ingest_chunk, n_total - i);
-                bool last_chunk = (i + chunk >= n_total);
-                for (int j = 0; j < chunk; j++) {
-                    common_batch_add(ingest_batch, state.prompt_tokens[i + j], i + j,
-                                     {0}, last_chunk && (j == chunk - 1));
-                }
-                auto t0 = std::chrono::steady_clock::now();
-                if (llama_decode(rn_ctx->ctx, ingest_batch) != 0) {
-                    result.success = false;
-                    result.error_msg = "Failed to process prompt";
-                    result.error_type = RN_ERROR_INFERENCE;
-                    return result;
-                }
-                const auto chunk_elapsed = std::chrono::steady_clock::now() - t0;
-                if (rn_ctx->params.is_cpu_only) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
-                } else {
-                    int chunk_gap_ms = std::max(0, rn_ctx->params.prompt_chunk_gap_ms);
-                    if (state.prompt_tokens.size() > 2048) {
-                        chunk_gap_ms += static_cast<int>(state.prompt_tokens.size() / 2048);
-                    }
-                    const auto min_chunk_gap = std::chrono::milliseconds(chunk_gap_ms);
-                    if (chunk_elapsed < min_chunk_gap) {
-                        std::this_thread::sleep_for(min_chunk_gap - chunk_elapsed);
-                    }
+            size_t kv_common_len = std::min(static_cast<size_t>(options.kv_hint_pos), n_reuse_max);
+            // The boundaries behind the hint come from renders of the conversation; after a
+            // message-evicting context shift the re-rendered window may tokenize slightly
+            // differently, so never trust more than seq 0 verifiably shares.
+            if (!kv_tokens.empty()) {
+                kv_common_len = std::min(kv_common_len, common_lcp(kv_tokens, state.prompt_tokens));
+            }
+            if (kv_common_len < static_cast<size_t>(options.kv_hint_pos) &&
+                !llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, static_cast<llama_pos>(kv_common_len), -1)) {
+                rn_clear_sequence(rn_ctx, 0);
+                kv_common_len = 0;
+            }
+            // Seq 0 now holds exactly this prefix.
+            kv_tokens.assign(state.prompt_tokens.begin(), state.prompt_tokens.begin() + kv_common_len);
+            rn_ctx->kv_shared_len = std::min(rn_ctx->kv_shared_len, kv_common_len);
+            state.n_past = static_cast<int>(kv_common_len);
+        } else {
+            size_t n_common = options.reset_kv_cache
+                ? 0
+                : std::min(common_lcp(kv_tokens, state.prompt_tokens), n_reuse_max);
+            // Prefix cache: snapshot seq 0 before its tail is evicted, then restore the
+            // cached sequence sharing the longest prefix with this prompt, if any is longer.
+            if (rn_ctx->prefix_cache && !options.reset_kv_cache) {
+                if (n_common < kv_tokens.size()) {
+                    rn_ctx->prefix_cache->store(rn_ctx->ctx, kv_tokens);
                 }
-                i += chunk;
+                n_common = rn_ctx->prefix_cache->restore(rn_ctx, state.prompt_tokens, n_common);
+            }
+            // Shared prefix: take over the system prompt / tools KV when it is longer.
+            if (!options.reset_kv_cache) {
+                n_common = rn_shared_prefix_attach(rn_ctx, options.prompt_id, state.prompt_tokens, n_common, 0);
+            }
+            if (n_common > 0 &&
+                !llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, static_cast<llama_pos>(n_common), -1)) {
+                // Partial removal is unsupported (recurrent state) — start over.
+                n_common = 0;
+            }
+            if (n_common == 0) {
+                rn_clear_sequence(rn_ctx, 0);
+            }
+            kv_tokens.resize(n_common);
+            rn_ctx->kv_shared_len = std::min(rn_ctx->kv_shared_len, n_common);
+            state.n_past = static_cast<int>(n_common);
+        }
+
+        // Configure state
+        state.n_ctx       = llama_n_ctx(rn_ctx->ctx);
+        state.n_predict   = resolve_n_predict(rn_ctx, options);
+        state.n_remaining = state.n_predict;
+
+        // Guard: prompt must fit in the context window, otherwise llama_decode will ggml_abort.
+        if (static_cast<int>(state.prompt_tokens.size()) >= state.n_ctx) {
+            result.success = false;
+            result.error_msg = "Prompt too long: " + std::to_string(state.prompt_tokens.size())
+                + " tokens exceeds context size " + std::to_string(state.n_ctx);
+            result.error_type = RN_ERROR_INVALID_PARAM;
+            return result;
+        }
+
+        // Encode prompt_tokens[n_past:] at positions [n_past, ...] in governed chunks:
+        // each llama_decode is sized to stay near ingest_budget_ms, then we yield to let
+        // the OS/UI thread run, preventing display fence timeouts (Android) and UI
+        // starvation (CPU-only devices). kv_tokens grows per chunk so an abort mid-prompt
+        // still leaves a reusable prefix. With a first-token deadline the yields are
+        // dropped once the remaining prompt would not otherwise make it; a missed deadline
+        // ends the request here with the ingested prefix kept. Chunk boundaries are also
+        // where a higher-priority request on the inference gate may preempt this one.
+        const int n_total = static_cast<int>(state.prompt_tokens.size());
+        llama_batch& ingest_batch = rn_ctx->ingest_batch;
+        ingest_governor governor(rn_ctx->params);
+        int i = state.n_past;
+        while (i < n_total) {
+            if (rn_ctx->abort_generation.load(std::memory_order_relaxed) ||
+                (rn_ctx->gate && rn_ctx->gate->holder_cancelled())) {
+                result.success = false;
+                result.error_msg = "Generation aborted";
+                result.error_type = RN_ERROR_INFERENCE;
+                return result;
+            }
+            if (deadline_passed(state)) {
+                break;
+            }
+            state.n_past = i;
+            if (!preempt_point(rn_ctx, state, LLAMA_TOKEN_NULL)) {
+                result.success = false;
+                result.error_msg = "Request cancelled while preempted";
+                result.error_type = RN_ERROR_INFERENCE;
+                return result;
+            }
+            const bool full_speed = rn_ctx->ingest_full_speed.load(std::memory_order_relaxed) ||
+                                    governor.behind(n_total - i, state.t_first_token);
+            common_batch_clear(ingest_batch);
+            int chunk = std::min(governor.next_chunk(full_speed), n_total - i);
+            bool last_chunk = (i + chunk >= n_total);
+            for (int j = 0; j < chunk; j++) {
+                common_batch_add(ingest_batch, state.prompt_tokens[i + j], i + j,
+                                 {0}, last_chunk && (j == chunk - 1));
             }
-            state.n_past = n_total;
+            auto t0 = std::chrono::steady_clock::now();
+            if (rn_decode(rn_ctx, ingest_batch) != 0) {
+                llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, i, -1);
+                result.success = false;
+                result.error_msg = "Failed to process prompt";
+                result.error_type = RN_ERROR_INFERENCE;
+                return result;
+            }
+            kv_tokens.insert(kv_tokens.end(),
+                             state.prompt_tokens.begin() + i, state.prompt_tokens.begin() + i + chunk);
+            governor.record(chunk, std::chrono::steady_clock::now() - t0);
+            i += chunk;
+            if (i < n_total && !full_speed) {
+                governor.yield();
+            }
+        }
+        state.n_past = i;
+        if (i == n_total && !options.shared_prefix_tokens.empty()) {
+            rn_shared_prefix_store(rn_ctx, options.prompt_id, options.shared_prefix_tokens,
+                                   state.prompt_tokens, 0);
         }
 
         // Seed the sampler with prompt tokens — matches the server's init_sampler() pattern exactly.
         //
         // CORRECT ORDER (server-context.cpp init_sampler):
         //   1. Reset FIRST  → clears prev ring buffer + grammar state to a known-clean baseline
-        //   2. Accept ALL prompt tokens with accept_grammar=false
+        //   2. Accept the prompt tokens with accept_grammar=false
         //      → rebuilds the repetition-penalty window (prev ring buffer)
         //      → does NOT advance grammar state (grammar only tracks generated tokens)
         //
@@ -420,11 +1640,10 @@ CompletionResult run_completion(
         //   Grammar state should only track generated tokens, not prompt tokens.
         //   Using true here would advance the grammar FSM through the prompt, which is wrong
         //   for tool-call grammars that expect to start fresh at generation time.
-        common_sampler_reset(state.sampler.get());
-
-        for (auto tok : state.prompt_tokens) {
-            common_sampler_accept(state.sampler.get(), tok, false);
-        }
+        //
+        // acquire_sampler already returned a fresh or reset sampler (step 1); prime_sampler
+        // replays only the prompt tail the history windows can see.
+        prime_sampler(state.sampler.get(), sampling_params, state.prompt_tokens);
 
         result.n_prompt_tokens = state.prompt_tokens.size();
 
@@ -438,8 +1657,11 @@ CompletionResult run_completion(
         // KV entries; the model then loops on content still visible near the beginning —
         // the primary mechanical cause of paragraph-level repetition in long generation.
         // Unlimited generation (n_predict < 0) is never capped; EOS or stop strings end it.
+        // With n > 1 or beam search the sequences share the remaining cells.
         if (state.n_predict > 0) {
-            const int available = state.n_ctx - state.n_past - 4;
+            const int n_streams = std::max(std::clamp(options.n_choices, 1, RN_MAX_CHOICES),
+                                           std::clamp(options.beam_width, 1, RN_MAX_BEAMS));
+            const int available = (state.n_ctx - state.n_past - 4) / n_streams;
             if (available > 0 && state.n_predict > available) {
                 state.n_predict   = available;
                 state.n_remaining = available;
@@ -453,23 +1675,81 @@ CompletionResult run_completion(
             options.mtmd_encoded_n_past < 0 &&
             llama_memory_can_shift(llama_get_memory(rn_ctx->ctx));
 
-        // MP-P2 FIX: pre-reserve generated_text and generated_tokens to avoid
-        // repeated heap reallocations inside the token generation loop.
-        // Average token is ~4 bytes (mixed ASCII/UTF-8); reserve 4× n_predict chars.
-        // For unlimited generation (n_predict < 0), reserve 512 tokens as a reasonable default.
-        if (state.n_predict > 0) {
-            state.generated_text.reserve(static_cast<size_t>(state.n_predict) * 4);
-            state.generated_tokens.reserve(static_cast<size_t>(state.n_predict));
-        } else {
-            // Thinking models (reasoning_budget != 0) generate 2000-5000 token reasoning
-            // blocks with n_predict = -1. Reserve enough upfront to avoid reallocations.
-            const bool has_thinking = (rn_ctx->params.reasoning_budget != 0);
-            const size_t initial_reserve = has_thinking ? 6144 : 512;
-            state.generated_text.reserve(initial_reserve * 4);
-            state.generated_tokens.reserve(initial_reserve);
+        reserve_generation_buffers(state);
+
+        // Per-token logprobs are recorded by the single-sequence loop below only.
+        if (options.n_logprobs > 0 && options.n_choices <= 1 && options.beam_width <= 1) {
+            state.n_logprobs = std::min(options.n_logprobs, RN_MAX_LOGPROBS);
+            const size_t n_expected = state.generated_tokens.capacity();
+            state.token_logprobs.reserve(n_expected);
+            state.top_tokens.reserve(n_expected * state.n_logprobs);
+            state.top_logprobs.reserve(n_expected * state.n_logprobs);
+        }
+
+        // Beam search / n > 1: generate in batched steps over several sequences; this
+        // leaves `state` finished so the loop below does not run.
+        if (state.stopped_by_time) {
+            // The prompt did not finish before the deadline; nothing to generate.
+        } else if (options.beam_width > 1) {
+            if (!options.grammar.empty()) {
+                result.success = false;
+                result.error_msg = "beam_width cannot be combined with a grammar or tool calling";
+                result.error_type = RN_ERROR_INVALID_PARAM;
+                return result;
+            }
+            if (!generate_beams(rn_ctx, options, state, result)) {
+                return result;
+            }
+        } else if (options.n_choices > 1 &&
+                   !generate_choices(rn_ctx, options, sampling_params, state, track_kv, callback, result)) {
+            return result;
         }
 
+        // Speculative decoding with a draft model and/or prompt lookup. kv_tokens
+        // mirrors target seq 0 (one token per KV position) so the draft context can be
+        // resynced by common prefix and n-grams can be matched against prompt + output;
+        // spec_pending is a token the target already sampled and accepted while
+        // verifying drafts, decoded at the start of the next iteration.
+        // Rejected drafts are trimmed with seq_rm, which recurrent state cannot do.
+        const bool use_lookup =
+            options.prompt_lookup &&
+            !llama_model_is_recurrent(rn_ctx->model) &&
+            !llama_model_is_hybrid(rn_ctx->model);
+        // Drafted tokens are sampled from verify-batch rows, so logprobs (which read the
+        // last row) turn speculation off.
+        const bool use_draft =
+            (rn_ctx->draft_loaded || use_lookup) &&
+            options.mtmd_encoded_n_past < 0 &&
+            state.n_logprobs == 0;
+        const int lookup_ngram = std::max(1, options.prompt_lookup_ngram);
+        const int lookup_n_max = std::clamp(options.prompt_lookup_n_max, 1, RN_MAX_DRAFT_TOKENS);
+        rn_prompt_lookup lookup(std::clamp(options.prompt_lookup_ngram_min, 1, lookup_ngram), lookup_ngram);
+        llama_token spec_pending = LLAMA_TOKEN_NULL;
+
+        // Message-aware context shift: options.shift_spans are whole prompt messages in
+        // eviction order. shift_span_next is the first not yet evicted and
+        // shift_span_offset how far earlier shifts moved the remaining ones.
+        size_t  shift_span_next   = 0;
+        int32_t shift_span_offset = 0;
+
         while (state.has_next_token && (state.n_predict < 0 || state.n_remaining > 0)) {
+            if (deadline_passed(state)) {
+                break;
+            }
+
+            // Preemption point. A pending draft token is decoded below anyway; otherwise
+            // the last decoded token is decoded again for fresh logits after resuming.
+            // Media prompts are not preempted: their KV positions need not match n_past.
+            if (track_kv && (spec_pending != LLAMA_TOKEN_NULL || !kv_tokens.empty())) {
+                const llama_token relogit = spec_pending != LLAMA_TOKEN_NULL ? LLAMA_TOKEN_NULL : kv_tokens.back();
+                if (!preempt_point(rn_ctx, state, relogit)) {
+                    result.success = false;
+                    result.error_msg = "Request cancelled while preempted";
+                    result.error_type = RN_ERROR_INFERENCE;
+                    return result;
+                }
+            }
+
             // Thermal management: apply any thread count change requested by the JS thread.
             // JS writes requested_n_threads with memory_order_release (non-blocking).
             // exchange(-1, acq_rel) clears the request; new count applies to next llama_decode.
@@ -514,9 +1794,46 @@ CompletionResult run_completion(
 
                 // Safety: leave at least 4 slots for generation
                 n_keep = std::min(n_keep, state.n_ctx - 4);
+                // Cells shared with other sequences cannot move; past n_ctx - 4 this leaves
+                // nothing to discard and generation stops as truncated.
+                n_keep = std::max(n_keep, static_cast<int>(rn_ctx->kv_shared_len));
 
                 const int n_left    = state.n_past - n_keep;
-                const int n_discard = n_left / 2;
+                int n_discard    = n_left / 2;
+                int n_discard_at = n_keep;
+
+                // Prefer evicting whole messages, oldest first, so the message boundaries
+                // tracked by run_chat_completion stay valid (shifted) and the next turn
+                // still reuses the cache. The same half-of-the-rest target applies, but
+                // measured from the first evictable message instead of n_keep; a run of
+                // messages reaching less than half of that target falls back to the
+                // positional shift below.
+                bool by_message = false;
+                if (shift_span_next < options.shift_spans.size()) {
+                    const int32_t span_start =
+                        options.shift_spans[shift_span_next].first - shift_span_offset;
+                    const int target = (state.n_past - span_start) / 2;
+                    int32_t span_end = span_start;
+                    size_t  k        = shift_span_next;
+                    while (k < options.shift_spans.size() && span_end - span_start < target) {
+                        span_end = options.shift_spans[k].second - shift_span_offset;
+                        k++;
+                    }
+                    const int n_span = span_end - span_start;
+                    if (span_start >= 1 && span_start >= options.n_keep &&
+                        span_start >= static_cast<int32_t>(rn_ctx->kv_shared_len) &&
+                        n_span > 0 && n_span >= target / 2) {
+                        n_discard          = n_span;
+                        n_discard_at       = span_start;
+                        shift_span_next    = k;
+                        shift_span_offset += n_span;
+                        by_message         = true;
+                    }
+                }
+                if (!by_message) {
+                    // Cutting mid-message invalidates every later span.
+                    shift_span_next = options.shift_spans.size();
+                }
 
                 if (n_discard <= 0) {
                     // n_keep is too large relative to n_ctx — can't shift
@@ -526,28 +1843,38 @@ CompletionResult run_completion(
                     break;
                 }
 
-                // Remove KV entries at positions [n_keep, n_keep + n_discard)
-                llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, n_keep, n_keep + n_discard);
-                // Shift remaining entries [n_keep + n_discard, n_past) backward by n_discard
-                llama_memory_seq_add(llama_get_memory(rn_ctx->ctx), 0, n_keep + n_discard, state.n_past, -n_discard);
+                // Remove KV entries at positions [n_discard_at, n_discard_at + n_discard)
+                llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, n_discard_at, n_discard_at + n_discard);
+                // Shift remaining entries [n_discard_at + n_discard, n_past) backward by n_discard
+                llama_memory_seq_add(llama_get_memory(rn_ctx->ctx), 0, n_discard_at + n_discard, state.n_past, -n_discard);
 
                 // Shift the prompt_tokens array to match
-                for (int i = n_keep + n_discard; i < (int)state.prompt_tokens.size(); i++) {
+                for (int i = n_discard_at + n_discard; i < (int)state.prompt_tokens.size(); i++) {
                     state.prompt_tokens[i - n_discard] = state.prompt_tokens[i];
                 }
                 state.prompt_tokens.resize(state.prompt_tokens.size() - n_discard);
+                kv_tokens.erase(kv_tokens.begin() + n_discard_at,
+                                kv_tokens.begin() + n_discard_at + n_discard);
 
                 state.n_past -= n_discard;
                 state.truncated = true;
                 state.context_shifted = true;
+                result.context_shifted = true;
+                result.n_shift_spans_evicted = static_cast<int>(by_message ? shift_span_next : 0);
+                result.shift_misaligned = result.shift_misaligned || !by_message;
             }
 
-            // Sample the next token
-            llama_token token_id = common_sampler_sample(state.sampler.get(), rn_ctx->ctx, -1);
+            // Sample the next token (or take the one left over from draft verification,
+            // which the sampler has already accepted)
+            const bool pending_accepted = (spec_pending != LLAMA_TOKEN_NULL);
+            llama_token token_id = pending_accepted
+                ? spec_pending
+                : common_sampler_sample(state.sampler.get(), rn_ctx->ctx, -1);
+            spec_pending = LLAMA_TOKEN_NULL;
 
             // Guard: sampler returns LLAMA_TOKEN_NULL (-1) when the grammar rejects all
             // candidates (e.g. malformed grammar or empty vocabulary after constraints).
-            // Passing -1 downstream to common_token_to_piece / llama_vocab_is_eog is UB.
+            // Passing -1 downstream to llama_vocab_is_eog is UB.
             if (token_id == LLAMA_TOKEN_NULL) {
                 result.success = false;
                 result.error_msg = "Sampler produced no valid token (grammar may be over-constrained)";
@@ -555,8 +1882,96 @@ CompletionResult run_completion(
                 return result;
             }
 
+            if (state.n_logprobs > 0) {
+                record_logprobs(rn_ctx, state, token_id);
+            }
+
+            // Draft continuation tokens and verify them together with token_id in one
+            // target pass. Capped so every committed token fits n_remaining and n_ctx.
+            // Prompt lookup is tried first (no model pass); the draft model covers the
+            // steps where the history has no matching n-gram, and, when loaded, the ones
+            // where lookup only matched fewer than prompt_lookup_ngram tokens.
+            if (use_draft && !llama_vocab_is_eog(rn_ctx->vocab, token_id)) {
+                int n_draft_max = state.n_ctx - state.n_past - 2;
+                if (state.n_predict >= 0) {
+                    n_draft_max = std::min(n_draft_max, state.n_remaining - 1);
+                }
+                std::vector<llama_token> drafts;
+                if (n_draft_max > 0) {
+                    kv_tokens.push_back(token_id);
+                    if (use_lookup) {
+                        int match_len = 0;
+                        drafts = lookup.draft(kv_tokens, std::min(lookup_n_max, n_draft_max), match_len);
+                        if (rn_ctx->draft_loaded && match_len < lookup_ngram) {
+                            drafts.clear();
+                        }
+                    }
+                    if (drafts.empty() && rn_ctx->draft_loaded) {
+                        drafts = draft_from_model(
+                            rn_ctx, kv_tokens, std::min(rn_ctx->params.draft_n_max, n_draft_max));
+                    }
+                    kv_tokens.pop_back();
+                }
+
+                if (!drafts.empty()) {
+                    llama_batch& spec_batch = rn_ctx->spec_batch;
+                    common_batch_clear(spec_batch);
+                    common_batch_add(spec_batch, token_id, state.n_past, {0}, true);
+                    for (size_t i = 0; i < drafts.size(); i++) {
+                        common_batch_add(spec_batch, drafts[i], state.n_past + 1 + (int)i, {0}, true);
+                    }
+                    if (rn_decode(rn_ctx, spec_batch) != 0) {
+                        llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, state.n_past, -1);
+                        if (rn_ctx->gate && rn_ctx->gate->holder_cancelled()) {
+                            // stopCompletion() aborted the decode: end like any other stop.
+                            state.has_next_token = false;
+                            break;
+                        }
+                        result.success = false;
+                        result.error_msg = "Failed to decode draft verification batch";
+                        result.error_type = RN_ERROR_INFERENCE;
+                        return result;
+                    }
+                    state.n_decode_passes++;
+                    if (!pending_accepted) {
+                        common_sampler_accept(state.sampler.get(), token_id, true);
+                    }
+
+                    // Samples at batch rows 0..n, accepting while the target agrees with the
+                    // draft. ids = accepted drafts + one token sampled from the target.
+                    const std::vector<llama_token> ids =
+                        common_sampler_sample_and_accept_n(state.sampler.get(), rn_ctx->ctx, drafts);
+                    const int n_accepted = static_cast<int>(ids.size()) - 1;
+                    state.n_drafted        += static_cast<int>(drafts.size());
+                    state.n_draft_accepted += n_accepted;
+
+                    // Rejected drafts were written to the KV cache by the verify pass.
+                    llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, state.n_past + 1 + n_accepted, -1);
+                    spec_pending = ids.back();
+
+                    // Commit token_id and the accepted drafts through the normal
+                    // EOG / stop / streaming path.
+                    bool keep_going = true;
+                    for (int i = 0; i <= n_accepted && keep_going; i++) {
+                        const llama_token tok = (i == 0) ? token_id : ids[i - 1];
+                        const std::string_view piece = rn_ctx->pieces.piece(tok);
+                        state.generated_text += piece;
+                        state.generated_tokens.push_back(tok);
+                        state.n_decoded++;
+                        state.n_remaining--;
+                        state.n_past++;
+                        kv_tokens.push_back(tok);
+                        keep_going = process_generated_token(state, tok, piece, options, callback);
+                    }
+                    if (!keep_going) {
+                        break;
+                    }
+                    continue;
+                }
+            }
+
             // Extract the token text
-            std::string token_text = common_token_to_piece(rn_ctx->vocab, token_id);
+            const std::string_view token_text = rn_ctx->pieces.piece(token_id);
 
             // Add to generated text
             state.generated_text += token_text;
@@ -574,106 +1989,83 @@ CompletionResult run_completion(
             // Correct order matches server-context.cpp and ai_chat.cpp: sample → decode → accept → n_past++
             common_batch_clear(gen_batch);
             common_batch_add(gen_batch, token_id, state.n_past, {0}, true);
-            if (llama_decode(rn_ctx->ctx, gen_batch) != 0) {
+            if (rn_decode(rn_ctx, gen_batch) != 0) {
+                llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, state.n_past, -1);
+                if (rn_ctx->gate && rn_ctx->gate->holder_cancelled()) {
+                    // stopCompletion() aborted the decode: end like any other stop.
+                    state.has_next_token = false;
+                    break;
+                }
                 result.success = false;
                 result.error_msg = "Failed to decode generated token";
                 result.error_type = RN_ERROR_INFERENCE;
                 return result;
             }
+            state.n_decode_passes++;
 
             state.n_past++;
+            if (track_kv) {
+                kv_tokens.push_back(token_id);
+            }
 
             // Accept the token into the sampler AFTER decode and n_past increment.
             // token_id is a plain int32 captured before llama_decode — safe to pass here.
-            common_sampler_accept(state.sampler.get(), token_id, true);
-
-            // Check EOS FIRST — before streaming — so the EOS token text is never sent to JS
-            // and all end-of-generation tokens are handled (not just the single llama_vocab_eos()).
-            // Also erase the EOG token text from generated_text so it does not appear in
-            // result.content or any streamed batch: EOG tokens are control tokens, not content.
-            if (!options.ignore_eos && llama_vocab_is_eog(rn_ctx->vocab, token_id)) {
-                if (state.generated_text.size() >= token_text.size()) {
-                    state.generated_text.erase(state.generated_text.size() - token_text.size());
-                } else {
-                    state.generated_text.clear();
-                }
-                if (state.n_sent_text > state.generated_text.size()) {
-                    state.n_sent_text = state.generated_text.size();
-                }
-                if (!state.generated_tokens.empty()) {
-                    state.generated_tokens.pop_back();
-                }
-                state.has_next_token = false;
-                // Flush any buffered tokens before breaking on EOS
-                if (callback && state.n_sent_text < state.generated_text.size()) {
-                    callback(state.generated_text.substr(state.n_sent_text), false);
-                    state.n_sent_text = state.generated_text.size();
-                }
-                break;
+            if (!pending_accepted) {
+                common_sampler_accept(state.sampler.get(), token_id, true);
             }
 
-            // Check stopping conditions (stop strings, context limit, n_remaining)
-            bool should_stop = check_stop_conditions(state, state.antiprompt, token_text, options.ignore_eos);
-
-            if (should_stop) {
-                // Flush any buffered tokens before breaking on stop string / context limit
-                if (callback && state.n_sent_text < state.generated_text.size()) {
-                    callback(state.generated_text.substr(state.n_sent_text), false);
-                    state.n_sent_text = state.generated_text.size();
-                }
+            // EOG, stop strings, n_predict limit and streaming (see process_generated_token).
+            if (!process_generated_token(state, token_id, token_text, options, callback)) {
                 break;
             }
-
-            // Stream unsent text, holding back any suffix that could be the start of a
-            // stop word. find_partial_stop_string returns the TEXT position where the
-            // potential prefix begins; we only send up to that position.
-            if (callback) {
-                size_t safe_send_limit = state.generated_text.size();
-                for (const std::string& word : state.antiprompt) {
-                    size_t partial_pos = find_partial_stop_string(word, state.generated_text);
-                    if (partial_pos != std::string::npos && partial_pos < safe_send_limit) {
-                        safe_send_limit = partial_pos;
-                    }
-                }
-                if (safe_send_limit > state.n_sent_text) {
-                    std::string text_to_send = state.generated_text.substr(
-                        state.n_sent_text, safe_send_limit - state.n_sent_text);
-                    state.n_sent_text = safe_send_limit;
-                    if (!text_to_send.empty() && !callback(text_to_send, false)) {
-                        state.has_next_token = false;
-                        break;
-                    }
-                }
-            }
         }
 
         result.stopped_by_length = state.stopped_by_limit;
+        result.stopped_by_time   = state.stopped_by_time;
         result.context_shifted   = state.context_shifted;
 
         // Capture timings from the context performance counters
         {
             auto perf = llama_perf_context(rn_ctx->ctx);
+            perf.n_eval      += state.perf_parked.n_eval;
+            perf.t_eval_ms   += state.perf_parked.t_eval_ms;
+            perf.n_p_eval    += state.perf_parked.n_p_eval;
+            perf.t_p_eval_ms += state.perf_parked.t_p_eval_ms;
             result.timings.predicted_n  = perf.n_eval;
             result.timings.predicted_ms = perf.t_eval_ms;
             result.timings.prompt_n     = perf.n_p_eval;
             result.timings.prompt_ms    = perf.t_p_eval_ms;
             result.timings.total_ms     = perf.t_p_eval_ms + perf.t_eval_ms;
+            result.timings.draft_n          = state.n_drafted;
+            result.timings.draft_n_accepted = state.n_draft_accepted;
+            result.timings.decode_passes    = state.n_decode_passes;
         }
 
+        // Flush any tokens not yet sent due to buffering (e.g. when generation ended before
+        // the next buf_size boundary — EOS, stop string, or n_predict limit). This also
+        // drops a trailing incomplete UTF-8 sequence, so it runs before content is set.
+        flush_unsent_text(state, callback);
+
         // Set the result
         result.content = state.generated_text;
         result.tokens = state.generated_tokens;
+        if (state.n_logprobs > 0) {
+            result.n_logprobs     = state.n_logprobs;
+            result.token_logprobs = std::move(state.token_logprobs);
+            result.top_tokens     = std::move(state.top_tokens);
+            result.top_logprobs   = std::move(state.top_logprobs);
+        }
         result.n_prompt_tokens = state.prompt_tokens.size();
         result.n_predicted_tokens = state.n_decoded;
+        for (size_t c = 1; c < result.choices.size(); c++) {
+            result.n_predicted_tokens += result.choices[c].n_predicted_tokens;
+        }
 
-        // KV state is owned by run_chat_completion (kv_messages). Nothing to update here.
+        // kv_tokens already mirrors seq 0; message boundaries (kv_messages) are owned by
+        // run_chat_completion.
+
+        release_sampler(rn_ctx, state);
 
-        // Flush any tokens not yet sent due to buffering (e.g. when generation ended before
-        // the next buf_size boundary — EOS, stop string, or n_predict limit).
-        if (callback && state.n_sent_text < state.generated_text.size()) {
-            callback(state.generated_text.substr(state.n_sent_text), false);
-            state.n_sent_text = state.generated_text.size();
-        }
         // Final callback with is_done=true. The string argument is ignored by
         // callback_adapter (!is_done guard), so pass empty to avoid a needless copy.
         if (callback) {
@@ -690,6 +2082,7 @@ CompletionResult run_completion(
     }
 }
 
+
 // Counts media (image/audio) chunks in a tokenized mtmd input. Used to decide
 // whether the batched-encode path below is worth taking.
 static size_t count_media_chunks(const mtmd_input_chunks* chunks) {
@@ -810,10 +2203,255 @@ static int32_t mtmd_eval_chunks_batched(
     return 0;
 }
 
+// The leading system / developer messages rendered with the tools and no generation
+// prompt, tokenized: what every turn of a conversation with this system prompt and these
+// tools starts with (see rn-shared-prefix.h). Empty when the template cannot render them
+// alone. Only the text matters, so the grammar is skipped (force_pure_content).
+static std::vector<llama_token> render_system_prefix(
+    rn_llama_context* rn_ctx,
+    const common_chat_templates_inputs& inputs) {
+    size_t n_system = 0;
+    while (n_system < inputs.messages.size() &&
+           (inputs.messages[n_system].role == "system" || inputs.messages[n_system].role == "developer")) {
+        n_system++;
+    }
+    if (n_system == 0 && inputs.tools.empty()) {
+        return {};
+    }
+    common_chat_templates_inputs prefix = inputs;
+    prefix.messages.resize(n_system);
+    prefix.add_generation_prompt = false;
+    prefix.force_pure_content    = true;
+    try {
+        return common_tokenize(rn_ctx->vocab,
+                               common_chat_templates_apply(rn_ctx->chat_templates.get(), prefix).prompt,
+                               true, true);
+    } catch (...) {
+        return {};
+    }
+}
+
+// Maps ascending character offsets into `prompt` to kv_messages boundaries by walking the
+// pieces of one tokenization of `prompt`: each is the number of tokens that end at or
+// before the offset (a token straddling it is not counted). Returns false when the pieces
+// do not line up with the text.
+static bool offsets_to_token_ends(
+    rn_llama_context* rn_ctx,
+    const std::string& prompt,
+    const std::vector<size_t>& offsets,
+    std::vector<int32_t>& token_ends) {
+    const std::vector<llama_token> tokens = common_tokenize(rn_ctx->vocab, prompt, true, true);
+    token_ends.assign(offsets.size(), 0);
+    size_t cursor = 0;
+    size_t k = 0;
+    for (size_t i = 0; i < tokens.size() && k < offsets.size(); i++) {
+        const std::string_view piece = rn_ctx->pieces.piece(tokens[i]);
+        if (prompt.compare(cursor, piece.size(), piece) == 0) {
+            cursor += piece.size();
+        } else if (!(i == 0 && tokens[0] == llama_vocab_bos(rn_ctx->vocab))) {
+            return false; // BOS added by the tokenizer is the only token not in the text
+        }
+        while (k < offsets.size() && offsets[k] <= cursor) {
+            token_ends[k] = static_cast<int32_t>(offsets[k] == cursor ? i + 1 : i);
+            k++;
+        }
+    }
+    return k == offsets.size();
+}
+
+// Computes kv_messages token boundaries for msgs[first, last) from a single render.
+// A boundary is the end of the message's content, before the template's end-of-turn
+// text (see rn_llama_context::kv_msg_entry). Each message's content gets a unique marker
+// appended; the conversation is rendered once with the same inputs that produced
+// `prompt`, the markers are located and removed, and their offsets are mapped with
+// offsets_to_token_ends.
+// Returns false — the caller then falls back to compute_message_boundaries_per_prefix —
+// when the template does not reproduce `prompt` once the markers are stripped (e.g. it
+// trims or rewrites content) or the token pieces do not line up with the text.
+static bool compute_message_boundaries(
+    rn_llama_context* rn_ctx,
+    const common_chat_templates_inputs& inputs,
+    const std::string& prompt,
+    size_t first,
+    size_t last,
+    bool pure_content,
+    std::vector<int32_t>& token_ends) {
+    if (first >= last || last > inputs.messages.size()) {
+        return false;
+    }
+
+    common_chat_templates_inputs marked = inputs;
+    // Only the text is needed: when a pure render is verified for these inputs, skip the
+    // autoparser and grammar generation the full render would redo every turn.
+    marked.force_pure_content = pure_content;
+    std::vector<std::string> markers;
+    for (size_t k = first; k < last; k++) {
+        if (!marked.messages[k].content_parts.empty()) {
+            return false;
+        }
+        markers.push_back("<<rn-kv-boundary-" + std::to_string(k) + ">>");
+        marked.messages[k].content += markers.back();
+    }
+
+    std::string rendered;
+    try {
+        rendered = common_chat_templates_apply(rn_ctx->chat_templates.get(), marked).prompt;
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    // Strip markers in order, recording where each one sat in the clean text.
+    std::vector<size_t> offsets;
+    std::string clean;
+    clean.reserve(rendered.size());
+    size_t pos = 0;
+    for (const auto& marker : markers) {
+        const size_t at = rendered.find(marker, pos);
+        if (at == std::string::npos) {
+            return false;
+        }
+        clean.append(rendered, pos, at - pos);
+        offsets.push_back(clean.size());
+        pos = at + marker.size();
+    }
+    clean.append(rendered, pos, std::string::npos);
+    if (clean != prompt) {
+        return false;
+    }
+    return offsets_to_token_ends(rn_ctx, prompt, offsets, token_ends);
+}
+
+// Fallback for compute_message_boundaries with the same boundary convention: renders
+// msgs[0..k] for each k in [first, last) with a marker after message k's content, and
+// takes the marker's offset when the text before it is a prefix of `prompt`. One render
+// per message. Stops at the first message that can't be placed, so token_ends may cover
+// fewer than last - first messages.
+static void compute_message_boundaries_per_prefix(
+    rn_llama_context* rn_ctx,
+    const common_chat_templates_inputs& inputs,
+    const std::string& prompt,
+    size_t first,
+    size_t last,
+    bool pure_content,
+    std::vector<int32_t>& token_ends) {
+    token_ends.clear();
+    std::vector<size_t> offsets;
+    for (size_t k = first; k < last && k < inputs.messages.size(); k++) {
+        if (!inputs.messages[k].content_parts.empty()) {
+            break;
+        }
+        common_chat_templates_inputs partial = inputs;
+        partial.messages.resize(k + 1);
+        partial.add_generation_prompt = false;
+        partial.force_pure_content    = pure_content;
+        const std::string marker = "<<rn-kv-boundary-" + std::to_string(k) + ">>";
+        partial.messages[k].content += marker;
+        std::string rendered;
+        try {
+            rendered = common_chat_templates_apply(rn_ctx->chat_templates.get(), partial).prompt;
+        } catch (const std::exception&) {
+            break; // template failed — stop tracking; next call will do a full encode
+        }
+        const size_t at = rendered.find(marker);
+        if (at == std::string::npos || at > prompt.size() || prompt.compare(0, at, rendered, 0, at) != 0 ||
+            (!offsets.empty() && at < offsets.back())) {
+            break;
+        }
+        offsets.push_back(at);
+    }
+    if (!offsets.empty() && !offsets_to_token_ends(rn_ctx, prompt, offsets, token_ends)) {
+        token_ends.clear();
+    }
+}
+
+// Minimum spacing between two stream_deltas parses; matches the JS flush cadence.
+static constexpr auto RN_DELTA_PARSE_INTERVAL = std::chrono::milliseconds(33);
+
+// Wraps the streaming callback of a chat completion for stream_deltas. common_chat_parse
+// cannot resume, so each parse covers the whole text streamed so far (is_partial = true)
+// and reports what changed since the previous parse. To keep that from growing with every
+// token, a chunk only triggers a parse once RN_DELTA_PARSE_INTERVAL has passed (the JS
+// flush cadence) and at least 4x the previous parse's own time, so parsing stays a bounded
+// share of the inference thread; the final chunk always parses. Events go to on_deltas:
+//   {type: "reasoning_content" | "content", text}
+//   {type: "tool_call", index, id?, name?, arguments}   arguments is the next fragment
+//   {type: "tool_call_done", index}
+// A call is done once a later call starts, or at the end of generation when the final
+// (non-partial) parse accepts it. A prefix the parser rejects, or a parse that rewrites
+// already reported text, yields no events; the next chunk diffs against the last good parse.
+static std::function<bool(const std::string&, bool)> make_delta_callback(
+    std::function<bool(const std::string&, bool)> callback,
+    std::shared_ptr<const rn_llama_context::chat_artifacts> artifacts,
+    rn_delta_callback on_deltas) {
+    struct stream_state {
+        std::string     text;
+        common_chat_msg msg;
+        size_t          n_calls_done = 0;
+        std::chrono::steady_clock::time_point next_parse; // epoch: the first chunk parses
+    };
+    auto st = std::make_shared<stream_state>();
+
+    return [callback = std::move(callback), artifacts = std::move(artifacts),
+            on_deltas = std::move(on_deltas), st](const std::string& chunk, bool is_done) -> bool {
+        st->text += chunk;
+        const auto t_start = std::chrono::steady_clock::now();
+        if (!is_done && t_start < st->next_parse) {
+            return callback(chunk, is_done);
+        }
+        json events = json::array();
+        try {
+            common_chat_msg msg = common_chat_parse(st->text, !is_done, *artifacts->parser);
+            size_t n_calls_done = st->n_calls_done;
+            json step = json::array();
+            auto close_calls = [&](size_t n) {
+                for (; n_calls_done < n; n_calls_done++) {
+                    step.push_back({{"type", "tool_call_done"}, {"index", n_calls_done}});
+                }
+            };
+            for (const auto& diff : common_chat_msg_diff::compute_diffs(st->msg, msg)) {
+                if (!diff.reasoning_content_delta.empty()) {
+                    step.push_back({{"type", "reasoning_content"}, {"text", diff.reasoning_content_delta}});
+                }
+                if (!diff.content_delta.empty()) {
+                    step.push_back({{"type", "content"}, {"text", diff.content_delta}});
+                }
+                if (diff.tool_call_index != std::string::npos) {
+                    close_calls(diff.tool_call_index);
+                    json call = {{"type", "tool_call"}, {"index", diff.tool_call_index}};
+                    if (!diff.tool_call_delta.id.empty()) {
+                        call["id"] = diff.tool_call_delta.id;
+                    }
+                    if (!diff.tool_call_delta.name.empty()) {
+                        call["name"] = diff.tool_call_delta.name;
+                    }
+                    call["arguments"] = diff.tool_call_delta.arguments;
+                    step.push_back(std::move(call));
+                }
+            }
+            if (is_done) {
+                close_calls(msg.tool_calls.size());
+            }
+            st->msg          = std::move(msg);
+            st->n_calls_done = n_calls_done;
+            events           = std::move(step);
+        } catch (const std::exception &) {
+            // Not parseable yet; wait for more text.
+        }
+        const auto t_end = std::chrono::steady_clock::now();
+        st->next_parse = t_end + std::max<std::chrono::steady_clock::duration>(
+            RN_DELTA_PARSE_INTERVAL, 4 * (t_end - t_start));
+        if (!events.empty()) {
+            on_deltas(events);
+        }
+        return callback(chunk, is_done);
+    };
+}
+
 CompletionResult run_chat_completion(
     rn_llama_context* rn_ctx,
     const CompletionOptions& options,
-    std::function<bool(const std::string&, bool)> callback) {
+    std::function<bool(const std::string&, bool)> callback,
+    rn_delta_callback on_deltas) {
 
     CompletionResult result;
     completion_state state;
@@ -836,7 +2474,64 @@ CompletionResult run_chat_completion(
             media_items = extract_media_from_messages(messages_json, mtmd_get_marker(rn_ctx->mtmd_ctx));
             has_media = !media_items.empty();
         }
-        const json& effective_messages = has_media ? messages_json : options.messages;
+        // Scheduled requests run on a pooled sequence owned by rn_batch_scheduler, not on
+        // seq 0, so the per-message KV bookkeeping below (which describes seq 0) is skipped.
+        // The caller does not hold inference_gate_ in this mode.
+        const bool scheduled = options.use_scheduler;
+        if (scheduled && !rn_ctx->scheduler) {
+            result.success = false;
+            result.error_msg = "Batch scheduler is not running";
+            result.error_type = RN_ERROR_CONTEXT;
+            return result;
+        }
+        if (scheduled && has_media) {
+            result.success = false;
+            result.error_msg = "Media messages cannot be routed through the batch scheduler";
+            result.error_type = RN_ERROR_INVALID_PARAM;
+            return result;
+        }
+
+        const uint64_t artifact_key = chat_artifact_key(rn_ctx, options);
+        std::ostringstream identity_hex;
+        identity_hex << std::hex << artifact_key;
+        const std::string kv_render_identity = identity_hex.str();
+
+        // Messages an earlier context shift evicted from seq 0 stay out of the rendered
+        // window, so the prompt keeps lining up with the shifted KV cache. That only holds
+        // for the conversation they were cut from: with a different render identity or a
+        // different leading message the set is dropped and the messages render again.
+        // reset_kv_cache brings them back too. Left-out IDs are reported in the response.
+        const json* message_source = has_media ? &messages_json : &options.messages;
+        json windowed_messages;
+        std::vector<std::string> evicted_message_ids;
+        if (!scheduled && options.reset_kv_cache) {
+            rn_ctx->kv_evicted_ids.clear();
+        }
+        if (!scheduled && !rn_ctx->kv_evicted_ids.empty() && message_source->is_array()) {
+            windowed_messages = json::array();
+            for (const auto& msg : *message_source) {
+                if (msg.is_object() && msg.contains("id") && msg["id"].is_string() &&
+                    rn_ctx->kv_evicted_ids.count(msg["id"].get<std::string>()) > 0) {
+                    evicted_message_ids.push_back(msg["id"].get<std::string>());
+                    continue;
+                }
+                windowed_messages.push_back(msg);
+            }
+            const bool same_prefix =
+                rn_ctx->kv_has_messages &&
+                rn_ctx->kv_render_identity == kv_render_identity &&
+                !rn_ctx->kv_messages.empty() &&
+                !windowed_messages.empty() &&
+                windowed_messages[0].is_object() &&
+                windowed_messages[0].value("id", json()) == rn_ctx->kv_messages[0].id;
+            if (same_prefix) {
+                message_source = &windowed_messages;
+            } else {
+                rn_ctx->kv_evicted_ids.clear();
+                evicted_message_ids.clear();
+            }
+        }
+        const json& effective_messages = *message_source;
 
         // Parse messages directly from options
         std::vector<common_chat_msg> chat_msgs;
@@ -844,13 +2539,14 @@ CompletionResult run_chat_completion(
             chat_msgs = common_chat_msgs_parse_oaicompat(effective_messages);
         }
 
-        const std::string kv_render_identity = build_kv_render_identity(rn_ctx, options);
-        if (rn_ctx->kv_has_messages &&
+        if (!scheduled &&
+            rn_ctx->kv_has_messages &&
             !rn_ctx->kv_render_identity.empty() &&
             rn_ctx->kv_render_identity != kv_render_identity) {
-            llama_memory_clear(llama_get_memory(rn_ctx->ctx), true);
+            rn_clear_sequence(rn_ctx, 0);
             rn_ctx->kv_messages.clear();
             rn_ctx->kv_has_messages = false;
+            rn_ctx->kv_evicted_ids.clear();
         }
 
         // --- Per-message KV cache prefix reuse ---
@@ -872,7 +2568,7 @@ CompletionResult run_chat_completion(
         // Find how many leading messages have IDs that match the cached sequence.
         // A message with an empty ID never matches (we can't trust it's unchanged).
         size_t kv_match_count = 0;
-        if (!has_media && !msg_ids.empty() && rn_ctx->kv_has_messages && !options.reset_kv_cache) {
+        if (!scheduled && !has_media && !msg_ids.empty() && rn_ctx->kv_has_messages && !options.reset_kv_cache) {
             const auto& cached = rn_ctx->kv_messages;
             while (kv_match_count < msg_ids.size()
                    && kv_match_count < cached.size()
@@ -885,23 +2581,37 @@ CompletionResult run_chat_completion(
         // Completion cache: if prompt_id changed from the cached value, the system prompt or
         // tools have changed — the KV cache is stale and must be fully cleared.
         // This must happen BEFORE the KV eviction block so the clear is applied correctly.
+        // The entry is copied under rn_ctx->mutex because scheduled requests reach this
+        // point concurrently.
         const bool has_cache_ids = !options.prompt_id.empty() && !options.config_id.empty();
-        if (has_cache_ids && rn_ctx->completion_cache.has_value()) {
-            if (rn_ctx->completion_cache->prompt_id != options.prompt_id) {
-                // prompt_id changed — system prompt or tools changed; KV cache is invalid.
-                llama_memory_clear(llama_get_memory(rn_ctx->ctx), true);
-                rn_ctx->kv_messages.clear();
-                rn_ctx->kv_has_messages = false;
-                // Invalidate the cache entry so config_cache_hit will be false below.
-                rn_ctx->completion_cache.reset();
+        std::optional<rn_llama_context::completion_cache_entry> cached_config;
+        if (has_cache_ids) {
+            std::lock_guard<std::mutex> cache_lock(rn_ctx->mutex);
+            if (rn_ctx->completion_cache.has_value()) {
+                if (rn_ctx->completion_cache->prompt_id != options.prompt_id) {
+                    // prompt_id changed — system prompt or tools changed; KV cache is invalid.
+                    if (!scheduled) {
+                        rn_clear_sequence(rn_ctx, 0);
+                        rn_ctx->kv_messages.clear();
+                        rn_ctx->kv_has_messages = false;
+                        rn_ctx->kv_evicted_ids.clear();
+                        kv_match_count = 0;
+                    }
+                    // Invalidate the cache entry so config_cache_hit will be false below.
+                    rn_ctx->completion_cache.reset();
+                } else {
+                    cached_config = rn_ctx->completion_cache;
+                }
             }
         }
 
         // Decide the KV common position and evict stale entries.
-        int32_t kv_hint_pos = 0; // default: full encode from position 0
-        if (has_media) {
+        int32_t kv_hint_pos = 0; // >= 0: trusted prefix length; -1: token-level prefix match
+        if (scheduled) {
+            // Prefix reuse is decided per slot when the scheduler admits the request.
+        } else if (has_media) {
             // Images invalidate KV prefix reuse — always do a full clear.
-            llama_memory_clear(llama_get_memory(rn_ctx->ctx), true);
+            rn_clear_sequence(rn_ctx, 0);
         } else if (kv_match_count > 0) {
             const int32_t kv_common_len = rn_ctx->kv_messages[kv_match_count - 1].token_end;
             // Clamp against actual context size: persisted metadata may be stale if the
@@ -914,7 +2624,7 @@ CompletionResult run_chat_completion(
                     !llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, safe_kv_len, -1)) {
                     // seq_rm returns false on recurrent models and some GPU backends.
                     // Full clear + invalidate metadata so next call starts fresh.
-                    llama_memory_clear(llama_get_memory(rn_ctx->ctx), true);
+                    rn_clear_sequence(rn_ctx, 0);
                     rn_ctx->kv_messages.clear();
                     rn_ctx->kv_has_messages = false;
                     kv_hint_pos = 0;
@@ -928,7 +2638,7 @@ CompletionResult run_chat_completion(
                     !llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), 0, safe_kv_len, -1)) {
                     // seq_rm returns false on recurrent models and some GPU backends.
                     // Full clear + invalidate metadata so next call starts fresh.
-                    llama_memory_clear(llama_get_memory(rn_ctx->ctx), true);
+                    rn_clear_sequence(rn_ctx, 0);
                     rn_ctx->kv_messages.clear();
                     rn_ctx->kv_has_messages = false;
                     kv_hint_pos = 0;
@@ -936,21 +2646,22 @@ CompletionResult run_chat_completion(
                     kv_hint_pos = safe_kv_len;
                 }
             }
-        } else {
-            // No matching prefix (or no IDs provided): full clear.
-            llama_memory_clear(llama_get_memory(rn_ctx->ctx), true);
+        } else if (options.reset_kv_cache) {
+            rn_clear_sequence(rn_ctx, 0);
             kv_hint_pos = 0;
+        } else {
+            // No message-ID match (or no IDs provided): run_completion diffs the rendered
+            // prompt against kv_tokens and reuses the longest common token prefix.
+            kv_hint_pos = -1;
         }
 
-        // Completion cache lookup: if both prompt_id and config_id match the cached entry,
-        // skip the expensive common_chat_templates_apply step entirely and reuse the cached
-        // sampling params, grammar, grammar_triggers, preserved_tokens, and additional_stops.
-        // When both IDs are empty, behave identically to before (no cache lookup, no cache store).
-        // Contract: callers should roll tools + system prompt identity into config_id so
-        // completion-config changes only take effect when config_id changes.
+        // Completion cache lookup: when both prompt_id and config_id match the cached entry
+        // it already describes this configuration and is not rewritten below. When both IDs
+        // are empty there is no cache lookup and no cache store. Render artifacts are
+        // cached separately by content (chat_artifact_key), independent of these IDs.
         bool config_cache_hit = false;
-        if (has_cache_ids && rn_ctx->completion_cache.has_value()) {
-            const auto& cached_entry = *rn_ctx->completion_cache;
+        if (cached_config.has_value()) {
+            const auto& cached_entry = *cached_config;
             if (cached_entry.prompt_id == options.prompt_id && cached_entry.config_id == options.config_id) {
                 config_cache_hit = true;
             }
@@ -993,129 +2704,71 @@ CompletionResult run_chat_completion(
         // Pass the trusted KV start position so run_completion skips its own KV management.
         cmpl_options.kv_hint_pos = kv_hint_pos;
 
-        common_chat_params chat_params;
-        if (config_cache_hit) {
-            // Cache hit: always render with full template inputs (including tools) so
-            // tool-aware templates remain semantically identical between miss/hit paths.
-            const auto& cached_entry = *rn_ctx->completion_cache;
-            try {
-                chat_params = common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs);
-            } catch (const std::exception &) {
-                try {
-                    template_inputs.force_pure_content = true;
-                    chat_params = common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs);
-                } catch (const std::exception &) {
-                    template_inputs.use_jinja = false;
-                    chat_params = common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs);
-                }
-            }
-
-            // Preserve stop strings and protected tokens from the current render.
-            for (const auto & stop : chat_params.additional_stops) {
-                cmpl_options.stop.push_back(stop);
-            }
-
-            for (const auto & pt : chat_params.preserved_tokens) {
-                auto ids = common_tokenize(rn_ctx->vocab, pt, false, true);
-                if (ids.size() == 1) {
-                    cmpl_options.preserved_tokens.insert(ids[0]);
-                }
-            }
-
-            // Conservative grammar reuse:
-            // - Reuse cached grammar only when no tool grammar is in play.
-            // - Otherwise, regenerate from current chat_params for correctness.
-            const bool grammar_inputs_unchanged =
-                template_inputs.tools.empty() &&
-                options.grammar.empty() &&
-                !chat_params.grammar.empty();
-
-            if (grammar_inputs_unchanged && !cached_entry.grammar.empty()) {
-                cmpl_options.grammar          = cached_entry.grammar;
-                cmpl_options.grammar_lazy     = cached_entry.grammar_lazy;
-                cmpl_options.grammar_triggers = cached_entry.grammar_triggers;
-            } else if (!chat_params.grammar.empty()) {
-                cmpl_options.grammar = chat_params.grammar;
-                if (!template_inputs.tools.empty()) {
-                    cmpl_options.grammar_lazy = false;
-                } else {
-                    cmpl_options.grammar_lazy = chat_params.grammar_lazy;
-                }
-                cmpl_options.grammar_triggers = chat_params.grammar_triggers;
-            }
-        } else {
-            // Cache miss (or IDs empty): run full common_chat_templates_apply as before.
-            //
-            // common_chat_templates_apply_jinja renders the template twice against real messages
-            // (add_generation_prompt=false then true) to extract the generation-prompt suffix before
-            // invoking either the specialized handler or the auto-parser.  If the model's embedded
-            // jinja template references a field that is absent or a wrong type (e.g. calls .lstrip()
-            // on a non-string), the runtime throws std::runtime_error.
-            //
-            // Level 1: full jinja path — autoparser generates a grammar/parser for structured output.
-            // Level 2 (force_pure_content): skips the autoparser; jinja still renders the prompt but
-            //          no grammar constraint is produced.  Tool calls still appear in the prompt via
-            //          the template itself; only grammar-constrained sampling is lost.
-            // Level 3 (use_jinja=false): the C++ llama_chat_apply_template path — zero jinja.
-            //          Last resort to prevent a hard crash when jinja itself cannot execute the
-            //          template.  Produces a usable prompt; tool-call grammar/parser is not available.
-            try {
-                chat_params = common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs);
-            } catch (const std::exception & e) {
-                try {
-                    template_inputs.force_pure_content = true;
-                    chat_params = common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs);
-                } catch (const std::exception &) {
-                    template_inputs.use_jinja = false;
-                    chat_params = common_chat_templates_apply(rn_ctx->chat_templates.get(), template_inputs);
-                }
-            }
-
-            // Add extra stop strings emitted by the chat format (e.g. EOS variants, special separators).
-            // Mirrors server-common.cpp: llama_params["stop"].push_back(stop)
-            for (const auto & stop : chat_params.additional_stops) {
-                cmpl_options.stop.push_back(stop);
-            }
-
-            // Tokenize preserved_tokens strings from the chat template and insert single-token IDs
-            // into sampling params so the tokenizer never splits them mid-sequence.
-            // Mirrors server-task.cpp: common_tokenize → insert if size() == 1.
-            for (const auto & pt : chat_params.preserved_tokens) {
-                auto ids = common_tokenize(rn_ctx->vocab, pt, false, true);
-                if (ids.size() == 1) {
-                    cmpl_options.preserved_tokens.insert(ids[0]);
-                }
-            }
+        // Render the prompt. The render can fail on templates that reference fields that
+        // are absent or of the wrong type (common_chat_templates_apply_jinja renders the
+        // template twice against the real messages to extract the generation-prompt suffix
+        // before invoking the specialized handler or the auto-parser; e.g. .lstrip() on a
+        // non-string throws std::runtime_error), so it falls back in three levels:
+        //
+        // Level 1: full jinja path — autoparser generates a grammar/parser for structured output.
+        // Level 2 (force_pure_content): skips the autoparser; jinja still renders the prompt but
+        //          no grammar constraint is produced.  Tool calls still appear in the prompt via
+        //          the template itself; only grammar-constrained sampling is lost.
+        // Level 3 (use_jinja=false): the C++ llama_chat_apply_template path — zero jinja.
+        //          Last resort to prevent a hard crash when jinja itself cannot execute the
+        //          template.  Produces a usable prompt; tool-call grammar/parser is not available.
+        //
+        // Tool-heavy requests repeat the same tools turn after turn: the grammar, triggers,
+        // stops, preserved token ids and PEG parser of a level-1 render are cached by
+        // chat_artifact_key, and later turns only render the prompt (level 2 inputs) once
+        // that is verified to give the same text for this message shape.
+        std::shared_ptr<const rn_llama_context::chat_artifacts> artifacts;
+        bool pure_render_ok = false;
+        common_chat_params chat_params = apply_chat_template_cached(
+            rn_ctx, template_inputs, artifact_key, message_shape(chat_msgs), artifacts, pure_render_ok);
+
+        // Add extra stop strings emitted by the chat format (e.g. EOS variants, special separators).
+        // Mirrors server-common.cpp: llama_params["stop"].push_back(stop)
+        for (const auto & stop : chat_params.additional_stops) {
+            cmpl_options.stop.push_back(stop);
+        }
+        cmpl_options.preserved_tokens.insert(artifacts->preserved_ids.begin(), artifacts->preserved_ids.end());
 
-            if (!chat_params.grammar.empty()) {
-                cmpl_options.grammar = chat_params.grammar;
-                // Always force grammar_lazy to false when tools are present
-                if (!template_inputs.tools.empty()) {
-                    cmpl_options.grammar_lazy = false;
-                } else {
-                    // Only use chat_params.grammar_lazy if no tools are present
-                    cmpl_options.grammar_lazy = chat_params.grammar_lazy;
-                }
-                // Default to grammar_triggers provided by chat_params
-                cmpl_options.grammar_triggers = chat_params.grammar_triggers;
+        if (!chat_params.grammar.empty()) {
+            cmpl_options.grammar = chat_params.grammar;
+            // Always force grammar_lazy to false when tools are present
+            if (!template_inputs.tools.empty()) {
+                cmpl_options.grammar_lazy = false;
+            } else {
+                // Only use chat_params.grammar_lazy if no tools are present
+                cmpl_options.grammar_lazy = chat_params.grammar_lazy;
             }
+            // Default to grammar_triggers provided by chat_params
+            cmpl_options.grammar_triggers = chat_params.grammar_triggers;
+        }
 
-            // Store new cache entry when both IDs are provided.
-            if (has_cache_ids) {
-                rn_llama_context::completion_cache_entry new_entry;
-                new_entry.prompt_id        = options.prompt_id;
-                new_entry.config_id        = options.config_id;
-                new_entry.grammar          = cmpl_options.grammar;
-                new_entry.grammar_lazy     = cmpl_options.grammar_lazy;
-                new_entry.grammar_triggers = cmpl_options.grammar_triggers;
-                new_entry.preserved_tokens = cmpl_options.preserved_tokens;
-                new_entry.additional_stops = chat_params.additional_stops;
-                rn_ctx->completion_cache   = std::move(new_entry);
-            }
+        // Store new cache entry when both IDs are provided.
+        if (has_cache_ids && !config_cache_hit) {
+            rn_llama_context::completion_cache_entry new_entry;
+            new_entry.prompt_id        = options.prompt_id;
+            new_entry.config_id        = options.config_id;
+            new_entry.grammar          = cmpl_options.grammar;
+            new_entry.grammar_lazy     = cmpl_options.grammar_lazy;
+            new_entry.grammar_triggers = cmpl_options.grammar_triggers;
+            new_entry.preserved_tokens = cmpl_options.preserved_tokens;
+            new_entry.additional_stops = chat_params.additional_stops;
+            std::lock_guard<std::mutex> cache_lock(rn_ctx->mutex);
+            rn_ctx->completion_cache   = std::move(new_entry);
         }
 
         cmpl_options.prompt = chat_params.prompt;
 
+        // First request of a prompt_id: its system prompt and tools become the shared
+        // prefix once the prompt is in KV (run_completion or the batch scheduler).
+        if (!has_media && rn_shared_prefix_wanted(rn_ctx, options.prompt_id)) {
+            cmpl_options.shared_prefix_tokens = render_system_prefix(rn_ctx, template_inputs);
+        }
+
         // Wire reasoning budget from chat template into completion options.
         // Mirrors server-common.cpp: reads thinking_start/end_tag from chat_params and
         // passes them through to the sampler via reasoning_budget_* fields.
@@ -1186,57 +2839,98 @@ CompletionResult run_chat_completion(
             cmpl_options.kv_hint_pos = -1;
         }
 
-        // Run standard completion with the processed prompt
-        result = run_completion(rn_ctx, cmpl_options, callback);
+        // Per-message token boundaries of this prompt (exclusive ends, one per message up
+        // to the first one without an ID; later messages can't be matched by ID either).
+        // Computed before the run so a context shift can evict whole messages, and stored
+        // in kv_messages afterwards. Matched messages keep their cached boundaries.
+        std::vector<int32_t> msg_ends;
+        size_t shift_first_msg = 0;
+        if (!scheduled && !msg_ids.empty()) {
+            const size_t n_msgs = chat_msgs.size();
+            size_t n_tracked = kv_match_count;
+            while (n_tracked < n_msgs && n_tracked < msg_ids.size() && !msg_ids[n_tracked].empty()) {
+                n_tracked++;
+            }
+            for (size_t k = 0; k < kv_match_count; k++) {
+                msg_ends.push_back(rn_ctx->kv_messages[k].token_end);
+            }
 
-        // If context shift occurred, KV message boundaries are now stale (positions shifted).
-        // Invalidate them so the next call does a full re-encode rather than using wrong offsets.
-        if (result.context_shifted) {
-            rn_ctx->kv_messages.clear();
-            rn_ctx->kv_has_messages = false;
-            rn_ctx->kv_render_identity.clear();
+            // Preferred: one marked render + one tokenization for all new messages.
+            std::vector<int32_t> token_ends;
+            if (n_tracked > kv_match_count &&
+                compute_message_boundaries(rn_ctx, template_inputs, cmpl_options.prompt,
+                                           kv_match_count, n_tracked, pure_render_ok, token_ends)) {
+                msg_ends.insert(msg_ends.end(), token_ends.begin(), token_ends.end());
+            } else if (n_tracked > kv_match_count) {
+                // Fallback: one render of the conversation per new message.
+                compute_message_boundaries_per_prefix(rn_ctx, template_inputs, cmpl_options.prompt,
+                                                      kv_match_count, n_tracked, pure_render_ok, token_ends);
+                msg_ends.insert(msg_ends.end(), token_ends.begin(), token_ends.end());
+            }
+
+            // Messages a context shift may evict: the contiguous run after the leading
+            // system/developer messages, up to the next system message, never including
+            // the last message (the turn being answered).
+            auto is_system = [](const common_chat_msg& m) {
+                return m.role == "system" || m.role == "developer";
+            };
+            while (shift_first_msg < n_msgs && is_system(chat_msgs[shift_first_msg])) {
+                shift_first_msg++;
+            }
+            for (size_t k = shift_first_msg; !has_media && k < msg_ends.size() && k + 1 < n_msgs; k++) {
+                const int32_t start = k == 0 ? 0 : msg_ends[k - 1];
+                if (is_system(chat_msgs[k]) || msg_ends[k] < start) {
+                    break;
+                }
+                cmpl_options.shift_spans.emplace_back(start, msg_ends[k]);
+            }
+        }
+
+        if (options.stream_deltas && on_deltas && callback && artifacts->parser) {
+            callback = make_delta_callback(std::move(callback), artifacts, std::move(on_deltas));
         }
 
+        // Run standard completion with the processed prompt
+        result = scheduled
+            ? rn_ctx->scheduler->run(cmpl_options, callback)
+            : run_completion(rn_ctx, cmpl_options, callback);
+
+        // A shift that cut through a message (or an interrupted run after any shift) leaves
+        // the boundaries stale; invalidate them so the next call re-diffs from scratch.
+        const bool boundaries_stale =
+            result.context_shifted &&
+            (result.shift_misaligned || !result.success || msg_ids.empty());
+
         // Update per-message KV boundaries so the next call can skip unchanged messages.
         // We only do this when message IDs were provided (otherwise there's nothing to track).
-        if (result.success && !msg_ids.empty()) {
-            // Retain boundaries for matched messages (they're already correct in kv_messages).
+        if (scheduled) {
+            // Slots track their own cached tokens; seq 0 boundaries are unaffected.
+        } else if (boundaries_stale) {
+            rn_ctx->kv_messages.clear();
+            rn_ctx->kv_has_messages = false;
+            rn_ctx->kv_render_identity.clear();
+        } else if (result.success && !msg_ids.empty()) {
             rn_ctx->kv_messages.resize(kv_match_count);
+            for (size_t k = kv_match_count; k < msg_ends.size(); k++) {
+                rn_ctx->kv_messages.push_back({msg_ids[k], msg_ends[k]});
+            }
 
-            // For each new/changed message, determine where its tokens end by applying
-            // the chat template up to that message and tokenizing the result.
-            // This is O(n_new_messages) template applications — typically 1–2 per turn.
-            const size_t n_msgs = chat_msgs.size();
-            for (size_t k = kv_match_count; k < n_msgs && k < msg_ids.size(); k++) {
-                if (msg_ids[k].empty()) {
-                    // No ID for this message — stop tracking here; subsequent messages
-                    // can't be matched by ID either.
-                    break;
+            // Messages evicted whole by context shifts: drop their boundaries, move the
+            // later ones back by the evicted length and keep them out of the next render.
+            const size_t n_evicted = static_cast<size_t>(result.n_shift_spans_evicted);
+            if (n_evicted > 0) {
+                const size_t  first     = shift_first_msg;
+                const size_t  last      = first + n_evicted;
+                const int32_t start     = first == 0 ? 0 : msg_ends[first - 1];
+                const int32_t n_removed = msg_ends[last - 1] - start;
+                for (size_t k = first; k < last; k++) {
+                    rn_ctx->kv_evicted_ids.insert(msg_ids[k]);
+                    evicted_message_ids.push_back(msg_ids[k]);
                 }
-                // Apply the template to messages[0..k] to get the token boundary.
-                // Use add_generation_prompt=true for the final message so the stored token_end
-                // includes the gen-prompt suffix tokens (e.g. "<|im_start|>assistant\n") that
-                // ARE encoded in the actual KV cache. Using false would make kv_hint_pos point
-                // before those tokens, causing the next call to re-encode them at occupied
-                // KV positions and misaligning all subsequent RoPE position embeddings.
-                common_chat_templates_inputs tinput;
-                tinput.messages               = std::vector<common_chat_msg>(chat_msgs.begin(),
-                                                                              chat_msgs.begin() + k + 1);
-                // Always false: we want the token boundary after the message content, not after
-                // the generation-prompt suffix. Using true would include e.g. "<|im_start|>assistant\n"
-                // in token_end, but on the next turn that suffix is part of the assistant message
-                // tokens — causing kv_hint_pos to point into the wrong position.
-                tinput.add_generation_prompt  = false;
-                tinput.use_jinja              = rn_ctx->params.use_jinja;
-                tinput.reasoning_format       = rn_ctx->params.reasoning_format;
-                tinput.chat_template_kwargs   = rn_ctx->params.default_template_kwargs;
-                try {
-                    auto partial = common_chat_templates_apply(rn_ctx->chat_templates.get(), tinput);
-                    auto partial_tokens = common_tokenize(rn_ctx->vocab, partial.prompt, true, true);
-                    rn_ctx->kv_messages.push_back({msg_ids[k],
-                                                   static_cast<int32_t>(partial_tokens.size())});
-                } catch (...) {
-                    break; // template failed — stop tracking; next call will do a full encode
+                rn_ctx->kv_messages.erase(rn_ctx->kv_messages.begin() + first,
+                                          rn_ctx->kv_messages.begin() + last);
+                for (size_t k = first; k < rn_ctx->kv_messages.size(); k++) {
+                    rn_ctx->kv_messages[k].token_end -= n_removed;
                 }
             }
             rn_ctx->kv_has_messages = true;
@@ -1248,37 +2942,58 @@ CompletionResult run_chat_completion(
         }
 
         if (result.success) {
-            // Parse the generated content for tool calls and structured responses
-            common_chat_msg parsed_msg;
-            bool has_parsed_content = false;
-            
-            // Only parse if we have tools available and the response isn't empty
-            if (!template_inputs.tools.empty() && !result.content.empty()) {
-                try {
-                    // Construct parser params from the applied chat params, then override reasoning format.
-                    // The common_chat_parser_params(chat_params) constructor only copies format and
-                    // generation_prompt — it does NOT copy the PEG arena.  Load it explicitly so that
-                    // common_chat_parse uses the autoparser's generated PEG grammar for tool-call
-                    // parsing instead of the fallback pure-content parser.
-                    // Mirrors server-task.cpp: params.chat_parser_params.parser.load(data["chat_parser"])
-                    common_chat_parser_params parser_params(chat_params);
-                    parser_params.reasoning_format = rn_ctx->params.reasoning_format;
-                    if (!chat_params.parser.empty()) {
-                        parser_params.parser.load(chat_params.parser);
+            // Parses one choice's generated content for tool calls and structured responses
+            // and builds its OpenAI-compatible choice object.
+            auto make_choice = [&](int index, const std::string& content, bool stopped_by_length,
+                                   bool stopped_by_time, bool& parse_failed, std::string& parse_error) {
+                common_chat_msg parsed_msg;
+                bool has_parsed_content = false;
+
+                // Only parse if we have tools available and the response isn't empty
+                if (!template_inputs.tools.empty() && !content.empty()) {
+                    try {
+                        // The PEG parser was loaded once with the render artifacts.
+                        if (!artifacts->parser) {
+                            throw std::runtime_error(artifacts->parser_error);
+                        }
+                        parsed_msg = common_chat_parse(content, false, *artifacts->parser);
+                        has_parsed_content = true;
+
+                    } catch (const std::exception& e) {
+                        // If parsing fails, treat as regular content
+                        has_parsed_content = false;
+                        parse_failed = true;
+                        parse_error = e.what();
                     }
+                }
 
-                    // Parse the generated content for tool calls
-                    parsed_msg = common_chat_parse(result.content, false, parser_params);
-                    has_parsed_content = true;
-                    
-                } catch (const std::exception& e) {
-                    // If parsing fails, treat as regular content
-                    has_parsed_content = false;
-                    result.tool_call_parse_failed = true;
-                    result.tool_call_parse_error = e.what();
+                json choice = {
+                    {"index", index},
+                    {"message", {
+                        {"role", "assistant"}
+                    }},
+                    {"finish_reason", finish_reason(stopped_by_length, stopped_by_time)}
+                };
+
+                // Add parsed content and tool calls if available
+                if (has_parsed_content && !parsed_msg.tool_calls.empty()) {
+                    // Use the server.cpp approach: let the common_chat_msg handle the JSON conversion
+                    choice["message"] = parsed_msg.to_json_oaicompat();
+                    choice["finish_reason"] = "tool_calls";
+                } else if (parse_failed) {
+                    choice["message"]["content"] = content;
+                    choice["finish_reason"] = "tool_call_parse_error";
+                    choice["tool_call_parse_error"] = parse_error;
+                } else if (has_parsed_content && !parsed_msg.content.empty()) {
+                    // Regular text response with parsed content
+                    choice["message"]["content"] = parsed_msg.content;
+                } else {
+                    // Fallback to raw content if parsing failed or no tools
+                    choice["message"]["content"] = content;
                 }
-            }
-            
+                return choice;
+            };
+
             // Create OpenAI-compatible response
             json response = {
                 {"id", gen_chatcmplid()},
@@ -1288,32 +3003,16 @@ CompletionResult run_chat_completion(
             };
 
             json choices = json::array();
-            json choice = {
-                {"index", 0},
-                {"message", {
-                    {"role", "assistant"}
-                }},
-                {"finish_reason", result.stopped_by_length ? "length" : "stop"}
-            };
-            
-            // Add parsed content and tool calls if available
-            if (has_parsed_content && !parsed_msg.tool_calls.empty()) {
-                // Use the server.cpp approach: let the common_chat_msg handle the JSON conversion
-                choice["message"] = parsed_msg.to_json_oaicompat();
-                choice["finish_reason"] = "tool_calls";
-            } else if (result.tool_call_parse_failed) {
-                choice["message"]["content"] = result.content;
-                choice["finish_reason"] = "tool_call_parse_error";
-                choice["tool_call_parse_error"] = result.tool_call_parse_error;
-            } else if (has_parsed_content && !parsed_msg.content.empty()) {
-                // Regular text response with parsed content
-                choice["message"]["content"] = parsed_msg.content;
-            } else {
-                // Fallback to raw content if parsing failed or no tools
-                choice["message"]["content"] = result.content;
+            choices.push_back(make_choice(0, result.content, result.stopped_by_length, result.stopped_by_time,
+                                          result.tool_call_parse_failed, result.tool_call_parse_error));
+            for (size_t c = 1; c < result.choices.size(); c++) {
+                bool        parse_failed = false;
+                std::string parse_error;
+                choices.push_back(make_choice(static_cast<int>(c), result.choices[c].content,
+                                              result.choices[c].stopped_by_length,
+                                              result.choices[c].stopped_by_time,
+                                              parse_failed, parse_error));
             }
-
-            choices.push_back(choice);
             response["choices"] = choices;
 
             // Add usage information
@@ -1323,6 +3022,12 @@ CompletionResult run_chat_completion(
                 {"total_tokens", result.n_prompt_tokens + result.n_predicted_tokens}
             };
 
+            // Message IDs the model no longer sees: left out of this prompt after an
+            // earlier shift, or evicted by a shift during this run.
+            if (!evicted_message_ids.empty()) {
+                response["evicted_message_ids"] = evicted_message_ids;
+            }
+
             // Store the response in the result
             result.chat_response = response;
         }
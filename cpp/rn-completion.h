@@ -0,0 +1,170 @@
+#pragma once
+
+// Internal generation helpers shared by the single-sequence loop in rn-completion.cpp
+// and the continuous-batching scheduler in rn-scheduler.cpp. Not part of the JSI surface.
+
+#include "rn-llama.h"
+// Suppress unused function warnings from llama.cpp headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "sampling.h"
+#pragma GCC diagnostic pop
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace facebook::react {
+
+// Struct to track prediction completion state
+struct completion_state {
+    struct sampler_deleter {
+        void operator()(common_sampler* sampler) const {
+            if (sampler) {
+                common_sampler_free(sampler);
+            }
+        }
+    };
+
+    rn_llama_context* rn_ctx = nullptr;
+
+    bool has_next_token = true;
+    bool has_new_line = false;
+    bool truncated = false;
+
+    int n_past = 0;
+    int n_ctx = 0;
+    int n_predict = 0;
+    int n_decoded = 0;
+    int n_remaining = 0;
+
+    size_t n_sent_text = 0;
+
+    std::string generated_text;
+    std::string stopping_word;
+    bool stopped_by_limit = false;
+    bool stopped_by_time = false;
+    bool context_shifted = false;  // true if at least one context shift occurred
+
+    // Absolute deadlines from max_time_ms / first_token_deadline_ms (see set_deadlines).
+    std::chrono::steady_clock::time_point t_deadline    = std::chrono::steady_clock::time_point::max();
+    std::chrono::steady_clock::time_point t_first_token = std::chrono::steady_clock::time_point::max();
+
+    std::vector<llama_token> prompt_tokens;
+    std::vector<llama_token> generated_tokens;
+
+    std::unique_ptr<common_sampler, sampler_deleter> sampler;
+    std::string              sampler_key;  // rn_sampler_cache key; empty = not cacheable
+    std::vector<std::string> antiprompt;
+    rn_stop_matcher          stop_matcher; // built from antiprompt once per request
+
+    // Per-token logprobs (n_logprobs > 0), see CompletionResult.
+    int n_logprobs = 0;
+    std::vector<float>       token_logprobs;
+    std::vector<llama_token> top_tokens;
+    std::vector<float>       top_logprobs;
+
+    // Speculative decoding stats
+    int n_drafted = 0;
+    int n_draft_accepted = 0;
+    int n_decode_passes = 0;  // target decodes during generation (plain + verify)
+
+    // llama_perf_context counters of the segments before each preemption (the request
+    // that ran meanwhile reset them), added to the final timings.
+    llama_perf_context_data perf_parked = {};
+};
+
+// Idle samplers of finished requests, keyed by their effective sampling params.
+// common_sampler_init builds the whole chain, parses the grammar and allocates an n_vocab
+// candidate array; a cached sampler is only reset (common_sampler_reset reseeds the RNG
+// from the configured seed, so results match a fresh sampler). A sampler belongs to one
+// request between acquire() and release(). The mutex is a leaf lock: the seq 0 path and
+// the batch scheduler share the cache.
+class rn_sampler_cache {
+public:
+    using sampler_ptr = std::unique_ptr<common_sampler, completion_state::sampler_deleter>;
+
+    static constexpr size_t CAPACITY = 4;
+
+    // Returns a reset idle sampler stored under `key`, or a new one built from `params`
+    // (null if common_sampler_init fails).
+    sampler_ptr acquire(const llama_model* model, const common_params_sampling& params, const std::string& key);
+
+    // Keeps `sampler` for a later request with the same key, evicting the least recently
+    // released one beyond CAPACITY.
+    void release(std::string key, sampler_ptr sampler);
+
+    void clear();
+
+private:
+    std::mutex mutex_;
+    std::list<std::pair<std::string, sampler_ptr>> idle_; // front = most recently released
+};
+
+// Everything that makes two samplers interchangeable: the numeric settings, seed, grammar
+// (the request's GBNF, hashed), triggers, preserved tokens and reasoning budget.
+std::string sampler_cache_key(const common_params_sampling& params, const std::string& grammar);
+
+// Puts a sampler for `params` (built by build_sampling_params from `options`) into
+// state.sampler, from rn_ctx->sampler_cache when present, and records its cache key.
+// Returns false if no sampler could be built.
+bool acquire_sampler(rn_llama_context* rn_ctx,
+                     completion_state& state,
+                     const common_params_sampling& params,
+                     const CompletionOptions& options);
+
+// Hands state.sampler back to rn_ctx->sampler_cache once the request is done with it.
+void release_sampler(rn_llama_context* rn_ctx, completion_state& state);
+
+// Seeds a fresh or reset sampler (as returned by acquire_sampler) with the prompt,
+// without advancing the grammar. Only the tail the history-based samplers can see
+// (repetition/DRY windows, n_prev) is replayed; the whole prompt when a window is
+// unbounded or a reasoning budget must find its start tag.
+void prime_sampler(common_sampler* sampler,
+                   const common_params_sampling& params,
+                   const std::vector<llama_token>& prompt);
+
+// Resolves the effective sampling params for one request: initLlama defaults
+// (params.sampling, including GGUF-embedded values) plus per-request overrides,
+// grammar, preserved tokens and reasoning budget from CompletionOptions.
+common_params_sampling build_sampling_params(
+    const rn_llama_context* rn_ctx,
+    const CompletionOptions& options);
+
+// Resolves n_predict: request value, then initLlama value, then -1 (unlimited).
+int resolve_n_predict(const rn_llama_context* rn_ctx, const CompletionOptions& options);
+
+// Turns options.max_time_ms / first_token_deadline_ms into absolute deadlines on `state`,
+// counted from options.t_request (now when unset).
+void set_deadlines(completion_state& state, const CompletionOptions& options);
+
+// True once the total deadline has passed, or the first-token deadline before any token
+// was decoded; then ends generation (has_next_token = false) with stopped_by_time.
+bool deadline_passed(completion_state& state);
+
+// Pre-reserves generated_text / generated_tokens for the expected response length.
+void reserve_generation_buffers(completion_state& state);
+
+// Handles a token that has already been sampled, appended to state.generated_text
+// and decoded: EOG, stop strings, n_predict limit and streaming with partial-stop
+// and incomplete-UTF-8 holdback. Returns false when generation for this state must end.
+bool process_generated_token(
+    completion_state& state,
+    llama_token token_id,
+    std::string_view token_text,
+    const CompletionOptions& options,
+    const std::function<bool(const std::string&, bool)>& callback);
+
+// Generation is over: drops an incomplete trailing UTF-8 sequence from generated_text
+// and sends any text not yet streamed to the callback.
+void flush_unsent_text(
+    completion_state& state,
+    const std::function<bool(const std::string&, bool)>& callback);
+
+} // namespace facebook::react
@@ -12,9 +12,13 @@
 
 #include "rn-utils.h"
 #include "rn-multimodal.h"
+#include "rn-piece-table.h"
 
 #include <atomic>
 #include <functional>
+#include <list>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <set>
@@ -23,6 +27,11 @@
 
 namespace facebook::react {
 
+class rn_batch_scheduler;
+class rn_prefix_cache;
+class rn_priority_gate;
+class rn_sampler_cache;
+
 // Extend common_params with additional fields needed by our implementation
 struct rn_common_params : common_params {
     bool debug = false;
@@ -37,14 +46,46 @@ struct rn_common_params : common_params {
     int reasoning_budget = 0;
 
     // Cooperative prompt-ingestion loop settings (set at initLlama time).
-    // chunk_size: tokens per llama_decode call during prompt encoding (distinct from n_batch).
+    // chunk_size: initial tokens per llama_decode call during prompt encoding (distinct from n_batch).
+    // ingest_budget_ms: target compute per chunk; chunks are resized from measured decode
+    //   time (0 = always use chunk_size).
     // is_cpu_only: when true, sleep 2ms after each chunk.
-    // prompt_chunk_gap_ms: minimum inter-chunk gap on GPU path.
+    // prompt_chunk_gap_ms: inter-chunk sleep on GPU path.
     int  chunk_size          = 128;
+    int  ingest_budget_ms    = 12;
     bool is_cpu_only         = false;
     int  prompt_chunk_gap_ms = 5;
+
+    // Continuous batching: number of scheduler slots (initLlama n_parallel).
+    // 1 = no scheduler; requests are serialized on seq 0 as before.
+    int n_parallel_requests = 1;
+
+    // Speculative decoding with a draft model (initLlama draft_model).
+    // draft_n_max: max tokens drafted per target pass.
+    // draft_p_min: stop drafting once the draft's top token probability drops below this.
+    int   draft_n_max = 8;
+    float draft_p_min = 0.75f;
+
+    // In-RAM prefix cache budget for seq 0 snapshots (initLlama prefix_cache_mb). 0 = off.
+    size_t prefix_cache_bytes = 0;
+
+    // Shared system prompt / tools prefix in an extra sequence (initLlama shared_prefix).
+    bool shared_prefix = false;
 };
 
+// Upper bound on tokens proposed per speculative verify pass (draft model or prompt
+// lookup). spec_batch is sized for this plus the sampled token.
+constexpr int RN_MAX_DRAFT_TOKENS = 32;
+
+// Upper bound on completion `n` (independent choices sharing one prompt prefill).
+constexpr int RN_MAX_CHOICES = 16;
+
+// Upper bound on completion beam_width.
+constexpr int RN_MAX_BEAMS = 8;
+
+// Upper bound on completion `logprobs` (alternatives recorded per generated token).
+constexpr int RN_MAX_LOGPROBS = 20;
+
 // Main context structure for React Native integration
 struct rn_llama_context {
     // Model parameters - use our extended params structure
@@ -54,6 +95,7 @@ struct rn_llama_context {
     llama_model* model = nullptr;
     llama_context* ctx = nullptr;
     const llama_vocab* vocab = nullptr;
+    rn_piece_table pieces;   // text of every token, built with vocab (see rn-piece-table.h)
 
     // Extensions
     std::vector<common_adapter_lora_info> lora_adapters;
@@ -79,20 +121,51 @@ struct rn_llama_context {
     // and calls llama_set_n_threads before the next llama_decode. -1 = no change pending.
     std::atomic<int> requested_n_threads{-1};
 
+    // Set by setAppState when the app is backgrounded or idle: prompt ingestion then runs
+    // n_batch-sized chunks without yielding, since no frames are waiting on the CPU/GPU.
+    std::atomic<bool> ingest_full_speed{false};
+
+    // Exact token sequence whose KV currently lives in seq 0, one entry per position.
+    // run_completion diffs each new prompt against it and re-encodes only the suffix
+    // after the longest common prefix. Anything else that writes seq 0 must go through
+    // rn_clear_sequence(rn_ctx, 0), which empties it.
+    std::vector<llama_token> kv_tokens;
+
+    // Leading seq 0 positions whose KV cells other sequences may share (an attached shared
+    // prefix, a preempted request's parked copy). Shared cells have one position for all
+    // their sequences, so context shift never discards or moves them. Only ever lowered by
+    // run_completion's prefix reuse; rn_clear_sequence(rn_ctx, 0) resets it.
+    size_t kv_shared_len = 0;
+
+    // Snapshots of earlier seq 0 contents for multi-conversation prefix reuse.
+    // Null when prefix_cache_bytes == 0.
+    std::shared_ptr<rn_prefix_cache> prefix_cache;
+
+    // Idle samplers of finished requests, reused by requests with the same effective
+    // sampling params and grammar (see rn-completion.h).
+    std::shared_ptr<rn_sampler_cache> sampler_cache;
+
     // KV cache prefix reuse state (guarded by mutex).
     // Stores the token boundary after each message so the next call can skip re-encoding
     // messages whose IDs haven't changed. IDs are supplied by the caller per message.
     struct kv_msg_entry {
         std::string id;         // caller-supplied message ID
-        int32_t     token_end;  // exclusive token index after this message in the KV cache
+        // Exclusive token index of the end of this message's content in the KV cache, i.e.
+        // before the template's end-of-turn text. Both boundary paths in run_chat_completion
+        // (marked render, per-prefix renders) use this convention, so a span between two
+        // boundaries is always: previous end-of-turn, this message's header and content.
+        int32_t     token_end;
     };
     std::vector<kv_msg_entry> kv_messages;
     bool                      kv_has_messages = false;
     std::string               kv_render_identity;
+    // IDs of messages a context shift evicted whole from seq 0. They are left out of
+    // later renders of the conversation so the prompt keeps matching the shifted KV.
+    std::set<std::string>     kv_evicted_ids;
 
-    // Completion cache: stores the resolved sampling params and grammar state from the last
-    // run_chat_completion call. When prompt_id and config_id both match on the next call,
-    // the expensive common_chat_templates_apply step is skipped entirely.
+    // Completion cache: the caller-supplied prompt_id / config_id of the last
+    // run_chat_completion call with the grammar state it resolved. A prompt_id change
+    // invalidates seq 0; the resolved state is persisted with sessions.
     struct completion_cache_entry {
         std::string                          prompt_id;
         std::string                          config_id;
@@ -104,21 +177,125 @@ struct rn_llama_context {
     };
     std::optional<completion_cache_entry> completion_cache;
 
+    // Everything above that describes seq 0, set aside together with its KV while another
+    // conversation uses seq 0 (preemption, chat sessions). See rn_take_seq0_state.
+    struct seq0_state {
+        std::vector<llama_token>              kv_tokens;
+        size_t                                kv_shared_len = 0;
+        std::vector<kv_msg_entry>             kv_messages;
+        bool                                  kv_has_messages = false;
+        std::string                           kv_render_identity;
+        std::set<std::string>                 kv_evicted_ids;
+        std::optional<completion_cache_entry> completion_cache;
+    };
+
+    // In-memory chat sessions (see rn-session.h). The conversation in seq 0 is
+    // active_session's; every other session keeps its KV in its own pooled sequence and
+    // its seq0_state in `parked`. An evicted session keeps its sequence but holds no KV.
+    // The map is guarded by mutex; the entries and active_session only change under the
+    // inference gate.
+    struct chat_session {
+        llama_seq_id seq_id    = -1;
+        seq0_state   parked;         // empty while the session is active or evicted
+        uint64_t     last_used = 0;  // session_clock at the last activation
+    };
+    std::map<int32_t, chat_session> sessions;
+    int32_t  active_session  = 0;  // 0 = the unnamed conversation
+    int32_t  next_session_id = 1;
+    uint64_t session_clock   = 0;
+
+    // Everything a chat template render produces apart from the prompt: grammar, triggers,
+    // stops, thinking tags, the single-token ids of preserved_tokens and the loaded PEG
+    // parser. Keyed by a hash of the render inputs minus the messages (template, tools,
+    // tool_choice, grammar); see chat_artifact_key in rn-completion.cpp. Immutable once
+    // cached except pure_render_ok, which like the cache list is guarded by mutex.
+    struct chat_artifacts {
+        common_chat_params                       params;        // prompt left empty
+        std::set<llama_token>                    preserved_ids;
+        std::optional<common_chat_parser_params> parser;        // set when tools are present
+        std::string                              parser_error;  // parser.load failure
+        // Per message shape (see message_shape): whether a force_pure_content render,
+        // which skips grammar generation, yields the same prompt as the full render.
+        std::map<uint32_t, bool>                 pure_render_ok;
+    };
+    static constexpr size_t CHAT_ARTIFACT_CACHE_SIZE = 8;
+    std::list<std::pair<uint64_t, std::shared_ptr<chat_artifacts>>> chat_artifact_cache; // front = MRU
+
     // Reused decode batches to avoid per-request alloc/free churn.
     llama_batch gen_batch = {};
     llama_batch ingest_batch = {};
+    llama_batch spec_batch = {};   // speculative verify batch (RN_MAX_DRAFT_TOKENS + 1)
     bool batches_initialized = false;
+
+    // Sequence pool. Sized to n_seq_max at initLlama time; seq 0 is always reserved for
+    // the legacy single-request path (completion, embedding, multimodal).
+    // seq_mutex is a leaf lock: never acquire another mutex while holding it.
+    std::mutex        seq_mutex;
+    std::vector<bool> seq_in_use;
+
+    // Shared system prompt / tools prefix (see rn-shared-prefix.h). Its KV lives in a
+    // reserved sequence; seq_id is -1 when initLlama shared_prefix is off. prompt_id and
+    // tokens are guarded by mutex; the sequence only changes under the inference gate.
+    struct shared_prefix_entry {
+        llama_seq_id             seq_id = -1;
+        std::string              prompt_id;
+        std::vector<llama_token> tokens;  // empty until a request with a prompt_id stored one
+        uint64_t                 n_attached = 0;
+    };
+    shared_prefix_entry shared_prefix;
+
+    // Continuous batching scheduler (owned by LlamaCppModel). Null when n_parallel <= 1.
+    rn_batch_scheduler* scheduler = nullptr;
+
+    // Inference gate (owned by LlamaCppModel). run_completion polls it at prefill-chunk
+    // and token boundaries to let higher-priority requests preempt a seq 0 completion.
+    rn_priority_gate* gate = nullptr;
+
+    // Speculative decoding draft model. Shares the target vocabulary; its single-sequence
+    // context mirrors target seq 0 and draft_cache records which tokens its KV holds.
+    common_init_result_ptr   draft_init;   // owns draft model + context
+    llama_model*             draft_model = nullptr;
+    llama_context*           draft_ctx   = nullptr;
+    std::vector<llama_token> draft_cache;
+    llama_batch              draft_batch = {}; // draft prefill / greedy step (n_batch)
+    bool                     draft_loaded = false;
 };
 
+// Sequence pool helpers. rn_acquire_seq returns -1 when every non-zero sequence is taken.
+llama_seq_id rn_acquire_seq(rn_llama_context* rn_ctx);
+void rn_release_seq(rn_llama_context* rn_ctx, llama_seq_id seq_id);
+
+// Drops the KV entries of one sequence. On single-sequence contexts this is a full
+// llama_memory_clear (which also resets recurrent state). Clearing seq 0 also empties
+// kv_tokens and kv_shared_len.
+void rn_clear_sequence(rn_llama_context* rn_ctx, llama_seq_id seq_id);
+
+// llama_decode on rn_ctx->ctx. When the unified KV cache is full (1) it frees idle
+// scheduler slots in LRU order (rn_batch_scheduler::evict_idle_slot) and retries before
+// returning. Call with the inference gate held.
+int rn_decode(rn_llama_context* rn_ctx, const llama_batch& batch);
+
+// Seq 0 bookkeeping. rn_copy_seq0_state snapshots it; rn_take_seq0_state also resets it
+// to an empty seq 0 (the caller clears the KV); rn_put_seq0_state installs a snapshot
+// whose KV the caller has just placed in seq 0.
+rn_llama_context::seq0_state rn_copy_seq0_state(rn_llama_context* rn_ctx);
+rn_llama_context::seq0_state rn_take_seq0_state(rn_llama_context* rn_ctx);
+void rn_put_seq0_state(rn_llama_context* rn_ctx, rn_llama_context::seq0_state state);
+
 // Core completion functions
 CompletionResult run_completion(
     rn_llama_context* rn_ctx,
     const CompletionOptions& options,
     std::function<bool(const std::string&, bool)> callback);
 
+// Receives the delta events of one streamed chunk (a JSON array) right before the chunk
+// itself reaches the streaming callback. Only called when options.stream_deltas is set.
+using rn_delta_callback = std::function<void(const json&)>;
+
 CompletionResult run_chat_completion(
     rn_llama_context* rn_ctx,
     const CompletionOptions& options,
-    std::function<bool(const std::string&, bool)> callback);
+    std::function<bool(const std::string&, bool)> callback,
+    rn_delta_callback on_deltas = nullptr);
 
 } // namespace facebook::react
\ No newline at end of file
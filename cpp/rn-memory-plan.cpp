@@ -0,0 +1,208 @@
+#include "rn-memory-plan.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <string>
+
+namespace facebook::react {
+
+namespace {
+
+struct kv_option {
+    ggml_type             type_k;
+    ggml_type             type_v;
+    llama_flash_attn_type flash_attn; // a quantized V cache requires flash attention
+};
+
+constexpr std::array<kv_option, 3> KV_OPTIONS = {{
+    {GGML_TYPE_F16,  GGML_TYPE_F16,  LLAMA_FLASH_ATTN_TYPE_AUTO},
+    {GGML_TYPE_Q8_0, GGML_TYPE_Q8_0, LLAMA_FLASH_ATTN_TYPE_ENABLED},
+    {GGML_TYPE_Q4_0, GGML_TYPE_Q4_0, LLAMA_FLASH_ATTN_TYPE_ENABLED},
+}};
+
+constexpr std::array<int, 3> UBATCH_OPTIONS = {{512, 256, 128}};
+
+int64_t row_bytes(ggml_type type, int64_t n) {
+    return n * static_cast<int64_t>(ggml_type_size(type)) / ggml_blck_size(type);
+}
+
+int32_t meta_int(const llama_model* model, const std::string& key, int32_t fallback) {
+    char buf[32] = {0};
+    if (llama_model_meta_val_str(model, key.c_str(), buf, sizeof(buf)) > 0) {
+        char* end = nullptr;
+        const long v = std::strtol(buf, &end, 10);
+        if (end && end != buf && v > 0) {
+            return static_cast<int32_t>(v);
+        }
+    }
+    return fallback;
+}
+
+} // namespace
+
+rn_model_dims rn_read_model_dims(const llama_model* model) {
+    rn_model_dims d;
+    d.n_layer     = llama_model_n_layer(model);
+    d.n_embd      = llama_model_n_embd(model);
+    d.n_head      = llama_model_n_head(model);
+    d.n_head_kv   = llama_model_n_head_kv(model);
+    d.n_vocab     = llama_vocab_n_tokens(llama_model_get_vocab(model));
+    d.n_ctx_train = llama_model_n_ctx_train(model);
+    d.recurrent   = llama_model_is_recurrent(model);
+
+    // Head sizes default to n_embd / n_head, as in llama.cpp's hparams loader.
+    char arch[64] = {0};
+    const int32_t head = d.n_head > 0 ? d.n_embd / d.n_head : 0;
+    if (llama_model_meta_val_str(model, "general.architecture", arch, sizeof(arch)) > 0) {
+        d.n_embd_head_k = meta_int(model, std::string(arch) + ".attention.key_length", head);
+        d.n_embd_head_v = meta_int(model, std::string(arch) + ".attention.value_length", head);
+    } else {
+        d.n_embd_head_k = head;
+        d.n_embd_head_v = head;
+    }
+    return d;
+}
+
+rn_memory_plan rn_plan_memory(const rn_model_dims& dims,
+                              int64_t weights_bytes,
+                              int64_t available_bytes,
+                              int max_ctx,
+                              int n_seq_max,
+                              const rn_plan_fixed& fixed) {
+    int cap = max_ctx;
+    if (cap <= 0) {
+        cap = dims.n_ctx_train > 0 ? std::min(dims.n_ctx_train, RN_PLAN_MAX_CTX) : RN_PLAN_MAX_CTX;
+    }
+    cap = std::max(cap, RN_PLAN_MIN_CTX);
+
+    const int64_t headroom = std::max(RN_PLAN_MIN_HEADROOM, available_bytes * RN_PLAN_HEADROOM_PCT / 100);
+    const int64_t room     = available_bytes - weights_bytes - headroom;
+
+    // The caller's explicit settings replace the planner's in every option. Without a
+    // fixed flash_attn, a quantized V cache gets it forced on as before.
+    auto constrain = [&](const kv_option& kv, bool& usable) {
+        kv_option c = kv;
+        if (fixed.cache_type_k_set) {
+            c.type_k = fixed.cache_type_k;
+        }
+        if (fixed.cache_type_v_set) {
+            c.type_v = fixed.cache_type_v;
+        }
+        if (fixed.flash_attn_set) {
+            c.flash_attn = fixed.flash_attn;
+        } else {
+            c.flash_attn = c.type_v == GGML_TYPE_F16 ? LLAMA_FLASH_ATTN_TYPE_AUTO : LLAMA_FLASH_ATTN_TYPE_ENABLED;
+        }
+        usable = fixed.cache_type_v_set || c.type_v == GGML_TYPE_F16 ||
+                 c.flash_attn != LLAMA_FLASH_ATTN_TYPE_DISABLED;
+        return c;
+    };
+
+    struct candidate {
+        kv_option        kv            = KV_OPTIONS.front();
+        int              n_ubatch      = 0;
+        int              n_ctx         = 0;
+        int64_t          kv_per_token  = 0;
+        int64_t          fixed_compute = 0;
+        int64_t          ctx_compute   = 0; // per context token
+    };
+
+    auto evaluate = [&](const kv_option& kv, int n_ubatch) {
+        candidate c;
+        c.kv       = kv;
+        c.n_ubatch = n_ubatch;
+        if (!dims.recurrent) {
+            c.kv_per_token = static_cast<int64_t>(dims.n_layer) * dims.n_head_kv *
+                (row_bytes(kv.type_k, dims.n_embd_head_k) + row_bytes(kv.type_v, dims.n_embd_head_v));
+        }
+        c.fixed_compute = (static_cast<int64_t>(n_ubatch) * (dims.n_vocab + 10LL * dims.n_embd) +
+                           static_cast<int64_t>(std::max(1, n_seq_max)) * dims.n_vocab) * 4;
+        // flash_attn AUTO may resolve to off, so only a forced one drops the KQ scores.
+        if (kv.flash_attn != LLAMA_FLASH_ATTN_TYPE_ENABLED) {
+            c.ctx_compute = 2LL * n_ubatch * dims.n_head * 4;
+        }
+        const int64_t per_ctx = c.kv_per_token + c.ctx_compute;
+        const int64_t left    = room - c.fixed_compute;
+        if (left <= 0) {
+            c.n_ctx = 0;
+        } else if (per_ctx == 0 || left / per_ctx >= cap) {
+            c.n_ctx = cap;
+        } else {
+            c.n_ctx = static_cast<int>(left / per_ctx) / RN_PLAN_CTX_ALIGN * RN_PLAN_CTX_ALIGN;
+        }
+        return c;
+    };
+
+    candidate chosen;
+    bool      front_usable = false;
+    kv_option smallest     = constrain(KV_OPTIONS.front(), front_usable); // f16 V: always usable
+    for (const auto& option : KV_OPTIONS) {
+        bool usable = false;
+        const kv_option kv = constrain(option, usable);
+        if (!usable) {
+            continue;
+        }
+        smallest = kv;
+        candidate best;
+        for (int n_ubatch : UBATCH_OPTIONS) {
+            // A smaller ubatch slows prompt ingestion; step down only for an eighth more context.
+            candidate c = evaluate(kv, n_ubatch);
+            if (c.n_ctx > best.n_ctx + best.n_ctx / 8) {
+                best = c;
+            }
+        }
+        if (best.n_ctx > chosen.n_ctx) {
+            chosen = best;
+        }
+        if (chosen.n_ctx >= cap) {
+            break;
+        }
+    }
+
+    rn_memory_plan plan;
+    plan.fits = available_bytes > 0 && chosen.n_ctx >= RN_PLAN_MIN_CTX;
+    if (!plan.fits) {
+        // Best effort: the smallest footprint the planner knows of.
+        plan.reason = available_bytes <= 0
+            ? "available memory could not be determined"
+            : "even " + std::to_string(RN_PLAN_MIN_CTX) + " tokens of context do not fit";
+        chosen       = evaluate(smallest, UBATCH_OPTIONS.back());
+        chosen.n_ctx = RN_PLAN_MIN_CTX;
+    }
+
+    plan.n_ctx              = chosen.n_ctx;
+    plan.n_ubatch           = chosen.n_ubatch;
+    plan.n_batch            = std::max(512, chosen.n_ubatch);
+    plan.cache_type_k       = chosen.kv.type_k;
+    plan.cache_type_v       = chosen.kv.type_v;
+    plan.flash_attn         = chosen.kv.flash_attn;
+    plan.available_bytes    = available_bytes;
+    plan.weights_bytes      = weights_bytes;
+    plan.kv_bytes_per_token = chosen.kv_per_token;
+    plan.kv_bytes           = chosen.kv_per_token * plan.n_ctx;
+    plan.compute_bytes      = chosen.fixed_compute + chosen.ctx_compute * plan.n_ctx;
+    plan.headroom_bytes     = headroom;
+    return plan;
+}
+
+const char* rn_kv_cache_type_name(ggml_type type) {
+    switch (type) {
+        case GGML_TYPE_F16:  return "f16";
+        case GGML_TYPE_Q8_0: return "q8_0";
+        case GGML_TYPE_Q4_0: return "q4_0";
+        default:             return ggml_type_name(type);
+    }
+}
+
+bool rn_kv_cache_type_from_name(const std::string& name, ggml_type& type) {
+    for (ggml_type t : {GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0}) {
+        if (name == rn_kv_cache_type_name(t)) {
+            type = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace facebook::react
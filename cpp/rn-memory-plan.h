@@ -0,0 +1,93 @@
+#pragma once
+
+// Memory-budget planner: picks n_ctx, KV cache types, flash attention and batch sizes so
+// a model fits the memory the process can still use.
+//
+// The estimate follows what llama.cpp allocates:
+//   weights  — GGUF file sizes (model + mmproj), counted as fully resident
+//   kv       — n_ctx * n_layer * n_head_kv * (k_len * size(type_k) + v_len * size(type_v))
+//   compute  — n_ubatch * (n_vocab + 10 * n_embd) * 4 for the reserved output logits and
+//              activations, n_seq_max logits rows, and without flash attention the KQ
+//              scores plus their softmax, 2 * n_ctx * n_ubatch * n_head * 4
+//   headroom — max(RN_PLAN_MIN_HEADROOM, RN_PLAN_HEADROOM_PCT of available) for the app
+//              and allocator slack
+// Sliding-window layers are costed as full-context layers, so SWA models are planned
+// conservatively. Recurrent models have no per-token KV and get their full n_ctx cap.
+
+#include "llama.h"
+
+#include <cstdint>
+#include <string>
+
+namespace facebook::react {
+
+constexpr int     RN_PLAN_MIN_CTX       = 512;
+constexpr int     RN_PLAN_MAX_CTX       = 32768; // default cap, below n_ctx_train
+constexpr int     RN_PLAN_CTX_ALIGN     = 256;
+constexpr int64_t RN_PLAN_MIN_HEADROOM  = 256LL * 1024 * 1024;
+constexpr int     RN_PLAN_HEADROOM_PCT  = 15;
+
+// Shape of a model as far as memory is concerned; read from GGUF hparams, so a
+// vocab_only load is enough.
+struct rn_model_dims {
+    int32_t n_layer       = 0;
+    int32_t n_embd        = 0;
+    int32_t n_head        = 0;
+    int32_t n_head_kv     = 0;
+    int32_t n_embd_head_k = 0;
+    int32_t n_embd_head_v = 0;
+    int32_t n_vocab       = 0;
+    int32_t n_ctx_train   = 0;
+    bool    recurrent     = false;
+};
+
+rn_model_dims rn_read_model_dims(const llama_model* model);
+
+struct rn_memory_plan {
+    int       n_ctx        = RN_PLAN_MIN_CTX;
+    int       n_batch      = 512;
+    int       n_ubatch     = 512;
+    ggml_type cache_type_k = GGML_TYPE_F16;
+    ggml_type cache_type_v = GGML_TYPE_F16;
+    llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO; // ENABLED for quantized V
+    bool      fits         = false; // false: even RN_PLAN_MIN_CTX exceeds the budget
+    std::string reason;               // why fits is false; empty when it fits
+
+    int64_t available_bytes    = 0;
+    int64_t weights_bytes      = 0;
+    int64_t kv_bytes           = 0;
+    int64_t compute_bytes      = 0;
+    int64_t headroom_bytes     = 0;
+    int64_t kv_bytes_per_token = 0;
+};
+
+// Settings the caller chose explicitly. The planner keeps them as they are and only
+// picks the others.
+struct rn_plan_fixed {
+    bool      cache_type_k_set = false;
+    ggml_type cache_type_k     = GGML_TYPE_F16;
+    bool      cache_type_v_set = false;
+    ggml_type cache_type_v     = GGML_TYPE_F16;
+    bool      flash_attn_set   = false;
+    llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+};
+
+// Largest context up to max_ctx (0 = min(n_ctx_train, RN_PLAN_MAX_CTX)) that fits
+// available_bytes. KV types are tried from f16 to q8_0 to q4_0: the first that reaches
+// the cap wins, otherwise the one giving the most context. A smaller ubatch is only taken
+// when it buys an eighth more context (without flash attention the KQ scores grow with both).
+// A K or V type or flash attention setting in `fixed` replaces the planner's choice in
+// every candidate; a quantized V the planner would pick is skipped when flash attention is
+// fixed off. available_bytes <= 0 (unknown) never fits.
+rn_memory_plan rn_plan_memory(const rn_model_dims& dims,
+                              int64_t weights_bytes,
+                              int64_t available_bytes,
+                              int max_ctx = 0,
+                              int n_seq_max = 1,
+                              const rn_plan_fixed& fixed = {});
+
+// KV cache types accepted by initLlama's cache_type_k / cache_type_v.
+const char* rn_kv_cache_type_name(ggml_type type);
+bool rn_kv_cache_type_from_name(const std::string& name, ggml_type& type);
+
+} // namespace facebook::react
@@ -70,6 +70,21 @@ std::vector<MediaItem> extract_media_from_messages(
     return items;
 }
 
+bool messages_contain_media(const json& messages_json) {
+    if (!messages_json.is_array()) return false;
+    for (const auto& msg : messages_json) {
+        if (!msg.is_object() || !msg.contains("content")) continue;
+        const auto& content = msg["content"];
+        if (!content.is_array()) continue;
+        for (const auto& part : content) {
+            if (!part.is_object()) continue;
+            std::string type = part.value("type", "");
+            if (type == "image_url" || type == "audio_url") return true;
+        }
+    }
+    return false;
+}
+
 mtmd_bitmap* load_bitmap_from_uri(mtmd_context* ctx, const std::string& url) {
     mtmd_helper_bitmap_wrapper wrapper{nullptr, nullptr};
     if (url.size() >= 7 && url.substr(0, 7) == "file://") {
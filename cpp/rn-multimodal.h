@@ -62,6 +62,9 @@ std::vector<MediaItem> extract_media_from_messages(
     json& messages_json,
     const std::string& marker = "<__media__>");
 
+// Non-mutating check: true if any message has an image_url/audio_url content part.
+bool messages_contain_media(const json& messages_json);
+
 // ---- Bitmap loaders ------------------------------------------------------
 // Load a bitmap from file:// URI, data: URI, or plain file path.
 // Returns nullptr on failure. Caller must call mtmd_bitmap_free().
@@ -0,0 +1,53 @@
+#include "rn-piece-table.h"
+
+#include <cstring>
+
+namespace facebook::react {
+
+bool rn_piece_table::build(const llama_vocab* vocab) {
+    arena_.clear();
+    offsets_.clear();
+    if (!vocab) {
+        return false;
+    }
+
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+    offsets_.reserve(static_cast<size_t>(n_vocab) + 1);
+    arena_.reserve(static_cast<size_t>(n_vocab) * 8); // typical BPE average is < 8 bytes
+
+    std::string buf(64, '\0');
+    offsets_.push_back(0);
+    for (llama_token t = 0; t < n_vocab; t++) {
+        int32_t n = llama_token_to_piece(vocab, t, buf.data(), static_cast<int32_t>(buf.size()), 0, true);
+        if (n < 0) {
+            buf.resize(static_cast<size_t>(-n));
+            n = llama_token_to_piece(vocab, t, buf.data(), static_cast<int32_t>(buf.size()), 0, true);
+        }
+        if (n < 0) {
+            arena_.clear();
+            offsets_.clear();
+            return false;
+        }
+        arena_.append(buf.data(), static_cast<size_t>(n));
+        offsets_.push_back(static_cast<uint32_t>(arena_.size()));
+    }
+    arena_.shrink_to_fit();
+    return true;
+}
+
+std::string rn_piece_table::detokenize(const llama_token* tokens, size_t n_tokens) const {
+    size_t total = 0;
+    for (size_t i = 0; i < n_tokens; i++) {
+        total += piece(tokens[i]).size();
+    }
+    std::string text(total, '\0');
+    char* out = text.data();
+    for (size_t i = 0; i < n_tokens; i++) {
+        const std::string_view p = piece(tokens[i]);
+        std::memcpy(out, p.data(), p.size());
+        out += p.size();
+    }
+    return text;
+}
+
+} // namespace facebook::react
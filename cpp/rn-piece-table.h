@@ -0,0 +1,47 @@
+#pragma once
+
+// Vocabulary-wide token → text table, built once at model load.
+//
+// common_token_to_piece allocates a std::string per call. The generation loops,
+// detokenize and tokenize(with_pieces) call it once per token. The table renders
+// every token once (special tokens included, matching common_token_to_piece's default)
+// into one contiguous byte arena, indexed by an offset array. A lookup is then a
+// string_view into the arena, and detokenizing is a gather of memcpy's.
+//
+// Immutable after build(), so it is read without locking from every thread.
+
+#include "llama.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace facebook::react {
+
+class rn_piece_table {
+public:
+    // Renders every token of `vocab`. Returns false (leaving the table empty) if
+    // llama_token_to_piece fails for any token.
+    bool build(const llama_vocab* vocab);
+
+    // Text of `token`; empty for ids outside the vocabulary.
+    std::string_view piece(llama_token token) const {
+        if (token < 0 || static_cast<size_t>(token) + 1 >= offsets_.size()) {
+            return {};
+        }
+        return std::string_view(arena_.data() + offsets_[token], offsets_[token + 1] - offsets_[token]);
+    }
+
+    // Concatenated text of `tokens`, sized in one pass and copied in a second.
+    std::string detokenize(const llama_token* tokens, size_t n_tokens) const;
+
+    [[nodiscard]] size_t n_tokens() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+    [[nodiscard]] size_t bytes() const { return arena_.size() + offsets_.size() * sizeof(uint32_t); }
+
+private:
+    std::string           arena_;
+    std::vector<uint32_t> offsets_; // n_tokens + 1 entries; piece t is [offsets_[t], offsets_[t + 1])
+};
+
+} // namespace facebook::react
@@ -0,0 +1,184 @@
+#include "rn-prefix-cache.h"
+// Suppress unused function warnings from llama.cpp headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "common.h"
+#include "llama.h"
+#pragma GCC diagnostic pop
+
+#include <algorithm>
+#include <iterator>
+
+namespace facebook::react {
+
+rn_prefix_cache::rn_prefix_cache(size_t budget_bytes)
+    : budget_bytes_(budget_bytes) {}
+
+std::vector<uint64_t> rn_prefix_cache::hash_blocks(const std::vector<llama_token>& tokens, size_t n_max) {
+    // FNV-1a, chained: block k's hash covers tokens [0, (k + 1) * PREFIX_BLOCK), so equal
+    // hashes mean equal prefixes (modulo collisions, which restore() re-checks).
+    const size_t n_blocks = std::min(n_max, tokens.size()) / PREFIX_BLOCK;
+    std::vector<uint64_t> hashes;
+    hashes.reserve(n_blocks);
+    uint64_t h = 14695981039346656037ull;
+    for (size_t b = 0; b < n_blocks; b++) {
+        const auto* p = reinterpret_cast<const uint8_t*>(tokens.data() + b * PREFIX_BLOCK);
+        for (size_t i = 0; i < PREFIX_BLOCK * sizeof(llama_token); i++) {
+            h ^= p[i];
+            h *= 1099511628211ull;
+        }
+        hashes.push_back(h);
+    }
+    return hashes;
+}
+
+void rn_prefix_cache::erase(entry_list::iterator it) {
+    for (uint64_t h : it->block_hashes) {
+        auto range = by_block_.equal_range(h);
+        for (auto m = range.first; m != range.second; ++m) {
+            if (m->second == it->id) {
+                by_block_.erase(m);
+                break;
+            }
+        }
+    }
+    bytes_ -= it->bytes;
+    by_id_.erase(it->id);
+    lru_.erase(it);
+}
+
+void rn_prefix_cache::touch(entry_list::iterator it) {
+    lru_.splice(lru_.begin(), lru_, it);
+}
+
+void rn_prefix_cache::store(llama_context* ctx, const std::vector<llama_token>& tokens) {
+    if (budget_bytes_ == 0 || tokens.size() < PREFIX_BLOCK) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = lru_.begin(); it != lru_.end(); ++it) {
+            if (it->tokens.size() >= tokens.size() &&
+                std::equal(tokens.begin(), tokens.end(), it->tokens.begin())) {
+                touch(it); // an entry already covers this sequence
+                return;
+            }
+        }
+    }
+
+    const size_t n_state = llama_state_seq_get_size(ctx, 0);
+    const size_t bytes   = n_state + tokens.size() * sizeof(llama_token);
+    if (n_state == 0 || bytes > budget_bytes_) {
+        return;
+    }
+
+    entry e;
+    e.state.resize(n_state);
+    if (llama_state_seq_get_data(ctx, e.state.data(), n_state, 0) != n_state) {
+        return;
+    }
+    e.tokens       = tokens;
+    e.block_hashes = hash_blocks(tokens, tokens.size());
+    e.bytes        = bytes;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Entries that are a prefix of the new one are now redundant.
+    for (auto it = lru_.begin(); it != lru_.end(); ) {
+        auto next = std::next(it);
+        if (it->tokens.size() <= tokens.size() &&
+            std::equal(it->tokens.begin(), it->tokens.end(), tokens.begin())) {
+            erase(it);
+        }
+        it = next;
+    }
+    while (!lru_.empty() && bytes_ + bytes > budget_bytes_) {
+        erase(std::prev(lru_.end()));
+    }
+
+    e.id = next_id_++;
+    lru_.push_front(std::move(e));
+    auto it = lru_.begin();
+    by_id_[it->id] = it;
+    for (uint64_t h : it->block_hashes) {
+        by_block_.emplace(h, it->id);
+    }
+    bytes_ += bytes;
+}
+
+size_t rn_prefix_cache::restore(rn_llama_context* rn_ctx,
+                                const std::vector<llama_token>& prompt,
+                                size_t n_current) {
+    // At least one prompt token is always re-encoded for logits.
+    const size_t n_reuse_max = prompt.empty() ? 0 : prompt.size() - 1;
+    if (budget_bytes_ == 0 || n_current + PREFIX_BLOCK > n_reuse_max) {
+        return n_current; // cannot gain a whole block
+    }
+    const std::vector<uint64_t> hashes = hash_blocks(prompt, n_reuse_max);
+
+    entry_list::iterator best = lru_.end();
+    size_t best_len = n_current;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Longest block first; the first verified match is the best block-aligned one,
+        // the exact common prefix may extend past it.
+        for (size_t k = hashes.size(); k-- > 0 && (k + 1) * PREFIX_BLOCK > best_len; ) {
+            auto range = by_block_.equal_range(hashes[k]);
+            for (auto m = range.first; m != range.second; ++m) {
+                auto it = by_id_.at(m->second);
+                const size_t len = std::min(common_lcp(it->tokens, prompt), n_reuse_max);
+                if (len > best_len) {
+                    best     = it;
+                    best_len = len;
+                }
+            }
+            if (best != lru_.end()) {
+                break;
+            }
+        }
+        if (best == lru_.end()) {
+            misses_++;
+            return n_current;
+        }
+    }
+
+    // Entries are only mutated by serialized callers, so `best` stays valid unlocked.
+    rn_clear_sequence(rn_ctx, 0);
+    if (llama_state_seq_set_data(rn_ctx->ctx, best->state.data(), best->state.size(), 0) != best->state.size()) {
+        rn_clear_sequence(rn_ctx, 0);
+        std::lock_guard<std::mutex> lock(mutex_);
+        erase(best);
+        misses_++;
+        return 0;
+    }
+    rn_ctx->kv_tokens = best->tokens;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    touch(best);
+    hits_++;
+    tokens_reused_ += best_len - n_current;
+    return best_len;
+}
+
+void rn_prefix_cache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+    by_id_.clear();
+    by_block_.clear();
+    bytes_ = 0;
+}
+
+rn_prefix_cache::stats_t rn_prefix_cache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_t s;
+    s.hits          = hits_;
+    s.misses        = misses_;
+    s.tokens_reused = tokens_reused_;
+    s.entries       = lru_.size();
+    s.bytes         = bytes_;
+    s.budget_bytes  = budget_bytes_;
+    return s;
+}
+
+} // namespace facebook::react
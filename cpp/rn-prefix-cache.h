@@ -0,0 +1,83 @@
+#pragma once
+
+// In-RAM LRU cache of seq 0 snapshots, indexed by hashed token blocks.
+//
+// Before run_completion evicts the tail of seq 0 for a prompt that diverges from it, the
+// current sequence state (llama_state_seq_get_data) is stored here with its tokens. Each
+// entry is indexed by the chained hash of every full PREFIX_BLOCK-token block of its
+// tokens, so a later prompt finds the entry sharing its longest block-aligned prefix
+// with one hash lookup per block. The match is then verified token-by-token and extended
+// to the exact common prefix. Switching back to a recent conversation, or to another one
+// with the same system prompt / tools, restores that prefix instead of re-prefilling it.
+//
+// All methods except stats() are called with seq 0 serialized (inference_gate_).
+// The internal mutex only protects the bookkeeping read by stats() from the JS thread.
+
+#include "rn-llama.h"
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace facebook::react {
+
+class rn_prefix_cache {
+public:
+    static constexpr size_t PREFIX_BLOCK = 64;
+
+    struct stats_t {
+        uint64_t hits          = 0; // lookups that restored a longer prefix than seq 0 had
+        uint64_t misses        = 0; // lookups that found nothing better
+        uint64_t tokens_reused = 0; // prompt tokens skipped thanks to restored entries
+        size_t   entries       = 0;
+        size_t   bytes         = 0;
+        size_t   budget_bytes  = 0;
+    };
+
+    explicit rn_prefix_cache(size_t budget_bytes);
+
+    // Snapshots seq 0 (whose contents are `tokens`) unless it is too short, too large for
+    // the budget, or already covered by a longer entry. Entries it covers are dropped.
+    void store(llama_context* ctx, const std::vector<llama_token>& tokens);
+
+    // Finds the entry with the longest common prefix with `prompt`; if that prefix is
+    // longer than n_current (what seq 0 already shares) the entry is loaded into seq 0,
+    // `kv_tokens` is replaced by its tokens and the new common prefix is returned.
+    // Otherwise seq 0 is untouched and n_current is returned.
+    size_t restore(rn_llama_context* rn_ctx,
+                   const std::vector<llama_token>& prompt,
+                   size_t n_current);
+
+    void clear();
+
+    [[nodiscard]] stats_t stats() const;
+
+private:
+    struct entry {
+        uint64_t                 id = 0;
+        std::vector<llama_token> tokens;
+        std::vector<uint64_t>    block_hashes;
+        std::vector<uint8_t>     state;
+        size_t                   bytes = 0;
+    };
+    using entry_list = std::list<entry>; // front = most recently used
+
+    static std::vector<uint64_t> hash_blocks(const std::vector<llama_token>& tokens, size_t n_max);
+    void erase(entry_list::iterator it);
+    void touch(entry_list::iterator it);
+
+    mutable std::mutex mutex_;
+    size_t     budget_bytes_;
+    size_t     bytes_ = 0;
+    uint64_t   next_id_ = 1;
+    entry_list lru_;
+    std::unordered_map<uint64_t, entry_list::iterator>   by_id_;
+    std::unordered_multimap<uint64_t, uint64_t>          by_block_; // chained block hash → entry id
+    uint64_t   hits_ = 0;
+    uint64_t   misses_ = 0;
+    uint64_t   tokens_reused_ = 0;
+};
+
+} // namespace facebook::react
@@ -0,0 +1,165 @@
+#include "rn-priority-gate.h"
+
+#include <algorithm>
+
+namespace facebook::react {
+
+bool rn_priority_from_name(const std::string& name, rn_priority& priority) {
+    if (name == "interactive") {
+        priority = RN_PRIORITY_INTERACTIVE;
+    } else if (name == "normal") {
+        priority = RN_PRIORITY_NORMAL;
+    } else if (name == "background") {
+        priority = RN_PRIORITY_BACKGROUND;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+rn_priority_gate::ticket_ptr rn_priority_gate::make_ticket(rn_priority priority, bool preemptible) {
+    auto t = std::make_shared<ticket>();
+    t->priority    = priority;
+    t->preemptible = preemptible;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = live_.begin(); it != live_.end();) {
+        it = it->second.expired() ? live_.erase(it) : std::next(it);
+    }
+    t->id = next_id_++;
+    live_[t->id] = t;
+    return t;
+}
+
+bool rn_priority_gate::lock(const ticket_ptr& t) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (t->id == 0) {
+        t->id = next_id_++; // anonymous: still needs its place in arrival order
+    }
+    waiting_.push_back(t);
+    update_yield_locked();
+    cv_.wait(lock, [&] { return t->cancelled.load() || (!holder_ && best_locked() == t); });
+
+    waiting_.erase(std::find(waiting_.begin(), waiting_.end(), t));
+    const bool acquired = !t->cancelled.load();
+    if (acquired) {
+        set_holder_locked(t);
+    }
+    update_yield_locked();
+    cv_.notify_all();
+    return acquired;
+}
+
+void rn_priority_gate::lock(rn_priority priority) {
+    auto t = std::make_shared<ticket>();
+    t->priority = priority;
+    lock(t);
+}
+
+void rn_priority_gate::unlock() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        set_holder_locked(nullptr);
+        update_yield_locked();
+    }
+    cv_.notify_all();
+}
+
+bool rn_priority_gate::yield() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const ticket_ptr self = holder_;
+    if (!self) {
+        return true;
+    }
+    self->parked = true;
+    waiting_.push_back(self);
+    set_holder_locked(nullptr);
+    update_yield_locked();
+    cv_.notify_all();
+
+    cv_.wait(lock, [&] { return !holder_ && best_locked() == self; });
+    waiting_.erase(std::find(waiting_.begin(), waiting_.end(), self));
+    self->parked = false;
+    set_holder_locked(self);
+    update_yield_locked();
+    return !self->cancelled.load();
+}
+
+bool rn_priority_gate::cancel(uint64_t id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = live_.find(id);
+        const ticket_ptr t = it != live_.end() ? it->second.lock() : nullptr;
+        if (!t) {
+            return false;
+        }
+        t->cancelled = true;
+        update_yield_locked();
+    }
+    cv_.notify_all();
+    return true;
+}
+
+void rn_priority_gate::cancel_all() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& entry : live_) {
+            if (const ticket_ptr t = entry.second.lock()) {
+                t->cancelled = true;
+            }
+        }
+        update_yield_locked();
+    }
+    cv_.notify_all();
+}
+
+void rn_priority_gate::cancel_parked() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const ticket_ptr& t : waiting_) {
+            if (t->parked) {
+                t->cancelled = true;
+            }
+        }
+        update_yield_locked();
+    }
+    cv_.notify_all();
+}
+
+void rn_priority_gate::set_holder_locked(ticket_ptr t) {
+    holder_cancel_.store(t ? &t->cancelled : nullptr, std::memory_order_release);
+    holder_ = std::move(t);
+}
+
+rn_priority_gate::ticket_ptr rn_priority_gate::best_locked() const {
+    // A cancelled parked ticket only needs the gate to drop its parked state, so it goes
+    // first; a cancelled queued one is leaving and takes no turn.
+    auto rank = [](const ticket_ptr& t) {
+        return t->cancelled.load() ? RN_PRIORITY_INTERACTIVE + 1 : static_cast<int>(t->priority);
+    };
+    ticket_ptr best;
+    for (const ticket_ptr& t : waiting_) {
+        if (t->cancelled.load() && !t->parked) {
+            continue;
+        }
+        if (!best || rank(t) > rank(best) || (rank(t) == rank(best) && t->id < best->id)) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+void rn_priority_gate::update_yield_locked() {
+    bool outranked = false;
+    if (holder_ && holder_->preemptible) {
+        for (const ticket_ptr& t : waiting_) {
+            if (!t->cancelled.load() && t->priority > holder_->priority) {
+                outranked = true;
+                break;
+            }
+        }
+    }
+    yield_requested_.store(outranked, std::memory_order_relaxed);
+}
+
+} // namespace facebook::react
@@ -0,0 +1,131 @@
+#pragma once
+
+// Priority gate that serializes inference on one llama_context: seq 0 completions, the
+// multimodal encoders, session I/O and the batch scheduler's steps. It replaces a plain
+// mutex so a queued interactive request does not wait behind a long background job.
+//
+// - Waiters are served by priority class (interactive > normal > background), then in
+//   arrival order.
+// - A preemptible holder (a seq 0 completion) polls should_yield() at prefill-chunk and
+//   token boundaries. When a waiter outranks it, the holder parks its sequence state and
+//   calls yield(), which hands the gate over and queues the holder again under its own
+//   ticket, so it resumes before requests of its class that arrived after it.
+// - cancel(id) wakes a queued ticket (lock() returns false) or flags a running or parked
+//   one. A cancelled parked ticket is served before everything else so it can clean up
+//   its parked state and leave. cancel_all() does the same for every live ticket, so a
+//   stop only reaches the requests that exist when it is issued.
+//
+// The internal mutex is a leaf lock. The gate itself is the inference lock of
+// LlamaCppModel's lock hierarchy.
+
+#include "rn-utils.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace facebook::react {
+
+// "interactive" | "normal" | "background"
+bool rn_priority_from_name(const std::string& name, rn_priority& priority);
+
+class rn_priority_gate {
+public:
+    // One request's place in line, shared by the thread running it and cancel().
+    struct ticket {
+        uint64_t          id          = 0; // also the arrival order; 0 = anonymous
+        rn_priority       priority    = RN_PRIORITY_NORMAL;
+        bool              preemptible = false;
+        std::atomic<bool> cancelled{false};
+        bool              parked      = false; // guarded by the gate's mutex
+    };
+    using ticket_ptr = std::shared_ptr<ticket>;
+
+    rn_priority_gate() = default;
+    rn_priority_gate(const rn_priority_gate&) = delete;
+    rn_priority_gate& operator=(const rn_priority_gate&) = delete;
+
+    // A ticket with a fresh id that cancel(id) can reach while the ticket is alive.
+    ticket_ptr make_ticket(rn_priority priority, bool preemptible);
+
+    // Blocks until `t` holds the gate. Returns false, without the gate, if `t` is
+    // cancelled first.
+    bool lock(const ticket_ptr& t);
+
+    // An anonymous, non-preemptible ticket of `priority`; never cancelled.
+    void lock(rn_priority priority);
+
+    // BasicLockable (std::lock_guard / std::unique_lock): lock(RN_PRIORITY_INTERACTIVE).
+    void lock() { lock(RN_PRIORITY_INTERACTIVE); }
+    void unlock();
+
+    // For the holder: a waiter outranks it and it is preemptible. One relaxed load.
+    [[nodiscard]] bool should_yield() const { return yield_requested_.load(std::memory_order_relaxed); }
+
+    // Whether the current holder's ticket was cancelled. Lock-free, so llama_decode's
+    // abort callback can poll it; only meaningful on the holder's thread.
+    [[nodiscard]] bool holder_cancelled() const {
+        const std::atomic<bool>* flag = holder_cancel_.load(std::memory_order_acquire);
+        return flag && flag->load(std::memory_order_relaxed);
+    }
+
+    // For the holder: hands the gate to the best waiter and blocks until the holder's
+    // ticket is first in line again. Always returns holding the gate; false if the ticket
+    // was cancelled meanwhile.
+    bool yield();
+
+    // Flags the live ticket with this id, wherever it is. False if there is none.
+    bool cancel(uint64_t id);
+
+    // Flags every live ticket made by make_ticket(): queued, running and parked
+    // (stopCompletion without an id).
+    void cancel_all();
+
+    // Flags every parked ticket so it resumes first and gives up (release()).
+    void cancel_parked();
+
+private:
+    ticket_ptr best_locked() const;
+    void update_yield_locked();
+    void set_holder_locked(ticket_ptr t);
+
+    mutable std::mutex      mutex_;
+    std::condition_variable cv_;
+    ticket_ptr              holder_;
+    std::vector<ticket_ptr> waiting_; // queued and parked tickets, unordered
+    std::map<uint64_t, std::weak_ptr<ticket>> live_;
+    uint64_t                next_id_ = 1;
+    std::atomic<bool>       yield_requested_{false};
+    // &holder_->cancelled. The holder's ticket outlives every read: only the holder's
+    // thread reads it, and it is swapped before holder_ is released.
+    std::atomic<const std::atomic<bool>*> holder_cancel_{nullptr};
+};
+
+// Scoped hold of a rn_priority_gate with a ticket or an anonymous priority.
+class rn_gate_lock {
+public:
+    rn_gate_lock(rn_priority_gate& gate, const rn_priority_gate::ticket_ptr& t)
+        : gate_(gate), owns_(gate.lock(t)) {}
+    rn_gate_lock(rn_priority_gate& gate, rn_priority priority)
+        : gate_(gate), owns_(true) { gate.lock(priority); }
+    ~rn_gate_lock() {
+        if (owns_) {
+            gate_.unlock();
+        }
+    }
+    rn_gate_lock(const rn_gate_lock&) = delete;
+    rn_gate_lock& operator=(const rn_gate_lock&) = delete;
+
+    // False when the ticket was cancelled before it got the gate.
+    [[nodiscard]] bool owns_lock() const { return owns_; }
+
+private:
+    rn_priority_gate& gate_;
+    bool              owns_;
+};
+
+} // namespace facebook::react
@@ -0,0 +1,547 @@
+#include "rn-scheduler.h"
+#include "rn-shared-prefix.h"
+// Suppress unused function warnings from llama.cpp headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "common.h"
+#include "llama.h"
+#include "sampling.h"
+#pragma GCC diagnostic pop
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace facebook::react {
+
+namespace {
+
+double elapsed_ms(std::chrono::steady_clock::time_point from,
+                  std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+CompletionResult make_error(const std::string& msg, rn_error_type type) {
+    CompletionResult result;
+    result.success = false;
+    result.error_msg = msg;
+    result.error_type = type;
+    return result;
+}
+
+} // namespace
+
+rn_batch_scheduler::rn_batch_scheduler(rn_llama_context* rn_ctx, rn_priority_gate& decode_gate, int n_slots)
+    : rn_ctx_(rn_ctx), decode_gate_(decode_gate) {
+    n_batch_ = static_cast<int32_t>(llama_n_batch(rn_ctx_->ctx));
+
+    // Every generating slot contributes one token per step, so never run more slots
+    // than fit in one batch.
+    n_slots = std::min(n_slots, static_cast<int>(n_batch_));
+    for (int i = 0; i < n_slots; i++) {
+        const llama_seq_id seq_id = rn_acquire_seq(rn_ctx_);
+        if (seq_id < 0) {
+            break; // pool exhausted — n_seq_max was set lower than n_parallel + 1
+        }
+        slot s;
+        s.seq_id = seq_id;
+        slots_.push_back(std::move(s));
+    }
+    n_slots_ = static_cast<int>(slots_.size());
+
+    batch_ = llama_batch_init(n_batch_, 0, 1);
+    worker_ = std::thread(&rn_batch_scheduler::worker_loop, this);
+}
+
+rn_batch_scheduler::~rn_batch_scheduler() {
+    shutdown();
+}
+
+CompletionResult rn_batch_scheduler::run(const CompletionOptions& options, token_callback callback) {
+    if (!rn_ctx_ || !rn_ctx_->model || !rn_ctx_->ctx) {
+        return make_error("Model not initialized", RN_ERROR_MODEL_LOAD);
+    }
+    if (n_slots_ == 0) {
+        return make_error("No KV sequences available for the batch scheduler", RN_ERROR_CONTEXT);
+    }
+
+    auto req = std::make_unique<request>();
+    req->options  = options;
+    req->callback = std::move(callback);
+
+    // Tokenize and build the sampler on the request thread so the worker only decodes.
+    completion_state& state = req->state;
+    state.rn_ctx = rn_ctx_;
+    set_deadlines(state, options);
+    try {
+        if (options.prompt.empty()) {
+            return make_error("No prompt provided", RN_ERROR_INVALID_PARAM);
+        }
+        state.prompt_tokens = common_tokenize(rn_ctx_->vocab, options.prompt, true, true);
+        if (state.prompt_tokens.empty()) {
+            return make_error("Empty prompt", RN_ERROR_INVALID_PARAM);
+        }
+
+        state.n_ctx = llama_n_ctx(rn_ctx_->ctx);
+        if (static_cast<int>(state.prompt_tokens.size()) >= state.n_ctx) {
+            return make_error("Prompt too long: " + std::to_string(state.prompt_tokens.size())
+                + " tokens exceeds context size " + std::to_string(state.n_ctx),
+                RN_ERROR_INVALID_PARAM);
+        }
+
+        const common_params_sampling sampling_params = build_sampling_params(rn_ctx_, options);
+        if (!acquire_sampler(rn_ctx_, state, sampling_params, options)) {
+            return make_error("Failed to initialize sampler", RN_ERROR_INFERENCE);
+        }
+        // Same seeding as run_completion: a fresh or reset sampler accepts the prompt tail
+        // without advancing the grammar.
+        prime_sampler(state.sampler.get(), sampling_params, state.prompt_tokens);
+
+        state.antiprompt  = options.stop;
+        state.stop_matcher.build(state.antiprompt);
+        state.n_predict   = resolve_n_predict(rn_ctx_, options);
+        state.n_remaining = state.n_predict;
+        if (state.n_predict > 0) {
+            const int available = state.n_ctx - static_cast<int>(state.prompt_tokens.size()) - 4;
+            if (available > 0 && state.n_predict > available) {
+                state.n_predict   = available;
+                state.n_remaining = available;
+            }
+        }
+        reserve_generation_buffers(state);
+    } catch (const std::exception& e) {
+        return make_error(e.what(), RN_ERROR_GENERAL);
+    }
+
+    auto future = req->promise.get_future();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (stopping_) {
+            return make_error("Model released", RN_ERROR_CONTEXT);
+        }
+        pending_.push_back(std::move(req));
+    }
+    queue_cv_.notify_one();
+    return future.get();
+}
+
+void rn_batch_scheduler::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+    }
+    queue_cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+
+    // The worker has exited; everything it still owned is failed here.
+    std::deque<std::unique_ptr<request>> pending;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        pending.swap(pending_);
+    }
+    for (auto& req : pending) {
+        req->promise.set_value(make_error("Model released", RN_ERROR_CONTEXT));
+    }
+
+    std::lock_guard<rn_priority_gate> decode_lock(decode_gate_);
+    for (auto& s : slots_) {
+        if (s.req) {
+            fail_slot(s, "Model released", RN_ERROR_CONTEXT);
+        }
+        if (rn_ctx_->ctx) {
+            llama_memory_seq_rm(llama_get_memory(rn_ctx_->ctx), s.seq_id, -1, -1);
+        }
+        rn_release_seq(rn_ctx_, s.seq_id);
+    }
+    slots_.clear();
+
+    llama_batch_free(batch_);
+    batch_ = {};
+}
+
+void rn_batch_scheduler::worker_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cv_.wait(lock, [this] { return stopping_ || !pending_.empty() || n_active_ > 0; });
+            if (stopping_) {
+                return;
+            }
+        }
+
+        // One step per gate acquisition so multimodal / embedding calls can interleave.
+        rn_gate_lock decode_lock(decode_gate_, step_priority());
+        admit_pending();
+        if (n_active_ > 0) {
+            step();
+        }
+    }
+}
+
+void rn_batch_scheduler::admit_pending() {
+    while (true) {
+        slot* best = nullptr;
+        size_t best_lcp = 0;
+
+        std::unique_ptr<request> req;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            if (pending_.empty()) {
+                return;
+            }
+            // The earliest request of the highest priority class goes next.
+            auto next = pending_.begin();
+            for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+                if ((*it)->options.priority > (*next)->options.priority) {
+                    next = it;
+                }
+            }
+            // Pick the free slot whose cached tokens share the longest prefix with this
+            // prompt; ties go to the first free slot.
+            for (auto& s : slots_) {
+                if (s.req) {
+                    continue;
+                }
+                const size_t lcp = common_lcp(s.cache_tokens, (*next)->state.prompt_tokens);
+                if (!best || lcp > best_lcp) {
+                    best = &s;
+                    best_lcp = lcp;
+                }
+            }
+            if (!best) {
+                return; // all slots busy
+            }
+            req = std::move(*next);
+            pending_.erase(next);
+        }
+
+        completion_state& state = req->state;
+
+        // Need at least one prompt token to decode so the first sample has logits.
+        size_t n_keep = std::min(best_lcp, state.prompt_tokens.size() - 1);
+        llama_memory_t mem = llama_get_memory(rn_ctx_->ctx);
+        if (!llama_memory_seq_rm(mem, best->seq_id, static_cast<llama_pos>(n_keep), -1)) {
+            // Partial removal is unsupported (recurrent models) — start this slot fresh.
+            llama_memory_seq_rm(mem, best->seq_id, -1, -1);
+            n_keep = 0;
+        }
+        best->cache_tokens.resize(n_keep);
+        const size_t n_shared = rn_shared_prefix_attach(
+            rn_ctx_, req->options.prompt_id, state.prompt_tokens, n_keep, best->seq_id);
+        if (n_shared > n_keep) {
+            n_keep = n_shared;
+            best->cache_tokens.assign(state.prompt_tokens.begin(), state.prompt_tokens.begin() + n_keep);
+        }
+
+        state.n_past       = static_cast<int>(n_keep);
+        req->n_prompt_eval = static_cast<int>(state.prompt_tokens.size() - n_keep);
+        req->t_admitted    = std::chrono::steady_clock::now();
+
+        best->generating    = false;
+        best->i_batch       = -1;
+        best->pending_token = LLAMA_TOKEN_NULL;
+        best->req           = std::move(req);
+        n_active_++;
+    }
+}
+
+rn_priority rn_batch_scheduler::step_priority() {
+    rn_priority priority = RN_PRIORITY_BACKGROUND;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        for (const auto& req : pending_) {
+            priority = std::max(priority, req->options.priority);
+        }
+    }
+    // slots_ is worker-owned, so the active requests are read without a lock.
+    for (const auto& s : slots_) {
+        if (s.req) {
+            priority = std::max(priority, s.req->options.priority);
+        }
+    }
+    return priority;
+}
+
+void rn_batch_scheduler::step() {
+    // Thermal management: same contract as the run_completion loop.
+    {
+        int requested = rn_ctx_->requested_n_threads.exchange(-1, std::memory_order_acq_rel);
+        if (requested > 0) {
+            llama_set_n_threads(rn_ctx_->ctx, requested, requested);
+        }
+    }
+
+    if (rn_ctx_->abort_generation.load(std::memory_order_relaxed)) {
+        for (auto& s : slots_) {
+            if (s.req) {
+                fail_slot(s, "Generation aborted", RN_ERROR_INFERENCE);
+            }
+        }
+        return;
+    }
+
+    // Requests out of time or stopped by stopCompletion() end before this step with what
+    // they generated so far; one still ingesting its prompt ends with no output. A prompt
+    // under a first-token deadline lifts the chunk cap below.
+    bool prompt_deadline = false;
+    for (auto& s : slots_) {
+        if (!s.req) {
+            continue;
+        }
+        const auto& cancelled = s.req->options.cancelled;
+        if (deadline_passed(s.req->state) || (cancelled && cancelled->load(std::memory_order_relaxed))) {
+            if (!s.generating) {
+                s.req->t_prompt_done = std::chrono::steady_clock::now();
+            }
+            finish_slot(s);
+            continue;
+        }
+        if (!s.generating && s.req->state.t_first_token != std::chrono::steady_clock::time_point::max()) {
+            prompt_deadline = true;
+        }
+    }
+
+    common_batch_clear(batch_);
+    for (auto& s : slots_) {
+        s.n_batched = 0;
+    }
+
+    // 1. One token for every generating slot: the one sampled at the end of the step
+    //    that produced its logits (or left over from a failed decode).
+    for (auto& s : slots_) {
+        if (!s.req || !s.generating) {
+            continue;
+        }
+        completion_state& state = s.req->state;
+        if (state.n_past + 1 >= state.n_ctx) {
+            // No context shift in scheduled mode.
+            state.truncated        = true;
+            state.stopped_by_limit = true;
+            state.has_next_token   = false;
+            finish_slot(s);
+            continue;
+        }
+        s.i_batch = batch_.n_tokens;
+        common_batch_add(batch_, s.pending_token, state.n_past, {s.seq_id}, true);
+        s.n_batched = 1;
+    }
+
+    // 2. Fill the rest of the batch with prompt chunks. The chunk_size cap keeps a long
+    //    prefill from stretching the step that every generating slot is waiting on; it is
+    //    lifted while the app is backgrounded or idle and nothing is rendering, and while
+    //    a prompt races a first-token deadline.
+    const int ingest_chunk = rn_ctx_->ingest_full_speed.load(std::memory_order_relaxed) || prompt_deadline
+        ? static_cast<int>(n_batch_)
+        : std::clamp(rn_ctx_->params.chunk_size, 8, 512);
+    int budget = std::min(ingest_chunk, static_cast<int>(n_batch_) - batch_.n_tokens);
+    for (auto& s : slots_) {
+        if (budget <= 0) {
+            break;
+        }
+        if (!s.req || s.generating) {
+            continue;
+        }
+        completion_state& state = s.req->state;
+        const int n_prompt = static_cast<int>(state.prompt_tokens.size());
+        const int n_take = std::min(budget, n_prompt - state.n_past);
+        for (int j = 0; j < n_take; j++) {
+            const int pos = state.n_past + j;
+            const bool last = (pos == n_prompt - 1);
+            if (last) {
+                s.i_batch = batch_.n_tokens;
+            }
+            common_batch_add(batch_, state.prompt_tokens[pos], pos, {s.seq_id}, last);
+        }
+        s.n_batched = n_take;
+        budget -= n_take;
+    }
+
+    if (batch_.n_tokens == 0) {
+        return;
+    }
+
+    int ret = llama_decode(rn_ctx_->ctx, batch_);
+    while (ret == 1 && evict_idle_slot()) {
+        // KV cache full: cached prefixes of idle slots go first, oldest first.
+        ret = llama_decode(rn_ctx_->ctx, batch_);
+    }
+    if (ret != 0) {
+        // Nothing in this batch is committed: drop any KV a partially processed batch
+        // left behind so every slot's sequence still ends at its n_past.
+        llama_memory_t mem = llama_get_memory(rn_ctx_->ctx);
+        for (auto& s : slots_) {
+            if (s.req && s.n_batched > 0) {
+                llama_memory_seq_rm(mem, s.seq_id, s.req->state.n_past, -1);
+            }
+        }
+
+        if (ret == 1 && !rn_ctx_->abort_generation.load(std::memory_order_relaxed)) {
+            // KV cache full with no idle cache left. Evict the active slot holding the
+            // most cells and let the others retry on the next step.
+            slot* victim = nullptr;
+            for (auto& s : slots_) {
+                if (s.req && s.n_batched > 0 &&
+                    (!victim || s.req->state.n_past > victim->req->state.n_past)) {
+                    victim = &s;
+                }
+            }
+            if (victim) {
+                if (victim->generating) {
+                    victim->req->state.truncated        = true;
+                    victim->req->state.stopped_by_limit = true;
+                    victim->req->state.has_next_token   = false;
+                    finish_slot(*victim);
+                } else {
+                    fail_slot(*victim, "KV cache is full; prompt could not be scheduled", RN_ERROR_CONTEXT);
+                }
+                llama_memory_seq_rm(mem, victim->seq_id, -1, -1);
+                victim->cache_tokens.clear();
+            }
+            return;
+        }
+
+        const std::string msg = rn_ctx_->abort_generation.load(std::memory_order_relaxed)
+            ? "Generation aborted" : "Failed to decode batch";
+        for (auto& s : slots_) {
+            if (s.req && s.n_batched > 0) {
+                fail_slot(s, msg, RN_ERROR_INFERENCE);
+            }
+        }
+        return;
+    }
+
+    // Commit the step.
+    for (auto& s : slots_) {
+        if (!s.req || s.n_batched == 0) {
+            continue;
+        }
+        completion_state& state = s.req->state;
+
+        if (s.generating) {
+            const llama_token token_id = s.pending_token;
+            s.pending_token = LLAMA_TOKEN_NULL;
+            s.cache_tokens.push_back(token_id);
+            state.n_past++;
+            common_sampler_accept(state.sampler.get(), token_id, true);
+
+            const std::string_view token_text = rn_ctx_->pieces.piece(token_id);
+            state.generated_text += token_text;
+            state.generated_tokens.push_back(token_id);
+            state.n_decoded++;
+            state.n_remaining--;
+
+            if (!process_generated_token(state, token_id, token_text, s.req->options, s.req->callback)) {
+                finish_slot(s);
+            } else {
+                sample_next(s);
+            }
+            continue;
+        }
+
+        s.cache_tokens.insert(s.cache_tokens.end(),
+                              state.prompt_tokens.begin() + state.n_past,
+                              state.prompt_tokens.begin() + state.n_past + s.n_batched);
+        state.n_past += s.n_batched;
+        if (state.n_past >= static_cast<int>(state.prompt_tokens.size())) {
+            s.generating = true;
+            s.req->t_prompt_done = std::chrono::steady_clock::now();
+            if (!s.req->options.shared_prefix_tokens.empty()) {
+                rn_shared_prefix_store(rn_ctx_, s.req->options.prompt_id,
+                                       s.req->options.shared_prefix_tokens, state.prompt_tokens, s.seq_id);
+            }
+            if (state.n_predict == 0) {
+                finish_slot(s);
+            } else {
+                sample_next(s);
+            }
+        }
+    }
+}
+
+bool rn_batch_scheduler::evict_idle_slot() {
+    slot* victim = nullptr;
+    for (auto& s : slots_) {
+        if (!s.req && !s.cache_tokens.empty() && (!victim || s.t_idle < victim->t_idle)) {
+            victim = &s;
+        }
+    }
+    if (!victim) {
+        return false;
+    }
+    llama_memory_seq_rm(llama_get_memory(rn_ctx_->ctx), victim->seq_id, -1, -1);
+    victim->cache_tokens.clear();
+    return true;
+}
+
+bool rn_batch_scheduler::sample_next(slot& s) {
+    // Called right after the decode, under the same hold of the gate: once the gate is
+    // released, any other decode on the context (seq 0, embeddings, multimodal) replaces
+    // the output buffer and s.i_batch no longer names this slot's row.
+    const llama_token token_id = common_sampler_sample(s.req->state.sampler.get(), rn_ctx_->ctx, s.i_batch);
+    if (token_id == LLAMA_TOKEN_NULL) {
+        fail_slot(s, "Sampler produced no valid token (grammar may be over-constrained)", RN_ERROR_INFERENCE);
+        return false;
+    }
+    s.pending_token = token_id;
+    return true;
+}
+
+void rn_batch_scheduler::finish_slot(slot& s) {
+    std::unique_ptr<request> req = std::move(s.req);
+    completion_state& state = req->state;
+
+    try {
+        flush_unsent_text(state, req->callback);
+        if (req->callback) {
+            req->callback("", true);
+        }
+    } catch (...) {
+        // A throwing callback must not take the worker down with it.
+    }
+    release_sampler(rn_ctx_, state);
+
+    const auto now = std::chrono::steady_clock::now();
+    CompletionResult result;
+    result.content            = std::move(state.generated_text);
+    result.tokens             = std::move(state.generated_tokens);
+    result.n_prompt_tokens    = static_cast<int>(state.prompt_tokens.size());
+    result.n_predicted_tokens = state.n_decoded;
+    result.stopped_by_length  = state.stopped_by_limit;
+    result.stopped_by_time    = state.stopped_by_time;
+    result.timings.prompt_n     = req->n_prompt_eval;
+    result.timings.prompt_ms    = elapsed_ms(req->t_admitted, req->t_prompt_done);
+    result.timings.predicted_n  = state.n_decoded;
+    result.timings.predicted_ms = elapsed_ms(req->t_prompt_done, now);
+    result.timings.total_ms     = elapsed_ms(req->t_admitted, now);
+
+    s.generating    = false;
+    s.i_batch       = -1;
+    s.pending_token = LLAMA_TOKEN_NULL;
+    s.t_idle        = now;
+    n_active_--;
+
+    req->promise.set_value(std::move(result));
+}
+
+void rn_batch_scheduler::fail_slot(slot& s, const std::string& msg, rn_error_type type) {
+    std::unique_ptr<request> req = std::move(s.req);
+    release_sampler(rn_ctx_, req->state);
+
+    s.generating    = false;
+    s.i_batch       = -1;
+    s.pending_token = LLAMA_TOKEN_NULL;
+    s.t_idle        = std::chrono::steady_clock::now();
+    n_active_--;
+
+    req->promise.set_value(make_error(msg, type));
+}
+
+} // namespace facebook::react
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "rn-llama.h"
+#include "rn-completion.h"
+#include "rn-priority-gate.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace facebook::react {
+
+// Continuous batching scheduler for concurrent text completions on one llama_context.
+//
+// Each slot owns one KV sequence from the rn_llama_context sequence pool. A single
+// worker thread builds one llama_batch per step that carries the next token of every
+// generating slot plus prompt chunks of slots still prefilling, so N concurrent
+// requests share one forward pass instead of queueing behind the inference gate.
+//
+// Slots keep their KV and token history after a request finishes; a new request is
+// admitted to the free slot with the longest common token prefix and only the suffix
+// is prefilled. When the shared prefix sequence holds the request's system / tools
+// prefix and covers more of the prompt, the slot attaches to it instead (see
+// rn-shared-prefix.h). Queued requests are admitted by priority class, then in arrival
+// order.
+//
+// Threading: run() is called from the request thread and blocks until the request
+// finishes. The worker takes decode_gate (LlamaCppModel::inference_gate_) once per
+// step at the highest priority among its queued and active requests, so multimodal /
+// embedding calls and seq 0 completions on the same gate interleave with it by class.
+// Callbacks are invoked on the worker thread.
+//
+// Not supported in scheduled mode: context shift (a slot that reaches n_ctx stops
+// with stopped_by_length) and media messages (routed to the legacy seq 0 path).
+class rn_batch_scheduler {
+public:
+    using token_callback = std::function<bool(const std::string&, bool)>;
+
+    rn_batch_scheduler(rn_llama_context* rn_ctx, rn_priority_gate& decode_gate, int n_slots);
+    ~rn_batch_scheduler();
+
+    rn_batch_scheduler(const rn_batch_scheduler&) = delete;
+    rn_batch_scheduler& operator=(const rn_batch_scheduler&) = delete;
+
+    // Tokenizes options.prompt, queues the request and blocks until it completes.
+    CompletionResult run(const CompletionOptions& options, token_callback callback);
+
+    // Stops the worker and fails every queued or active request; later run() calls
+    // fail immediately. Idempotent. Must be called before rn_ctx->ctx is released.
+    // The owner clears rn_ctx->scheduler once no request can reach it any more.
+    void shutdown();
+
+    [[nodiscard]] int n_slots() const { return n_slots_; }
+
+    // Frees the KV of the least recently used idle slot that still caches tokens, so a
+    // decode that found the unified KV cache full can retry. Returns false when no idle
+    // slot holds any cells. The caller must hold decode_gate (slots are only touched
+    // under it); seq 0 paths reach this through rn_decode().
+    bool evict_idle_slot();
+
+private:
+    struct request {
+        CompletionOptions options;
+        token_callback    callback;
+        completion_state  state;
+        std::promise<CompletionResult> promise;
+
+        int n_prompt_eval = 0; // prompt tokens actually prefilled (after prefix reuse)
+        std::chrono::steady_clock::time_point t_admitted;
+        std::chrono::steady_clock::time_point t_prompt_done;
+    };
+
+    struct slot {
+        llama_seq_id seq_id = -1;
+        std::vector<llama_token> cache_tokens; // tokens whose KV currently lives in seq_id
+        std::unique_ptr<request> req;
+
+        bool        generating    = false;
+        int32_t     i_batch       = -1;               // this slot's logits row in the last decode
+        llama_token pending_token = LLAMA_TOKEN_NULL; // sampled, not yet committed by a decode
+        int         n_batched     = 0;                // tokens this slot put in the current batch
+        std::chrono::steady_clock::time_point t_idle; // when the last request left (LRU eviction)
+    };
+
+    void worker_loop();
+    void admit_pending();
+    rn_priority step_priority();
+    void step();
+    bool sample_next(slot& s);
+    void finish_slot(slot& s);
+    void fail_slot(slot& s, const std::string& msg, rn_error_type type);
+
+    rn_llama_context* rn_ctx_;
+    rn_priority_gate& decode_gate_;
+    llama_batch       batch_ = {};
+    int32_t           n_batch_ = 0;
+    int               n_slots_ = 0; // fixed at construction; slots_ is worker-owned
+    std::vector<slot> slots_;
+
+    std::mutex                            queue_mutex_;
+    std::condition_variable               queue_cv_;
+    std::deque<std::unique_ptr<request>>  pending_;
+    bool                                  stopping_ = false;
+    int                                   n_active_ = 0; // worker-only
+
+    std::thread worker_;
+};
+
+} // namespace facebook::react
@@ -0,0 +1,442 @@
+#include "rn-session.h"
+#include "rn-prefix-cache.h"
+// Suppress unused function warnings from llama.cpp headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "common.h"
+#include "llama.h"
+#pragma GCC diagnostic pop
+
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace facebook::react {
+
+namespace {
+
+// File layout (host byte order; sessions are not meant to move between devices):
+//
+//   char[4]  magic "RNKV"
+//   uint32   version            RN_SESSION_VERSION
+//   uint64   model fingerprint  rn_model_fingerprint()
+//   uint32   n_ctx
+//   uint32   n_tokens
+//   uint32   meta_size
+//   uint64   kv_size
+//   uint64   checksum           FNV-1a over tokens + meta + kv
+//   int32    tokens[n_tokens]   kv_tokens
+//   char     meta[meta_size]    JSON: kv_messages, kv_render_identity, kv_evicted_ids,
+//                               completion_cache
+//   uint8    kv[kv_size]        llama_state_seq_get_data(ctx, ..., 0)
+constexpr char     kMagic[4]     = {'R', 'N', 'K', 'V'};
+constexpr uint32_t kMaxMetaSize  = 16u * 1024u * 1024u;
+constexpr uint64_t kFnvOffset    = 14695981039346656037ull;
+constexpr uint64_t kFnvPrime     = 1099511628211ull;
+
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = kFnvOffset) {
+    const auto* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= kFnvPrime;
+    }
+    return hash;
+}
+
+template <typename T>
+void write_pod(std::ofstream& out, const T& v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template <typename T>
+bool read_pod(std::ifstream& in, T& v) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+
+json session_meta_to_json(rn_llama_context* rn_ctx) {
+    json meta;
+    meta["kv_has_messages"]    = rn_ctx->kv_has_messages;
+    meta["kv_render_identity"] = rn_ctx->kv_render_identity;
+    json messages = json::array();
+    for (const auto& m : rn_ctx->kv_messages) {
+        messages.push_back({m.id, m.token_end});
+    }
+    meta["kv_messages"] = std::move(messages);
+    meta["kv_evicted_ids"] = rn_ctx->kv_evicted_ids;
+
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    if (rn_ctx->completion_cache.has_value()) {
+        const auto& c = *rn_ctx->completion_cache;
+        json triggers = json::array();
+        for (const auto& t : c.grammar_triggers) {
+            triggers.push_back({{"type", static_cast<int>(t.type)}, {"value", t.value}, {"token", t.token}});
+        }
+        meta["completion_cache"] = {
+            {"prompt_id",        c.prompt_id},
+            {"config_id",        c.config_id},
+            {"grammar",          c.grammar},
+            {"grammar_lazy",     c.grammar_lazy},
+            {"grammar_triggers", std::move(triggers)},
+            {"preserved_tokens", std::vector<llama_token>(c.preserved_tokens.begin(), c.preserved_tokens.end())},
+            {"additional_stops", c.additional_stops},
+        };
+    } else {
+        meta["completion_cache"] = nullptr;
+    }
+    return meta;
+}
+
+// Parses everything before touching rn_ctx so a malformed file leaves no partial state.
+struct session_meta {
+    bool                                                  kv_has_messages = false;
+    std::string                                           kv_render_identity;
+    std::vector<rn_llama_context::kv_msg_entry>           kv_messages;
+    std::set<std::string>                                 kv_evicted_ids;
+    std::optional<rn_llama_context::completion_cache_entry> completion_cache;
+};
+
+session_meta session_meta_from_json(const json& meta) {
+    session_meta out;
+    out.kv_has_messages    = meta.at("kv_has_messages").get<bool>();
+    out.kv_render_identity = meta.at("kv_render_identity").get<std::string>();
+    for (const auto& m : meta.at("kv_messages")) {
+        out.kv_messages.push_back({m.at(0).get<std::string>(), m.at(1).get<int32_t>()});
+    }
+    if (meta.contains("kv_evicted_ids")) { // absent in files written before context-shift eviction
+        out.kv_evicted_ids = meta.at("kv_evicted_ids").get<std::set<std::string>>();
+    }
+    const json& c = meta.at("completion_cache");
+    if (!c.is_null()) {
+        rn_llama_context::completion_cache_entry entry;
+        entry.prompt_id    = c.at("prompt_id").get<std::string>();
+        entry.config_id    = c.at("config_id").get<std::string>();
+        entry.grammar      = c.at("grammar").get<std::string>();
+        entry.grammar_lazy = c.at("grammar_lazy").get<bool>();
+        for (const auto& t : c.at("grammar_triggers")) {
+            common_grammar_trigger trigger;
+            trigger.type  = static_cast<common_grammar_trigger_type>(t.at("type").get<int>());
+            trigger.value = t.at("value").get<std::string>();
+            trigger.token = t.at("token").get<llama_token>();
+            entry.grammar_triggers.push_back(std::move(trigger));
+        }
+        for (const auto& tok : c.at("preserved_tokens")) {
+            entry.preserved_tokens.insert(tok.get<llama_token>());
+        }
+        entry.additional_stops = c.at("additional_stops").get<std::vector<std::string>>();
+        out.completion_cache = std::move(entry);
+    }
+    return out;
+}
+
+} // namespace
+
+uint64_t rn_model_fingerprint(const llama_model* model) {
+    char desc[256] = {0};
+    llama_model_desc(model, desc, sizeof(desc));
+    uint64_t hash = fnv1a(desc, std::char_traits<char>::length(desc));
+    const uint64_t dims[] = {
+        llama_model_n_params(model),
+        llama_model_size(model),
+        static_cast<uint64_t>(llama_vocab_n_tokens(llama_model_get_vocab(model))),
+        static_cast<uint64_t>(llama_model_n_embd(model)),
+        static_cast<uint64_t>(llama_model_n_layer(model)),
+    };
+    return fnv1a(dims, sizeof(dims), hash);
+}
+
+bool rn_save_session(rn_llama_context* rn_ctx, const std::string& path, std::string& error) {
+    if (!rn_ctx || !rn_ctx->model || !rn_ctx->ctx) {
+        error = "Model not initialized";
+        return false;
+    }
+
+    std::vector<uint8_t> kv(llama_state_seq_get_size(rn_ctx->ctx, 0));
+    if (!kv.empty() && llama_state_seq_get_data(rn_ctx->ctx, kv.data(), kv.size(), 0) != kv.size()) {
+        error = "Failed to read KV state";
+        return false;
+    }
+
+    const std::vector<llama_token>& tokens = rn_ctx->kv_tokens;
+    const std::string meta = session_meta_to_json(rn_ctx).dump();
+
+    uint64_t checksum = fnv1a(tokens.data(), tokens.size() * sizeof(llama_token));
+    checksum = fnv1a(meta.data(), meta.size(), checksum);
+    checksum = fnv1a(kv.data(), kv.size(), checksum);
+
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            error = "Cannot open session file for writing: " + tmp_path;
+            return false;
+        }
+        out.write(kMagic, sizeof(kMagic));
+        write_pod(out, RN_SESSION_VERSION);
+        write_pod(out, rn_model_fingerprint(rn_ctx->model));
+        write_pod(out, static_cast<uint32_t>(llama_n_ctx(rn_ctx->ctx)));
+        write_pod(out, static_cast<uint32_t>(tokens.size()));
+        write_pod(out, static_cast<uint32_t>(meta.size()));
+        write_pod(out, static_cast<uint64_t>(kv.size()));
+        write_pod(out, checksum);
+        out.write(reinterpret_cast<const char*>(tokens.data()), tokens.size() * sizeof(llama_token));
+        out.write(meta.data(), meta.size());
+        out.write(reinterpret_cast<const char*>(kv.data()), kv.size());
+        out.flush();
+        if (!out) {
+            out.close();
+            std::remove(tmp_path.c_str());
+            error = "Failed to write session file: " + tmp_path;
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        error = "Failed to move session file into place: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool rn_load_session(rn_llama_context* rn_ctx, const std::string& path, std::string& error) {
+    if (!rn_ctx || !rn_ctx->model || !rn_ctx->ctx) {
+        error = "Model not initialized";
+        return false;
+    }
+
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        error = "Session file not found: " + path;
+        return false;
+    }
+    const uint64_t file_size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    char magic[4];
+    uint32_t version = 0, n_ctx = 0, n_tokens = 0, meta_size = 0;
+    uint64_t fingerprint = 0, kv_size = 0, checksum = 0;
+    if (!in.read(magic, sizeof(magic)) || !read_pod(in, version)) {
+        error = "Session file is truncated";
+        return false;
+    }
+    if (std::char_traits<char>::compare(magic, kMagic, sizeof(kMagic)) != 0) {
+        error = "Not a session file";
+        return false;
+    }
+    if (version != RN_SESSION_VERSION) {
+        error = "Unsupported session version " + std::to_string(version);
+        return false;
+    }
+    if (!read_pod(in, fingerprint) || !read_pod(in, n_ctx) || !read_pod(in, n_tokens) ||
+        !read_pod(in, meta_size) || !read_pod(in, kv_size) || !read_pod(in, checksum)) {
+        error = "Session file is truncated";
+        return false;
+    }
+    if (fingerprint != rn_model_fingerprint(rn_ctx->model)) {
+        error = "Session was saved with a different model";
+        return false;
+    }
+    if (n_ctx != llama_n_ctx(rn_ctx->ctx)) {
+        error = "Session was saved with n_ctx " + std::to_string(n_ctx) + ", context has " +
+                std::to_string(llama_n_ctx(rn_ctx->ctx));
+        return false;
+    }
+    const uint64_t header_size = static_cast<uint64_t>(in.tellg());
+    if (n_tokens > n_ctx || meta_size > kMaxMetaSize ||
+        header_size + uint64_t(n_tokens) * sizeof(llama_token) + meta_size + kv_size != file_size) {
+        error = "Session file is corrupt";
+        return false;
+    }
+
+    std::vector<llama_token> tokens(n_tokens);
+    std::string meta_str(meta_size, '\0');
+    std::vector<uint8_t> kv(kv_size);
+    in.read(reinterpret_cast<char*>(tokens.data()), tokens.size() * sizeof(llama_token));
+    in.read(meta_str.data(), meta_str.size());
+    in.read(reinterpret_cast<char*>(kv.data()), kv.size());
+    if (!in) {
+        error = "Session file is truncated";
+        return false;
+    }
+
+    uint64_t actual = fnv1a(tokens.data(), tokens.size() * sizeof(llama_token));
+    actual = fnv1a(meta_str.data(), meta_str.size(), actual);
+    actual = fnv1a(kv.data(), kv.size(), actual);
+    if (actual != checksum) {
+        error = "Session file checksum mismatch";
+        return false;
+    }
+
+    const int32_t n_vocab = llama_vocab_n_tokens(rn_ctx->vocab);
+    for (llama_token t : tokens) {
+        if (t < 0 || t >= n_vocab) {
+            error = "Session file is corrupt";
+            return false;
+        }
+    }
+
+    session_meta meta;
+    try {
+        meta = session_meta_from_json(json::parse(meta_str));
+    } catch (const std::exception& e) {
+        error = std::string("Session metadata is invalid: ") + e.what();
+        return false;
+    }
+
+    rn_clear_sequence(rn_ctx, 0);
+    if (!kv.empty() && llama_state_seq_set_data(rn_ctx->ctx, kv.data(), kv.size(), 0) != kv.size()) {
+        rn_clear_sequence(rn_ctx, 0);
+        rn_ctx->kv_messages.clear();
+        rn_ctx->kv_has_messages = false;
+        rn_ctx->kv_render_identity.clear();
+        rn_ctx->kv_evicted_ids.clear();
+        error = "Failed to restore KV state (KV cache type or layout differs)";
+        return false;
+    }
+
+    rn_ctx->kv_tokens          = std::move(tokens);
+    rn_ctx->kv_messages        = std::move(meta.kv_messages);
+    rn_ctx->kv_has_messages    = meta.kv_has_messages;
+    rn_ctx->kv_render_identity = std::move(meta.kv_render_identity);
+    rn_ctx->kv_evicted_ids     = std::move(meta.kv_evicted_ids);
+    {
+        std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+        rn_ctx->completion_cache = std::move(meta.completion_cache);
+    }
+    return true;
+}
+
+namespace {
+
+// Entries are only erased under the inference gate the caller holds, so the pointer stays
+// valid after the map's mutex is dropped.
+rn_llama_context::chat_session* find_session(rn_llama_context* rn_ctx, int32_t session_id) {
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    auto it = rn_ctx->sessions.find(session_id);
+    return it != rn_ctx->sessions.end() ? &it->second : nullptr;
+}
+
+// The parked sessions may use what seq 0 does not: n_ctx minus its current length and a
+// quarter of n_ctx left for the request about to run. Least recently used sessions drop
+// their KV first; they keep their sequence and re-prefill when next activated.
+void evict_sessions(rn_llama_context* rn_ctx) {
+    const size_t n_ctx   = llama_n_ctx(rn_ctx->ctx);
+    const size_t reserve = rn_ctx->kv_tokens.size() + n_ctx / 4;
+    const size_t budget  = n_ctx > reserve ? n_ctx - reserve : 0;
+    llama_memory_t mem = llama_get_memory(rn_ctx->ctx);
+
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    size_t parked = 0;
+    for (const auto& [id, session] : rn_ctx->sessions) {
+        parked += session.parked.kv_tokens.size();
+    }
+    while (parked > budget) {
+        rn_llama_context::chat_session* lru = nullptr;
+        for (auto& [id, session] : rn_ctx->sessions) {
+            if (!session.parked.kv_tokens.empty() && (!lru || session.last_used < lru->last_used)) {
+                lru = &session;
+            }
+        }
+        if (!lru) {
+            break;
+        }
+        parked -= lru->parked.kv_tokens.size();
+        llama_memory_seq_rm(mem, lru->seq_id, -1, -1);
+        lru->parked = {};
+    }
+}
+
+} // namespace
+
+bool rn_create_session(rn_llama_context* rn_ctx, int32_t& session_id, std::string& error) {
+    const llama_seq_id seq_id = rn_acquire_seq(rn_ctx);
+    if (seq_id < 0) {
+        error = "No free sequence for a new session; raise n_seq_max";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    session_id = rn_ctx->next_session_id++;
+    rn_ctx->sessions[session_id].seq_id = seq_id;
+    return true;
+}
+
+bool rn_activate_session(rn_llama_context* rn_ctx, int32_t session_id, std::string& error) {
+    rn_llama_context::chat_session* target = nullptr;
+    if (session_id != 0) {
+        target = find_session(rn_ctx, session_id);
+        if (!target) {
+            error = "Unknown session " + std::to_string(session_id);
+            return false;
+        }
+        target->last_used = ++rn_ctx->session_clock;
+    }
+    if (rn_ctx->active_session == session_id) {
+        return true;
+    }
+
+    rn_park_active_session(rn_ctx);
+    if (target) {
+        // Moved, not shared: a context shift in seq 0 moves cell positions, which would
+        // corrupt a copy still referencing the same cells.
+        llama_memory_t mem = llama_get_memory(rn_ctx->ctx);
+        llama_memory_seq_cp(mem, target->seq_id, 0, -1, -1);
+        llama_memory_seq_rm(mem, target->seq_id, -1, -1);
+        rn_put_seq0_state(rn_ctx, std::move(target->parked));
+        target->parked = {};
+        rn_ctx->active_session = session_id;
+    }
+    evict_sessions(rn_ctx);
+    return true;
+}
+
+void rn_park_active_session(rn_llama_context* rn_ctx) {
+    rn_llama_context::chat_session* session =
+        rn_ctx->active_session != 0 ? find_session(rn_ctx, rn_ctx->active_session) : nullptr;
+    if (session) {
+        llama_memory_t mem = llama_get_memory(rn_ctx->ctx);
+        llama_memory_seq_rm(mem, session->seq_id, -1, -1);
+        llama_memory_seq_cp(mem, 0, session->seq_id, -1, -1);
+        session->parked = rn_take_seq0_state(rn_ctx);
+    } else {
+        if (rn_ctx->prefix_cache) {
+            rn_ctx->prefix_cache->store(rn_ctx->ctx, rn_ctx->kv_tokens);
+        }
+        rn_take_seq0_state(rn_ctx);
+    }
+    rn_clear_sequence(rn_ctx, 0);
+    rn_ctx->active_session = 0;
+}
+
+void rn_resume_session(rn_llama_context* rn_ctx, int32_t session_id) {
+    rn_llama_context::chat_session* session = session_id != 0 ? find_session(rn_ctx, session_id) : nullptr;
+    if (session) {
+        llama_memory_seq_rm(llama_get_memory(rn_ctx->ctx), session->seq_id, -1, -1);
+        session->parked = {};
+    }
+    // A session released while the request was parked leaves its conversation unnamed.
+    rn_ctx->active_session = session ? session_id : 0;
+}
+
+bool rn_release_session(rn_llama_context* rn_ctx, int32_t session_id) {
+    rn_llama_context::chat_session* session = session_id != 0 ? find_session(rn_ctx, session_id) : nullptr;
+    if (!session) {
+        return false;
+    }
+    if (rn_ctx->active_session == session_id) {
+        rn_take_seq0_state(rn_ctx);
+        rn_clear_sequence(rn_ctx, 0);
+        rn_ctx->active_session = 0;
+    }
+    rn_clear_sequence(rn_ctx, session->seq_id);
+    rn_release_seq(rn_ctx, session->seq_id);
+
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    rn_ctx->sessions.erase(session_id);
+    return true;
+}
+
+} // namespace facebook::react
@@ -0,0 +1,64 @@
+#pragma once
+
+// Sessions of one context, on disk and in memory.
+//
+// KV session persistence for seq 0. A session file holds the KV bytes of seq 0 together
+// with the bookkeeping that makes them reusable (kv_tokens, kv_messages,
+// kv_render_identity, completion_cache), so a relaunched app resumes with an exact
+// prefix hit instead of re-encoding the system prompt, tools and history.
+//
+// In-memory chat sessions (LlamaCppModel.createSession). Several conversations share the
+// model, the context and its KV cells. Requests still decode on seq 0: activating a
+// session moves the conversation in seq 0 into its owner's pooled sequence (with
+// seq0_state) and moves the target's back, both metadata-only copies on the unified KV
+// cache, so switching threads costs no prefill. When the parked sessions outgrow the KV
+// budget the least recently used ones drop their KV and re-prefill on their next turn.
+//
+// Apart from rn_create_session, callers must hold the lock that serializes seq 0
+// inference (LlamaCppModel::inference_gate_).
+
+#include "rn-llama.h"
+
+#include <cstdint>
+#include <string>
+
+namespace facebook::react {
+
+// Bumped whenever the on-disk layout changes; older files are rejected, not migrated.
+constexpr uint32_t RN_SESSION_VERSION = 1;
+
+// Identifies the loaded model without reading its weights: description, parameter count,
+// byte size and vocabulary/embedding/layer dimensions, hashed with FNV-1a.
+uint64_t rn_model_fingerprint(const llama_model* model);
+
+// Writes seq 0 to `path` (via a temporary file + rename, so a killed app never leaves a
+// truncated session behind). Returns false and sets `error` on failure.
+bool rn_save_session(rn_llama_context* rn_ctx, const std::string& path, std::string& error);
+
+// Restores seq 0 from `path`. Returns false and sets `error` when the file is missing,
+// has another version, was written for a different model or n_ctx, or is corrupt. Seq 0
+// is untouched by a rejected file, and cleared if llama.cpp refuses the KV bytes.
+bool rn_load_session(rn_llama_context* rn_ctx, const std::string& path, std::string& error);
+
+// Reserves a pooled sequence for a new, empty chat session. Returns false and sets `error`
+// when every sequence is taken (n_seq_max too small). Safe without the inference gate:
+// it touches no KV.
+bool rn_create_session(rn_llama_context* rn_ctx, int32_t& session_id, std::string& error);
+
+// Makes `session_id` (0 = the unnamed conversation) the one in seq 0 and evicts parked
+// sessions past the KV budget. False with `error` for an unknown id.
+bool rn_activate_session(rn_llama_context* rn_ctx, int32_t session_id, std::string& error);
+
+// Moves the active session out of seq 0 and leaves seq 0 empty to the unnamed
+// conversation. The unnamed conversation itself has no sequence to park in: it goes to
+// the prefix cache when one is enabled.
+void rn_park_active_session(rn_llama_context* rn_ctx);
+
+// After seq 0 was restored with `session_id`'s conversation (a preempted request
+// resuming): marks it active again and drops the copy parked in its own sequence.
+void rn_resume_session(rn_llama_context* rn_ctx, int32_t session_id);
+
+// Frees the session's KV and sequence. False for an unknown id.
+bool rn_release_session(rn_llama_context* rn_ctx, int32_t session_id);
+
+} // namespace facebook::react
@@ -0,0 +1,89 @@
+#include "rn-shared-prefix.h"
+// Suppress unused function warnings from llama.cpp headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "common.h"
+#include "llama.h"
+#pragma GCC diagnostic pop
+
+#include <algorithm>
+#include <mutex>
+
+namespace facebook::react {
+
+namespace {
+
+bool sharing_enabled(const rn_llama_context* rn_ctx) {
+    return rn_ctx->shared_prefix.seq_id >= 0 &&
+           !llama_model_is_recurrent(rn_ctx->model) && !llama_model_is_hybrid(rn_ctx->model);
+}
+
+} // namespace
+
+bool rn_shared_prefix_wanted(rn_llama_context* rn_ctx, const std::string& prompt_id) {
+    if (prompt_id.empty() || !sharing_enabled(rn_ctx)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    return rn_ctx->shared_prefix.tokens.empty() || rn_ctx->shared_prefix.prompt_id != prompt_id;
+}
+
+void rn_shared_prefix_store(
+    rn_llama_context* rn_ctx,
+    const std::string& prompt_id,
+    const std::vector<llama_token>& prefix_tokens,
+    const std::vector<llama_token>& prompt,
+    llama_seq_id seq_id) {
+    if (prompt_id.empty() || !sharing_enabled(rn_ctx)) {
+        return;
+    }
+    const size_t n = common_lcp(prefix_tokens, prompt);
+    if (n == 0) {
+        return;
+    }
+
+    auto& shared = rn_ctx->shared_prefix;
+    llama_memory_t mem = llama_get_memory(rn_ctx->ctx);
+    llama_memory_seq_rm(mem, shared.seq_id, -1, -1);
+    llama_memory_seq_cp(mem, seq_id, shared.seq_id, 0, static_cast<llama_pos>(n));
+    if (seq_id == 0) {
+        rn_ctx->kv_shared_len = std::max(rn_ctx->kv_shared_len, n);
+    }
+
+    std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+    shared.prompt_id = prompt_id;
+    shared.tokens.assign(prompt.begin(), prompt.begin() + n);
+}
+
+size_t rn_shared_prefix_attach(
+    rn_llama_context* rn_ctx,
+    const std::string& prompt_id,
+    const std::vector<llama_token>& prompt,
+    size_t n_common,
+    llama_seq_id seq_id) {
+    if (prompt_id.empty() || !sharing_enabled(rn_ctx)) {
+        return n_common;
+    }
+    auto& shared = rn_ctx->shared_prefix;
+    size_t n = 0;
+    {
+        std::lock_guard<std::mutex> lock(rn_ctx->mutex);
+        n = shared.tokens.size();
+        if (shared.prompt_id != prompt_id || n <= n_common || n >= prompt.size() ||
+            !std::equal(shared.tokens.begin(), shared.tokens.end(), prompt.begin())) {
+            return n_common;
+        }
+        shared.n_attached++;
+    }
+
+    rn_clear_sequence(rn_ctx, seq_id);
+    llama_memory_seq_cp(llama_get_memory(rn_ctx->ctx), shared.seq_id, seq_id, -1, -1);
+    if (seq_id == 0) {
+        rn_ctx->kv_tokens.assign(prompt.begin(), prompt.begin() + n);
+        rn_ctx->kv_shared_len = n;
+    }
+    return n;
+}
+
+} // namespace facebook::react
@@ -0,0 +1,51 @@
+#pragma once
+
+// One system prompt / tools prefix, prefilled once and shared by every sequence whose
+// prompt starts with it (initLlama shared_prefix).
+//
+// A chat request with a prompt_id for which nothing is shared yet renders its leading
+// system messages with the tools (CompletionOptions::shared_prefix_tokens). Once its
+// prompt is in the KV cache, the part of it matching that render is copied into the
+// reserved sequence with llama_memory_seq_cp, which on the unified KV cache shares the
+// cells instead of duplicating them. Later requests with the same prompt_id (a new chat,
+// a session's first turn, a scheduler slot last used by another conversation) attach
+// that sequence the same way and only prefill what follows. A new prompt_id replaces
+// the prefix; cells other sequences still hold stay theirs.
+//
+// Recurrent and hybrid models, whose state cannot be split at a position, do without.
+//
+// Callers hold the inference gate, except for rn_shared_prefix_wanted (mutex only).
+
+#include "rn-llama.h"
+
+#include <string>
+#include <vector>
+
+namespace facebook::react {
+
+// Whether a request with this prompt_id should render its prefix: sharing is on and
+// nothing is shared for this prompt_id yet.
+bool rn_shared_prefix_wanted(rn_llama_context* rn_ctx, const std::string& prompt_id);
+
+// After `seq_id` prefilled `prompt`: shares its first common_lcp(prefix_tokens, prompt)
+// tokens as the prefix of prompt_id.
+void rn_shared_prefix_store(
+    rn_llama_context* rn_ctx,
+    const std::string& prompt_id,
+    const std::vector<llama_token>& prefix_tokens,
+    const std::vector<llama_token>& prompt,
+    llama_seq_id seq_id);
+
+// When the shared prefix belongs to prompt_id, starts `prompt` (leaving at least one
+// token to decode) and is longer than the n_common tokens `seq_id` already holds, replaces
+// the sequence's KV with it. Returns the sequence's reusable prefix length: the prefix
+// length after an attach, n_common otherwise. Attaching to seq 0 also sets kv_tokens and
+// kv_shared_len.
+size_t rn_shared_prefix_attach(
+    rn_llama_context* rn_ctx,
+    const std::string& prompt_id,
+    const std::vector<llama_token>& prompt,
+    size_t n_common,
+    llama_seq_id seq_id);
+
+} // namespace facebook::react
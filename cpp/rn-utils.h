@@ -14,16 +14,21 @@
 #include "base64.hpp"
 #include "chat.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <random>
 #include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <unordered_map>
 #include <functional>
 #include <limits>
+#include <utility>
 
 using json = nlohmann::ordered_json;
 
@@ -39,6 +44,13 @@ enum rn_error_type {
     RN_ERROR_GENERAL         // General errors
 };
 
+// Priority classes of the inference gate (see rn-priority-gate.h); higher runs first.
+enum rn_priority {
+    RN_PRIORITY_BACKGROUND  = 0,
+    RN_PRIORITY_NORMAL      = 1,
+    RN_PRIORITY_INTERACTIVE = 2,
+};
+
 // CompletionOptions struct to represent parameters for completion requests
 //
 // Sampling fields use sentinel values to distinguish "not set by caller" from "explicitly set":
@@ -53,8 +65,20 @@ struct CompletionOptions {
     std::string model;   // model identifier
     json messages;       // for chat completions
     bool stream = false;
+    // Chat only: re-parse the streamed text after every chunk and report reasoning,
+    // content and tool-call deltas next to the raw text (see run_chat_completion).
+    bool stream_deltas = false;
     int n_predict = -1;  // -1 = unlimited; generation stops on EOS or stop strings
 
+    // Time budgets in ms from t_request, 0 = none. Checked before every prefill chunk and
+    // every decode; a miss ends the request with finish_reason "time". A first-token
+    // deadline also makes prefill ingest at full speed once the budget gets tight.
+    int max_time_ms             = 0;
+    int first_token_deadline_ms = 0;
+    // Internal: when the request arrived (set by LlamaCppModel when the JS call is parsed,
+    // so queueing on the inference lock counts against the budgets). Unset = run start.
+    std::chrono::steady_clock::time_point t_request{};
+
     // Sampling — NaN means "not set, use model default from initLlama"
     float temperature       = std::numeric_limits<float>::quiet_NaN();
     float top_p             = std::numeric_limits<float>::quiet_NaN();
@@ -73,10 +97,37 @@ struct CompletionOptions {
     bool use_jinja = false;
     int seed = -1;  // -1 = leave model's default seed unchanged; >=0 overrides (applied in run_completion)
     json tools;         // tools for function calling
+    uint64_t tools_hash = 0; // fnv1a_64 of tools.dump(), set where tools is parsed (0 = not set)
     std::string tool_choice = "auto"; // tool choice mode: "auto", "none", or "required"
     std::vector<common_grammar_trigger> grammar_triggers; // For lazy grammar
     std::set<llama_token> preserved_tokens; // single-token IDs that must not be split (from chat_params)
 
+    // Prompt-lookup speculative decoding: draft continuations by matching the last
+    // prompt_lookup_ngram tokens against the prompt and generated history.
+    bool prompt_lookup           = false;
+    int  prompt_lookup_ngram     = 3;   // longest n-gram tried
+    int  prompt_lookup_ngram_min = 2;   // shortest n-gram that may propose a draft
+    int  prompt_lookup_n_max     = 10;  // max tokens proposed per verify pass
+
+    // Independent choices generated from one prompt prefill (JS `n`). Choices 2..n run
+    // on pooled KV sequences forked from seq 0, so initLlama n_seq_max must be >= n.
+    int n_choices = 1;
+
+    // Beam search width (1 = sample normally). Each beam is a pooled KV sequence, so
+    // initLlama n_seq_max must be >= beam_width. With n > 1 the n best beams are returned.
+    int beam_width = 1;
+
+    // Per-token logprobs (JS `logprobs`): 0 = off, k > 0 records the sampled token's
+    // logprob and the k most likely alternatives at every step. Disables speculation.
+    int n_logprobs = 0;
+
+    // Queue class on the inference gate; also orders the batch scheduler's steps.
+    rn_priority priority = RN_PRIORITY_NORMAL;
+
+    // Chat session (createSession) the request continues; 0 = the model's unnamed
+    // conversation. Session requests run on seq 0, never on the batch scheduler.
+    int32_t session_id = 0;
+
     // KV cache control
     bool    reset_kv_cache = false; // force full KV cache clear even when message IDs match
 
@@ -84,10 +135,29 @@ struct CompletionOptions {
     // When >= 0, run_completion skips KV management and uses this value directly as n_past.
     int32_t kv_hint_pos = -1;
 
+    // Internal: set by run_chat_completion. [start, end) token spans of whole prompt
+    // messages a context shift may evict, contiguous and oldest first. Empty → shifts
+    // discard half of the tokens after n_keep regardless of message boundaries.
+    std::vector<std::pair<int32_t, int32_t>> shift_spans;
+
+    // Internal: set by run_chat_completion when nothing is shared for prompt_id yet. The
+    // tokens of the leading system messages and tools, shared once the prompt is prefilled
+    // (see rn-shared-prefix.h).
+    std::vector<llama_token> shared_prefix_tokens;
+
+    // Internal: the request's stop flag (its inference gate ticket's `cancelled`), set by
+    // stopCompletion(). The batch scheduler polls it; seq 0 requests see it through the
+    // gate they hold. Null for requests that cannot be stopped individually.
+    std::shared_ptr<const std::atomic<bool>> cancelled;
+
     // Set by run_chat_completion after mtmd_helper_eval_chunks so run_completion
     // skips its own encode step (prompt + images already in KV cache, logits ready).
     int32_t mtmd_encoded_n_past = -1;
 
+    // Internal: set by LlamaCppModel when the request is routed through the continuous
+    // batching scheduler. run_chat_completion then leaves seq 0 and kv_messages alone.
+    bool use_scheduler = false;
+
     // Completion cache key for system prompt + tools identity.
     std::string prompt_id;
 
@@ -111,6 +181,20 @@ struct CompletionTimings {
     int32_t prompt_n     = 0;
     double  prompt_ms    = 0.0;
     double  total_ms     = 0.0;
+    // Speculative decoding: tokens proposed by the drafter and how many the target accepted.
+    int32_t draft_n          = 0;
+    int32_t draft_n_accepted = 0;
+    // Target decode passes spent generating; predicted tokens / passes is the speedup.
+    int32_t decode_passes    = 0;
+};
+
+// One of the n choices of a completion with n > 1.
+struct CompletionChoice {
+    std::string              content;
+    std::vector<llama_token> tokens;
+    int                      n_predicted_tokens = 0;
+    bool                     stopped_by_length = false;
+    bool                     stopped_by_time = false;
 };
 
 // CompletionResult struct to hold completion response data
@@ -125,9 +209,20 @@ struct CompletionResult {
     json chat_response;
     CompletionTimings timings;
     bool stopped_by_length = false;
+    bool stopped_by_time = false;   // max_time_ms or first_token_deadline_ms hit
     bool tool_call_parse_failed = false;
     std::string tool_call_parse_error;
     bool context_shifted = false;  // true if context shift occurred during generation
+    int  n_shift_spans_evicted = 0; // leading shift_spans removed whole by context shifts
+    bool shift_misaligned = false;  // a shift cut at an arbitrary position (boundaries stale)
+    std::vector<CompletionChoice> choices; // every choice when n > 1 (choices[0] == content)
+
+    // Filled when n_logprobs > 0, one entry per element of `tokens`; top_* hold n_logprobs
+    // entries per token, most likely first (LLAMA_TOKEN_NULL / -inf past the vocabulary).
+    int                      n_logprobs = 0;
+    std::vector<float>       token_logprobs;
+    std::vector<llama_token> top_tokens;
+    std::vector<float>       top_logprobs;
 };
 
 // Utility functions
@@ -155,10 +250,51 @@ inline std::string gen_chatcmplid() {
     return "chatcmpl-" + result;
 }
 
+// finish_reason of a choice that did not end in a tool call.
+inline const char* finish_reason(bool stopped_by_length, bool stopped_by_time) {
+    return stopped_by_time ? "time" : stopped_by_length ? "length" : "stop";
+}
+
 inline bool ends_with(const std::string & str, const std::string & suffix) {
     return str.size() >= suffix.size() && 0 == str.compare(str.size() - suffix.size(), suffix.size(), suffix);
 }
 
+// FNV-1a over `data`, chained through `h`. Stable across runs and platforms, so hashes
+// may be persisted (session files).
+inline uint64_t fnv1a_64(std::string_view data, uint64_t h = 14695981039346656037ull) {
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Length of the incomplete UTF-8 sequence at the end of `text`: a lead byte whose
+// continuation bytes belong to a token not generated yet (CJK, emoji and other
+// multi-byte characters are often split across tokens). Looks at most at the last
+// three bytes, so streaming can call it per token without rescanning the text.
+inline size_t utf8_incomplete_tail(const std::string & text) {
+    const size_t n_max = std::min<size_t>(text.size(), 3);
+    for (size_t i = 1; i <= n_max; i++) {
+        const unsigned char c = static_cast<unsigned char>(text[text.size() - i]);
+        if ((c & 0xC0) == 0x80) {
+            continue; // continuation byte, keep looking for the lead byte
+        }
+        const size_t n_seq = (c & 0xE0) == 0xC0 ? 2
+                           : (c & 0xF0) == 0xE0 ? 3
+                           : (c & 0xF8) == 0xF0 ? 4
+                           : 1;
+        return n_seq > i ? i : 0;
+    }
+    return 0;
+}
+
+// Drops an incomplete trailing sequence once generation is over and it can no longer
+// be completed (e.g. a length limit hit between the bytes of one character).
+inline void utf8_trim_incomplete(std::string & text) {
+    text.resize(text.size() - utf8_incomplete_tail(text));
+}
+
 inline size_t find_partial_stop_string(const std::string &stop, const std::string &text) {
     if (!text.empty() && !stop.empty()) {
         const char text_last_char = text.back();
@@ -175,6 +311,122 @@ inline size_t find_partial_stop_string(const std::string &stop, const std::strin
     return std::string::npos;
 }
 
+// Aho-Corasick automaton over the stop strings of one request. build() runs once per
+// request; feed() then consumes each token's bytes without allocating and reports:
+//   - the earliest-starting stop string completed inside the fed chunk, and
+//   - partial_len(): the longest suffix of all text fed so far that is a proper prefix
+//     of some stop string — the bytes streaming has to hold back.
+// Both cost O(chunk length) amortized, independent of the number of stop strings.
+class rn_stop_matcher {
+public:
+    void build(const std::vector<std::string> & words) {
+        nodes_.assign(1, node{});
+        edges_.clear();
+        state_ = 0;
+        for (size_t w = 0; w < words.size(); w++) {
+            int32_t cur = 0;
+            for (unsigned char c : words[w]) {
+                int32_t next = child(cur, c);
+                if (next < 0) {
+                    next = static_cast<int32_t>(nodes_.size());
+                    nodes_.push_back(node{});
+                    nodes_[next].depth = nodes_[cur].depth + 1;
+                    edges_.push_back({c, next, nodes_[cur].first_edge});
+                    nodes_[cur].first_edge = static_cast<int32_t>(edges_.size()) - 1;
+                }
+                cur = next;
+            }
+            if (cur != 0 && nodes_[cur].out < 0) {
+                nodes_[cur].out     = static_cast<int32_t>(w);
+                nodes_[cur].out_len = nodes_[cur].depth;
+            }
+        }
+
+        // BFS for failure links. A node that ends no stop string inherits the longest one
+        // ending at its failure state (the longest stop string that is a suffix here).
+        std::vector<int32_t> queue;
+        queue.reserve(nodes_.size());
+        queue.push_back(0);
+        for (size_t qi = 0; qi < queue.size(); qi++) {
+            const int32_t u = queue[qi];
+            for (int32_t e = nodes_[u].first_edge; e >= 0; e = edges_[e].next) {
+                const int32_t v = edges_[e].target;
+                int32_t f = nodes_[u].fail;
+                while (f != 0 && child(f, edges_[e].byte) < 0) {
+                    f = nodes_[f].fail;
+                }
+                const int32_t fv = child(f, edges_[e].byte);
+                nodes_[v].fail = (u != 0 && fv >= 0) ? fv : 0;
+                if (nodes_[v].out < 0) {
+                    nodes_[v].out     = nodes_[nodes_[v].fail].out;
+                    nodes_[v].out_len = nodes_[nodes_[v].fail].out_len;
+                }
+                queue.push_back(v);
+            }
+        }
+    }
+
+    // Feeds `chunk`, which was appended to the text at offset `base`. Returns the text
+    // offset where the earliest completed stop string begins (its index in `word`), or
+    // npos if none completed.
+    size_t feed(std::string_view chunk, size_t base, int & word) {
+        size_t best = std::string::npos;
+        if (nodes_.size() <= 1) {
+            return best;
+        }
+        for (size_t i = 0; i < chunk.size(); i++) {
+            const unsigned char c = static_cast<unsigned char>(chunk[i]);
+            int32_t s = state_;
+            int32_t t = child(s, c);
+            while (t < 0 && s != 0) {
+                s = nodes_[s].fail;
+                t = child(s, c);
+            }
+            state_ = t < 0 ? 0 : t;
+            const node & n = nodes_[state_];
+            if (n.out >= 0) {
+                const size_t start = base + i + 1 - static_cast<size_t>(n.out_len);
+                if (start < best) {
+                    best = start;
+                    word = n.out;
+                }
+            }
+        }
+        return best;
+    }
+
+    size_t partial_len() const {
+        return nodes_.empty() ? 0 : static_cast<size_t>(nodes_[state_].depth);
+    }
+
+private:
+    struct node {
+        int32_t first_edge = -1;
+        int32_t fail       = 0;
+        int32_t depth      = 0;
+        int32_t out        = -1; // index of the longest stop string ending here
+        int32_t out_len    = 0;
+    };
+    struct edge {
+        unsigned char byte;
+        int32_t       target;
+        int32_t       next; // sibling list
+    };
+
+    int32_t child(int32_t n, unsigned char c) const {
+        for (int32_t e = nodes_[n].first_edge; e >= 0; e = edges_[e].next) {
+            if (edges_[e].byte == c) {
+                return edges_[e].target;
+            }
+        }
+        return -1;
+    }
+
+    std::vector<node> nodes_;
+    std::vector<edge> edges_;
+    int32_t           state_ = 0;
+};
+
 inline bool json_is_array_of_numbers(const json & data) {
     if (data.is_array()) {
         for (const auto & e : data) {
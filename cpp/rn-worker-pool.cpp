@@ -0,0 +1,132 @@
+#include "rn-worker-pool.h"
+
+#include <algorithm>
+
+namespace facebook::react {
+
+rn_worker_pool::rn_worker_pool(int n_threads, size_t max_queued)
+    : state_(std::make_shared<shared_state>()),
+      n_threads_(std::max(1, n_threads) + RN_WORKER_INTERACTIVE_THREADS),
+      max_queued_(std::max<size_t>(1, max_queued)) {
+    workers_.reserve(n_threads_);
+    for (int i = 0; i < n_threads_; i++) {
+        workers_.emplace_back(&rn_worker_pool::worker_loop, state_, i < RN_WORKER_INTERACTIVE_THREADS);
+    }
+}
+
+rn_worker_pool::~rn_worker_pool() {
+    shutdown();
+}
+
+bool rn_worker_pool::submit(std::function<void()> task, rn_priority priority) {
+    const std::shared_ptr<shared_state> state = state_; // a queued task may destroy *this
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->stopping) {
+            return false;
+        }
+        if (state->queue.size() >= max_queued_) {
+            state->rejected++;
+            return false;
+        }
+        // Behind every queued task of the same or a higher class.
+        auto it = std::find_if(state->queue.begin(), state->queue.end(),
+                               [priority](const queued_task& t) { return t.priority < priority; });
+        state->queue.insert(it, queued_task{std::move(task), priority});
+        state->peak_queued = std::max(state->peak_queued, state->queue.size());
+    }
+    // Not notify_one: it could wake an interactive-only worker for a task it cannot take.
+    state->cv.notify_all();
+    return true;
+}
+
+bool rn_worker_pool::accepting() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return !state_->stopping;
+}
+
+void rn_worker_pool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->stopping) {
+            return;
+        }
+        state_->stopping = true;
+    }
+    state_->cv.notify_all();
+
+    const std::thread::id self = std::this_thread::get_id();
+    for (auto& w : workers_) {
+        if (w.get_id() == self) {
+            w.detach(); // destroyed from one of our own tasks: this worker exits after it
+        } else if (w.joinable()) {
+            w.join();
+        }
+    }
+    workers_.clear();
+}
+
+void rn_worker_pool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->stopping) {
+            return;
+        }
+        state_->stopping = true;
+    }
+    state_->cv.notify_all();
+
+    // Workers only touch the shared state, which they keep alive themselves.
+    for (auto& w : workers_) {
+        w.detach();
+    }
+    workers_.clear();
+}
+
+rn_worker_pool::stats_t rn_worker_pool::stats() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    stats_t s;
+    s.n_threads   = n_threads_;
+    s.active      = state_->active;
+    s.queued      = state_->queue.size();
+    s.max_queued  = max_queued_;
+    s.peak_queued = state_->peak_queued;
+    s.completed   = state_->completed;
+    s.rejected    = state_->rejected;
+    return s;
+}
+
+void rn_worker_pool::worker_loop(std::shared_ptr<shared_state> state, bool interactive_only) {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (true) {
+        // The queue is ordered by class, so its front tells whether an interactive task
+        // waits. Once stopping, every worker helps drain whatever is left.
+        state->cv.wait(lock, [&] {
+            return state->stopping ||
+                   (!state->queue.empty() &&
+                    (!interactive_only || state->queue.front().priority == RN_PRIORITY_INTERACTIVE));
+        });
+        if (state->queue.empty()) {
+            return; // stopping, and everything queued before it has run
+        }
+        std::function<void()> fn = std::move(state->queue.front().fn);
+        state->queue.pop_front();
+        state->active++;
+        lock.unlock();
+
+        // Tasks settle their own Promise and catch their own exceptions; this is only a
+        // backstop so one stray throw cannot take the worker down. The task is destroyed
+        // before relocking, since its captures may own the pool's owner.
+        try {
+            fn();
+        } catch (...) {
+        }
+        fn = nullptr;
+
+        lock.lock();
+        state->active--;
+        state->completed++;
+    }
+}
+
+} // namespace facebook::react
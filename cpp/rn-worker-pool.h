@@ -0,0 +1,99 @@
+#pragma once
+
+// Long-lived worker threads for the async JSI methods, instead of one detached
+// std::thread per call.
+//
+// Tasks wait in a bounded queue, ordered by priority class and then by arrival, so a
+// full pool hands its next free worker to the most urgent request. submit() fails
+// instead of queueing past max_queued. A task waiting on the inference gate (or inside a
+// scheduled request) keeps its worker, so when every general worker is taken by long
+// requests the next task would sit in this queue, out of the gate's reach; the
+// RN_WORKER_INTERACTIVE_THREADS reserved workers run interactive tasks only, so one always
+// gets to the gate and preempts. shutdown() stops accepting tasks, lets the
+// queued ones run (they see the released model and settle their Promise), and joins
+// the workers. stop() does the same without waiting: the workers drain the queue and
+// exit on their own. The JS thread uses stop(), because a task may hand work to the JS
+// thread (invokeAsync) and a join there could wait on itself.
+//
+// The queue and the workers share a state block the workers keep alive. When the last
+// reference to the owner is dropped inside a task, the owner (and this pool) is
+// destroyed on a worker thread; that worker is detached instead of joined and exits on
+// its own.
+
+#include "rn-utils.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace facebook::react {
+
+// A model's pool runs n_parallel + RN_WORKER_EXTRA_THREADS workers: every scheduled
+// request holds one while it runs, and a seq 0 completion needs a second worker free for
+// a higher-priority request to wait on the inference gate and preempt it.
+constexpr int    RN_WORKER_EXTRA_THREADS       = 2;
+constexpr int    RN_WORKER_INTERACTIVE_THREADS = 1; // on top of n_threads, interactive tasks only
+constexpr size_t RN_WORKER_MAX_QUEUED          = 32;
+
+class rn_worker_pool {
+public:
+    struct stats_t {
+        int      n_threads   = 0; // including the interactive-only workers
+        int      active      = 0; // workers running a task (possibly waiting on the model)
+        size_t   queued      = 0;
+        size_t   max_queued  = 0;
+        size_t   peak_queued = 0;
+        uint64_t completed   = 0;
+        uint64_t rejected    = 0; // submit() calls refused by a full queue
+    };
+
+    // n_threads general workers plus RN_WORKER_INTERACTIVE_THREADS reserved ones.
+    rn_worker_pool(int n_threads, size_t max_queued);
+    ~rn_worker_pool();
+
+    rn_worker_pool(const rn_worker_pool&) = delete;
+    rn_worker_pool& operator=(const rn_worker_pool&) = delete;
+
+    // Queues `task`; false when the queue is full or the pool was shut down.
+    bool submit(std::function<void()> task, rn_priority priority = RN_PRIORITY_NORMAL);
+
+    // False once shutdown() has started.
+    [[nodiscard]] bool accepting() const;
+
+    // Idempotent; see the header comment. shutdown() after stop() is a no-op.
+    void shutdown();
+    void stop();
+
+    [[nodiscard]] stats_t stats() const;
+
+private:
+    struct queued_task {
+        std::function<void()> fn;
+        rn_priority           priority;
+    };
+
+    struct shared_state {
+        mutable std::mutex      mutex;
+        std::condition_variable cv;
+        std::deque<queued_task> queue; // highest priority first, FIFO within a class
+        bool                    stopping = false;
+        int                     active   = 0;
+        size_t                  peak_queued = 0;
+        uint64_t                completed   = 0;
+        uint64_t                rejected    = 0;
+    };
+
+    static void worker_loop(std::shared_ptr<shared_state> state, bool interactive_only);
+
+    std::shared_ptr<shared_state> state_;
+    std::vector<std::thread>      workers_;
+    int                           n_threads_;
+    size_t                        max_queued_;
+};
+
+} // namespace facebook::react
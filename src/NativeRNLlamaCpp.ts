@@ -17,7 +17,7 @@ export interface LlamaContextType {
 }
 
 export interface ModelLoadProgressEvent {
-  phase: 'model' | 'mmproj'; // which load phase this progress update belongs to
+  phase: 'model' | 'mmproj' | 'draft'; // which load phase this progress update belongs to
   progress: number;          // 0.0 - 1.0
 }
 
@@ -93,9 +93,48 @@ export interface LlamaModelParams {
   capabilities?: ModelCapability[]; // declare which modalities are active
 
   // Cooperative prompt-ingestion loop (values from loadLlamaModelInfo.suggestedChunkSize / isCpuOnly)
-  chunk_size?: number;   // tokens per decode call during prompt ingestion (default 128)
+  chunk_size?: number;   // initial tokens per decode call during prompt ingestion (default 128)
+  ingest_budget_ms?: number; // target compute per ingestion chunk; chunks adapt to it (default 12, 0 = fixed chunk_size)
   is_cpu_only?: boolean; // true = 2ms sleep/chunk
-  prompt_chunk_gap_ms?: number; // minimum inter-chunk gap on GPU path (default: 5ms)
+  prompt_chunk_gap_ms?: number; // inter-chunk sleep on GPU path (default: 5ms)
+
+  // Continuous batching
+  n_parallel?: number; // concurrent completion slots sharing one context (default 1 = serialized)
+  n_seq_max?: number;  // KV sequences to allocate (default n_parallel + 1 when n_parallel > 1)
+
+  // Speculative decoding
+  draft_model?: string;  // path to a small GGUF with the same vocabulary as `model`
+  draft_n_max?: number;  // max tokens drafted per model pass (default 8, 1–32)
+  draft_p_min?: number;  // stop drafting below this draft confidence (default 0.75)
+  // Prefix cache
+  prefix_cache_mb?: number; // RAM budget for cached KV of earlier conversations (default 0 = off)
+  shared_prefix?: boolean;  // share the system prompt/tools KV per prompt_id across sequences (one extra sequence; default false)
+  // KV cache and memory planning
+  cache_type_k?: 'f16' | 'q8_0' | 'q4_0'; // K cache precision (default 'f16')
+  cache_type_v?: 'f16' | 'q8_0' | 'q4_0'; // V cache precision (default 'f16'; quantized needs flash_attn)
+  flash_attn?: boolean | 'auto';          // flash attention (default 'auto': llama.cpp decides per device)
+  auto_plan?: boolean; // size n_ctx, n_batch, n_ubatch and unset cache types / flash_attn to free memory; n_ctx caps it
+}
+
+// Context size, KV cache types and batch sizes that fit the memory available to the app
+// (loadLlamaModelInfo().memoryPlan). The first six fields are initLlama options.
+export interface LlamaMemoryPlan {
+  n_ctx: number;
+  n_batch: number;
+  n_ubatch: number;
+  cache_type_k: 'f16' | 'q8_0' | 'q4_0';
+  cache_type_v: 'f16' | 'q8_0' | 'q4_0';
+  flash_attn: boolean | 'auto';
+  fits: boolean; // false when even a 512-token context does not fit (plan is best effort)
+  reason?: string; // why fits is false (including: available memory unknown)
+  bytes: {
+    available: number;    // memory the process can still use
+    weights: number;      // model (+ mmproj) file size
+    kv: number;
+    compute: number;      // llama.cpp compute buffers, estimated
+    headroom: number;     // left for the app
+    kv_per_token: number;
+  };
 }
 
 export interface LlamaCompletionParams {
@@ -109,11 +148,21 @@ export interface LlamaCompletionParams {
   min_p?: number;              // min-p sampling floor (native default: 0.05)
   n_predict?: number;          // max tokens to predict (default: -1, infinite)
   max_tokens?: number;         // alias for n_predic
+  max_time_ms?: number;        // end generation this long after the call, finish_reason 'time' (default: 0, none)
+  first_token_deadline_ms?: number; // end with finish_reason 'time' if no token by then; prefill speeds up to meet it (default: 0, none)
+  priority?: LlamaPriority;    // inference queue class; a higher class preempts a running lower one (default: 'normal')
+  session_id?: number;         // chat session to continue (set by LlamaSession.completion; default: 0, the unnamed conversation)
   n_keep?: number;             // parsed by native completion options (currently reserved/no-op in generation path)
   stop?: string[];             // stop sequences
   stream?: boolean;            // advisory; callback presence controls streaming behavior
+  stream_deltas?: boolean;     // chat only: add parsed reasoning/content/tool-call deltas to each callback (default: false)
   ignore_eos?: boolean;        // ignore EOS/EOG termination checks
   reset_kv_cache?: boolean;    // force KV cache reset for this request
+  // Prompt-lookup speculative decoding (no draft model needed)
+  prompt_lookup?: boolean;      // draft from n-gram matches in prompt + output (default: false)
+  prompt_lookup_ngram?: number; // longest n-gram matched (default: 3)
+  prompt_lookup_ngram_min?: number; // shortest n-gram that may draft (default: 2)
+  prompt_lookup_n_max?: number; // max tokens proposed per pass (default: 10, 1–32)
   // Chat parameters
   chat_template?: string;      // optional chat template name to use
 
@@ -127,11 +176,49 @@ export interface LlamaCompletionParams {
   frequency_penalty?: number;   // frequency penalty (default: 0.0)
   presence_penalty?: number;    // presence penalty (default: 0.0)
   seed?: number;                // RNG seed (default: -1, random)
+  n?: number;                   // independent choices from one prompt prefill (default 1, max 16; needs n_seq_max >= n)
+  beam_width?: number;          // deterministic beam search over this many beams (default 1 = off, max 8; needs n_seq_max >= beam_width)
+  logprobs?: number;            // record each token's logprob and this many top alternatives (default 0 = off, max 20)
   grammar?: string;             // GBNF grammar for structured outpu
   prompt_id?: string;           // cache key for system prompt/tools identity
   config_id?: string;           // cache key for effective completion config (include tools + main system prompt identity)
 }
 
+export interface PrefixCacheStats {
+  enabled: boolean;       // false when prefix_cache_mb is 0
+  hits: number;           // prompts that restored a cached prefix
+  misses: number;         // prompts that looked up the cache and found nothing longer
+  tokens_reused: number;  // prompt tokens not re-encoded thanks to hits
+  entries: number;
+  bytes: number;
+  budget_bytes: number;
+  shared_prefix_tokens: number; // tokens in the shared system prompt/tools prefix (0 = none)
+  shared_prefix_hits: number;   // prompts that attached the shared prefix instead of prefilling it
+}
+
+/**
+ * A conversation of its own inside a loaded model (see `createSession`). Sessions share the
+ * model, the context and its KV cells; switching between them re-encodes nothing until the
+ * KV budget forces the least recently used ones out.
+ */
+export interface LlamaSession {
+  readonly id: number;
+  /** `completion` of the model, continuing this session's conversation. */
+  completion(params: LlamaCompletionParams, partialCallback?: (data: LlamaPartialData) => void): Promise<LlamaCompletionResult> & { requestId: number };
+  /** Frees the session's KV cache and sequence; false if it was already released. */
+  release(): Promise<boolean>;
+}
+
+export interface WorkerPoolStats {
+  threads: number;      // n_parallel + 2 workers, fixed for the model's lifetime
+  active: number;       // workers running a call (including ones waiting for the model)
+  queued: number;       // calls waiting for a worker
+  max_queued: number;   // calls beyond this are rejected
+  peak_queued: number;
+  completed: number;
+  rejected: number;     // calls rejected by a full queue
+}
+
 export interface LlamaMessage {
   role: 'system' | 'user' | 'assistant' | 'tool';
   content: LlamaMessageContent;
@@ -171,15 +258,43 @@ export interface LlamaTool {
   };
 }
 
+// Parsed stream events (stream_deltas). Texts and arguments are fragments to append; a
+// tool call's arguments are complete at its tool_call_done event.
+export type LlamaStreamDelta =
+  | { type: 'reasoning_content' | 'content'; text: string }
+  | { type: 'tool_call'; index: number; id?: string; name?: string; arguments: string }
+  | { type: 'tool_call_done'; index: number };
+
+export interface LlamaPartialData {
+  token: string;                 // raw text generated since the previous callback
+  deltas?: LlamaStreamDelta[];   // present when stream_deltas is set and the parse moved on
+}
+
+// Per-token logprobs, packed: entry i describes tokens[i]; its alternatives are
+// top_tokens / top_logprobs[i * k .. i * k + k - 1], most likely first (-1 / -Infinity
+// past the vocabulary size).
+export interface LlamaLogprobs {
+  k: number;
+  tokens: Int32Array;
+  token_logprobs: Float32Array;
+  top_tokens: Int32Array;
+  top_logprobs: Float32Array;
+}
+
 export interface LlamaCompletionResult {
   text: string;                          // The generated completion tex
   tokens_predicted: number;              // Number of tokens generated
+  finish_reason?: 'stop' | 'length' | 'time'; // prompt completions; chat results report it per choice
   timings: {
     predicted_n: number;                 // Number of tokens predicted
     predicted_ms: number;                // Time spent generating tokens (ms)
     prompt_n: number;                    // Number of tokens in the promp
     prompt_ms: number;                   // Time spent processing prompt (ms)
     total_ms: number;                    // Total time spent (ms)
+    draft_n?: number;                    // Speculative decoding: tokens drafted (omitted when 0)
+    draft_n_accepted?: number;           // Speculative decoding: drafted tokens the model accepted
+    draft_acceptance_rate?: number;      // draft_n_accepted / draft_n
+    tokens_per_pass?: number;            // tokens generated per main-model pass (speedup vs 1.0)
   };
 
   // OpenAI-compatible response fields
@@ -197,10 +312,13 @@ export interface LlamaCompletionResult {
         }
       }>
     };
-    finish_reason: 'stop' | 'length' | 'tool_calls' | 'tool_call_parse_error';
+    finish_reason: 'stop' | 'length' | 'time' | 'tool_calls' | 'tool_call_parse_error';
     tool_call_parse_error?: string;
   }>;
 
+  logprobs?: LlamaLogprobs;              // present when the request set logprobs > 0
+  evicted_message_ids?: string[];        // chat: message IDs a context shift evicted (see README)
+
   // Tool calls may appear at different levels based on model response
   tool_calls?: Array<{
     id: string;                          // Unique identifier for the tool call
@@ -219,11 +337,12 @@ export interface EmbeddingOptions {
   add_bos_token?: boolean;        // Whether to add a beginning of sequence token (default: true)
   encoding_format?: 'float' | 'base64'; // Output encoding forma
   model?: string;                 // Model identifier (ignored, included for OpenAI compatibility)
+  priority?: LlamaPriority;       // queue class on the inference gate (default: 'normal')
 }
 
 export interface EmbeddingResponse {
   data: Array<{
-    embedding: number[] | string; // Can be array of numbers or base64 string
+    embedding: Float32Array | string; // Float32Array, or a base64 string with encoding_format 'base64'
     index: number;
     object: 'embedding';
     encoding_format?: 'base64';   // Present only when base64 encoding is used
@@ -237,7 +356,7 @@ export interface EmbeddingResponse {
 }
 
 export interface ImageEmbedResult {
-  embedding: number[];  // flat float32 array, length = n_tokens * n_embd
+  embedding: Float32Array;  // flat, length = n_tokens * n_embd
   n_tokens: number;     // number of vision tokens
   n_embd: number;       // embedding dimension
 }
@@ -263,9 +382,16 @@ export interface DetectionResult {
   objects: DetectedObject[];
 }
 
+// Queue class on the native inference gate: interactive > normal > background.
+export type LlamaPriority = 'interactive' | 'normal' | 'background';
+
 export interface LlamaContextMethods {
-  completion(params: LlamaCompletionParams, partialCallback?: (data: {token: string}) => void): Promise<LlamaCompletionResult>;
-  completionSync(params: LlamaCompletionParams, partialCallback?: (data: {token: string}) => void): LlamaCompletionResult;
+  /**
+   * The returned Promise carries `requestId`, which `stopCompletion(requestId)` accepts to
+   * cancel this request alone, whether it is queued, running or preempted.
+   */
+  completion(params: LlamaCompletionParams, partialCallback?: (data: LlamaPartialData) => void): Promise<LlamaCompletionResult> & { requestId: number };
+  completionSync(params: LlamaCompletionParams, partialCallback?: (data: LlamaPartialData) => void): LlamaCompletionResult;
 
   // Updated tokenize method to match server.cpp interface
   tokenize(options: {
@@ -273,12 +399,12 @@ export interface LlamaContextMethods {
     add_special?: boolean;
     with_pieces?: boolean;
   }): Promise<{
-    tokens: (number | {id: number, piece: string | number[]})[]
+    tokens: Int32Array | {id: number, piece: string | number[]}[] // Int32Array without with_pieces
   }>;
 
   // New detokenize method
   detokenize(options: {
-    tokens: number[]
+    tokens: number[] | Int32Array
   }): Promise<{
     content: string
   }>;
@@ -291,9 +417,20 @@ export interface LlamaContextMethods {
    */
   embedding(options: EmbeddingOptions): Promise<EmbeddingResponse>;
   detectTemplate(messages: LlamaMessage[]): Promise<string>;
+  /**
+   * Restore the KV cache, cached token sequence, message IDs and completion cache
+   * saved by `saveSession`. Resolves false when the file is missing or was written
+   * for another model, `n_ctx` or file-format version.
+   */
   loadSession(path: string): Promise<boolean>;
+  /** Persist the current KV cache and its bookkeeping so a relaunch skips prefill. */
   saveSession(path: string): Promise<boolean>;
-  stopCompletion(): Promise<void>;
+  /**
+   * Without an id: stop every completion issued so far (queued, running, scheduled or
+   * preempted); later ones are unaffected. With the
+   * `requestId` of a completion() Promise: stop that request only; false once it finished.
+   */
+  stopCompletion(requestId?: number): boolean;
 
   /**
    * Set the number of CPU threads used for inference (thermal management).
@@ -311,6 +448,30 @@ export interface LlamaContextMethods {
    */
   setNThreads(n: number): void;
 
+  /**
+   * Report the app lifecycle state (e.g. from React Native `AppState`).
+   *
+   * `'background'` and `'idle'` let prompt ingestion run at full speed: no frame budget,
+   * no yields between chunks. Any other state restores the paced default. Non-blocking;
+   * applies from the next ingestion chunk, including in a prompt already being encoded.
+   * ```ts
+   * AppState.addEventListener('change', (s) => model.setAppState(s));
+   * ```
+   */
+  setAppState(state: 'active' | 'inactive' | 'background' | 'idle' | string): void;
+
+  /** Hit/miss counters and memory use of the in-RAM prefix cache (`prefix_cache_mb`). */
+  getPrefixCacheStats(): PrefixCacheStats;
+
+  /** Queue depth and counters of the worker threads that run this model's async calls. */
+  getWorkerPoolStats(): WorkerPoolStats;
+
+  /**
+   * Open a chat session with its own KV sequence (needs n_seq_max > 1; each session holds
+   * one of its n_seq_max - 1 pooled sequences until `release()`). Throws when none is free.
+   */
+  createSession(): LlamaSession;
+
   /**
    * Release the model and free all associated GPU/CPU memory.
    *
@@ -339,24 +500,25 @@ export interface LlamaContextMethods {
     audioSampleRate?: number;
   }>;
 
-  embedImage(imagePath: string, options?: { normalize?: boolean }): Promise<ImageEmbedResult>;
+  embedImage(imagePath: string, options?: { normalize?: boolean; priority?: LlamaPriority }): Promise<ImageEmbedResult>;
 
-  transcribeAudio(audioPath: string, options?: { language?: string }): Promise<TranscriptResult>;
+  transcribeAudio(audioPath: string, options?: { language?: string; priority?: LlamaPriority }): Promise<TranscriptResult>;
 
-  visionReasoning(imagePath: string, options?: { prompt?: string }): Promise<{ raw_text: string }>;
+  visionReasoning(imagePath: string, options?: { prompt?: string; priority?: LlamaPriority }): Promise<{ raw_text: string }>;
 
   runOnFrame(
     buffer: Object,
     width: number,
     height: number,
     capability: ModelCapability,
-    options?: { maxSize?: number },
+    options?: { maxSize?: number; priority?: LlamaPriority }, // priority default: 'interactive'
   ): Promise<ImageEmbedResult | TranscriptResult | DetectionResult | LlamaCompletionResult | null>;
 }
 
 export interface Spec extends TurboModule {
   // Fires during initLlama() while the GGUF model (phase: 'model') and, if
-  // mmproj was supplied, the multimodal projector (phase: 'mmproj') load.
+  // mmproj was supplied, the multimodal projector (phase: 'mmproj') load, and the
+  // speculative draft model (phase: 'draft') when draft_model was supplied.
   // Purely advisory — initLlama()'s resolved Promise is the source of truth
   // for "loading finished".
   readonly onModelLoadProgress: EventEmitter<ModelLoadProgressEvent>;
@@ -382,6 +544,7 @@ export interface Spec extends TurboModule {
     mmprojSizeMB?: number;      // present when mmprojPath was supplied
     suggestedChunkSize: number; // recommended chunk_size for initLlama (32=CPU, 128=GPU)
     isCpuOnly: boolean;         // true when optimalGpuLayers == 0
+    memoryPlan: LlamaMemoryPlan; // largest context that fits; spread into initLlama or use auto_plan
     samplingDefaults?: {
       temperature?: number;
       top_p?: number;
@@ -467,6 +630,7 @@ export function loadLlamaModelInfo(
   mmprojSizeMB?: number;
   suggestedChunkSize: number;
   isCpuOnly: boolean;
+  memoryPlan: LlamaMemoryPlan;
   samplingDefaults?: {
     temperature?: number;
     top_p?: number;
@@ -4,6 +4,7 @@ export {
   initLlama,
   type LlamaModel,
   type LlamaModelParams,
+  type LlamaMemoryPlan,
   type LlamaCompletionParams,
   type LlamaContextType,
   type LlamaMessage,
@@ -13,8 +14,15 @@ export {
   type JsonSchemaProperty,
   type LlamaTool,
   type LlamaCompletionResult,
+  type LlamaLogprobs,
+  type LlamaStreamDelta,
+  type LlamaPartialData,
+  type LlamaPriority,
+  type LlamaSession,
   type EmbeddingOptions,
   type EmbeddingResponse,
   type LlamaContextMethods,
+  type PrefixCacheStats,
+  type WorkerPoolStats,
   type Spec,
 } from './NativeRNLlamaCpp';